@@ -0,0 +1,305 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <capture.h>
+#include <latency_histogram.h>
+#include <logger.h>
+#include <opc/ua/protocol/binary/common.h>
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+
+// The types of the records of a capture file
+#define RECORD_NODE		'N'
+#define RECORD_NOTIFICATION	'V'
+
+using namespace std;
+
+/**
+ * Collects the bytes written by the binary serializer
+ */
+class RecordBuffer
+{
+	public:
+		void	Send(const char *data, size_t size)
+			{
+				record.insert(record.end(), data, data + size);
+			};
+		vector<char>	record;
+};
+
+/**
+ * Supplies the bytes of a record to the binary deserializer
+ */
+class RecordSupplier : public OpcUa::Binary::DataSupplier
+{
+	public:
+		RecordSupplier(const vector<char>& record) : m_record(record), m_pos(0) {};
+		size_t	Read(char *buffer, size_t size) override
+			{
+				if (size > m_record.size() - m_pos)
+				{
+					throw runtime_error("Truncated record in capture file");
+				}
+				memcpy(buffer, m_record.data() + m_pos, size);
+				m_pos += size;
+				return size;
+			};
+	private:
+		const vector<char>&	m_record;
+		size_t			m_pos;
+};
+
+/**
+ * Destructor, closes the capture file
+ */
+NotificationCapture::~NotificationCapture()
+{
+	close();
+}
+
+/**
+ * Start recording notifications to a file, replacing any existing file.
+ * Any capture already in progress is closed first.
+ *
+ * @param path	The path of the capture file
+ * @throws runtime_error if the file can not be created
+ */
+void
+NotificationCapture::open(const string& path)
+{
+	close();
+	lock_guard<mutex> guard(m_mutex);
+	m_file = fopen(path.c_str(), "wb");
+	if (!m_file)
+	{
+		throw runtime_error("Unable to create capture file " + path + ": " + strerror(errno));
+	}
+	uint32_t version = CAPTURE_VERSION;
+	if (fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), m_file) != strlen(CAPTURE_MAGIC)
+			|| fwrite(&version, sizeof(version), 1, m_file) != 1)
+	{
+		fclose(m_file);
+		m_file = NULL;
+		throw runtime_error("Unable to write capture file " + path + ": " + strerror(errno));
+	}
+	m_path = path;
+	m_start = monotonicTimeMicros();
+	m_recorded = 0;
+	m_open = true;
+	Logger::getLogger()->info("Recording notifications to %s", path.c_str());
+}
+
+/**
+ * Stop recording and close the capture file
+ */
+void
+NotificationCapture::close()
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_open = false;
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = NULL;
+		Logger::getLogger()->info("Recorded %lu notifications to %s",
+				(unsigned long)m_recorded, m_path.c_str());
+	}
+	m_nodes.clear();
+	m_path.clear();
+}
+
+/**
+ * Record a data change notification. If the file can not be written the
+ * capture is abandoned rather than failing the notification.
+ *
+ * @param handle	The handle of the monitored item
+ * @param nodeId	The variable
+ * @param assetPath	The asset path of the variable
+ * @param value		The value, status and timestamps received
+ * @param critical	The notification was received on the critical subscription
+ */
+void
+NotificationCapture::record(uint32_t handle, const OpcUa::NodeId& nodeId, const string& assetPath,
+		const OpcUa::DataValue& value, bool critical)
+{
+	if (!m_open)
+	{
+		return;
+	}
+	int64_t offset = monotonicTimeMicros() - m_start;
+	lock_guard<mutex> guard(m_mutex);
+	if (!m_file)
+	{
+		return;
+	}
+	try {
+		uint32_t index;
+		auto it = m_nodes.find(nodeId);
+		if (it == m_nodes.end())
+		{
+			index = m_nodes.size();
+			m_nodes[nodeId] = index;
+			OpcUa::Binary::DataSerializer serializer;
+			serializer << (uint8_t)RECORD_NODE << index << nodeId << assetPath;
+			RecordBuffer buffer;
+			serializer.Flush(buffer);
+			write(buffer.record);
+		}
+		else
+		{
+			index = it->second;
+		}
+		OpcUa::Binary::DataSerializer serializer;
+		serializer << (uint8_t)RECORD_NOTIFICATION << offset << handle << index
+			<< (uint8_t)(critical ? 1 : 0) << value;
+		RecordBuffer buffer;
+		serializer.Flush(buffer);
+		write(buffer.record);
+		m_recorded++;
+	} catch (exception& e) {
+		Logger::getLogger()->error("Abandoning the capture to %s: %s", m_path.c_str(), e.what());
+		fclose(m_file);
+		m_file = NULL;
+		m_open = false;
+	}
+}
+
+/**
+ * Write a record to the capture file, preceded by its length
+ *
+ * @param record	The serialized record
+ * @throws runtime_error if the record can not be written
+ */
+void
+NotificationCapture::write(const vector<char>& record)
+{
+	uint32_t length = record.size();
+	if (fwrite(&length, sizeof(length), 1, m_file) != 1
+			|| fwrite(record.data(), 1, record.size(), m_file) != record.size())
+	{
+		throw runtime_error(strerror(errno));
+	}
+}
+
+/**
+ * Open a capture file to read back
+ *
+ * @param path	The path of the capture file
+ * @throws runtime_error if the file can not be read or is not a capture file
+ */
+CaptureReader::CaptureReader(const string& path)
+{
+	m_file = fopen(path.c_str(), "rb");
+	if (!m_file)
+	{
+		throw runtime_error("Unable to open capture file " + path + ": " + strerror(errno));
+	}
+	char magic[sizeof(CAPTURE_MAGIC) - 1];
+	uint32_t version;
+	if (fread(magic, 1, sizeof(magic), m_file) != sizeof(magic)
+			|| memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0
+			|| fread(&version, sizeof(version), 1, m_file) != 1)
+	{
+		fclose(m_file);
+		throw runtime_error(path + " is not a capture file");
+	}
+	if (version != CAPTURE_VERSION)
+	{
+		fclose(m_file);
+		throw runtime_error("Unsupported version " + to_string(version) + " of capture file " + path);
+	}
+	m_first = ftell(m_file);
+}
+
+/**
+ * Destructor, closes the capture file
+ */
+CaptureReader::~CaptureReader()
+{
+	fclose(m_file);
+}
+
+/**
+ * Read the next notification from the capture file
+ *
+ * @param notification	Populated with the notification
+ * @return		False at the end of the capture
+ */
+bool
+CaptureReader::next(CapturedNotification& notification)
+{
+	vector<char> record;
+	while (read(record))
+	{
+		RecordSupplier supplier(record);
+		OpcUa::Binary::DataDeserializer deserializer(supplier);
+		uint8_t type;
+		uint32_t index;
+		deserializer >> type;
+		if (type == RECORD_NODE)
+		{
+			OpcUa::NodeId nodeId;
+			string assetPath;
+			deserializer >> index >> nodeId >> assetPath;
+			if (index >= m_nodeIds.size())
+			{
+				m_nodeIds.resize(index + 1);
+				m_assetPaths.resize(index + 1);
+			}
+			m_nodeIds[index] = nodeId;
+			m_assetPaths[index] = assetPath;
+		}
+		else if (type == RECORD_NOTIFICATION)
+		{
+			uint8_t critical;
+			deserializer >> notification.offset >> notification.handle >> index
+				>> critical >> notification.value;
+			if (index >= m_nodeIds.size())
+			{
+				throw runtime_error("Notification for an unknown variable in capture file");
+			}
+			notification.nodeId = m_nodeIds[index];
+			notification.assetPath = m_assetPaths[index];
+			notification.critical = critical != 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Return to the first notification of the capture file
+ */
+void
+CaptureReader::rewind()
+{
+	fseek(m_file, m_first, SEEK_SET);
+	m_nodeIds.clear();
+	m_assetPaths.clear();
+}
+
+/**
+ * Read the next record of the capture file. A record cut short, because
+ * the capture was not closed, is treated as the end of the file.
+ *
+ * @param record	Populated with the record
+ * @return		False at the end of the file
+ */
+bool
+CaptureReader::read(vector<char>& record)
+{
+	uint32_t length;
+	if (fread(&length, sizeof(length), 1, m_file) != 1)
+	{
+		return false;
+	}
+	record.resize(length);
+	return fread(record.data(), 1, length, m_file) == length;
+}
@@ -0,0 +1,185 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <conversion_pool.h>
+#include <opcua.h>
+
+// The number of readings a conversion thread hands to the ingest queues at a time
+#define CONVERSION_BATCH	500
+
+using namespace std;
+
+/**
+ * Constructor for the conversion pool
+ *
+ * @param opcua	The plugin instance the readings are ingested by
+ */
+ConversionPool::ConversionPool(OPCUA *opcua) : m_opcua(opcua), m_running(false)
+{
+}
+
+/**
+ * Destructor for the conversion pool
+ */
+ConversionPool::~ConversionPool()
+{
+	stop();
+}
+
+/**
+ * Start the conversion threads
+ *
+ * @param threads	The number of threads, and shards, to convert with
+ */
+void
+ConversionPool::start(int threads)
+{
+	if (m_running || threads <= 0)
+	{
+		return;
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		Shard *shard = new Shard();
+		shard->thread = new thread(&ConversionPool::convertThread, this, shard);
+		m_shards.push_back(shard);
+	}
+	m_running = true;
+	Logger::getLogger()->info("Converting data change notifications on %d threads", threads);
+}
+
+/**
+ * Stop the conversion threads once the notifications already queued
+ * have been converted and ingested
+ */
+void
+ConversionPool::stop()
+{
+	m_running = false;
+	for (auto shard : m_shards)
+	{
+		{
+			lock_guard<mutex> guard(shard->mutex);
+			shard->running = false;
+		}
+		shard->cv.notify_all();
+		shard->thread->join();
+		delete shard->thread;
+		delete shard;
+	}
+	m_shards.clear();
+}
+
+/**
+ * Queue a data change notification to be converted by the thread of
+ * the shard of its monitored item
+ *
+ * @param client	The handler the notification was received by
+ * @param handle	The handle of the monitored item
+ * @param node		The variable
+ * @param value		The value of the variable
+ * @param received	The time the notification was received
+ */
+void
+ConversionPool::dispatch(OpcUaClient *client, uint32_t handle, const OpcUa::Node& node,
+		const OpcUa::DataValue& value, const OpcUa::DateTime& received)
+{
+	Shard *shard = m_shards[handle % m_shards.size()];
+	lock_guard<mutex> guard(shard->mutex);
+	shard->queue.emplace_back(client, node, value, received);
+	shard->queued++;
+	if (shard->queue.size() == 1)
+	{
+		shard->cv.notify_all();
+	}
+}
+
+/**
+ * Wait for the notifications queued so far to be converted and their
+ * readings ingested. Called before the handlers the notifications refer
+ * to are destroyed. Notifications queued after the call are not waited
+ * for, so a busy server can not hold up the caller.
+ */
+void
+ConversionPool::drain()
+{
+	for (auto shard : m_shards)
+	{
+		unique_lock<mutex> lck(shard->mutex);
+		uint64_t target = shard->queued;
+		shard->cv.wait(lck, [shard, target] { return shard->converted >= target; });
+	}
+}
+
+/**
+ * Return the number of notifications waiting to be converted
+ */
+uint64_t
+ConversionPool::getBacklog()
+{
+	uint64_t backlog = 0;
+	for (auto shard : m_shards)
+	{
+		lock_guard<mutex> guard(shard->mutex);
+		backlog += shard->queued - shard->converted;
+	}
+	return backlog;
+}
+
+/**
+ * The thread of a shard. All the notifications queued since the thread
+ * last woke are taken in one go and converted outside the lock, the
+ * readings being handed to the ingest queue of their lane every
+ * CONVERSION_BATCH readings.
+ *
+ * @param shard	The shard to convert the notifications of
+ */
+void
+ConversionPool::convertThread(Shard *shard)
+{
+	vector<PendingConversion> batch;
+	vector<Reading *> bulk, critical;
+	unique_lock<mutex> lck(shard->mutex);
+	while (true)
+	{
+		shard->cv.wait(lck, [shard] { return !shard->queue.empty() || !shard->running; });
+		if (shard->queue.empty())
+		{
+			break;
+		}
+		batch.swap(shard->queue);
+		lck.unlock();
+
+		for (auto& pending : batch)
+		{
+			Reading *reading = pending.client->convert(pending.node, pending.value,
+					pending.received, monotonicTimeMicros());
+			if (!reading)
+			{
+				continue;
+			}
+			vector<Reading *>& lane = pending.client->isCritical() ? critical : bulk;
+			lane.push_back(reading);
+			if (lane.size() >= CONVERSION_BATCH)
+			{
+				m_opcua->ingest(lane, &lane == &critical);
+				lane.clear();
+			}
+		}
+		m_opcua->ingest(critical, true);
+		m_opcua->ingest(bulk, false);
+		critical.clear();
+		bulk.clear();
+
+		lck.lock();
+		shard->converted += batch.size();
+		batch.clear();
+		shard->cv.notify_all();
+	}
+}
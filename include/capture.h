@@ -0,0 +1,100 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdio.h>
+#include <opc/ua/node.h>
+
+// The first bytes of a capture file and the version of its format
+#define CAPTURE_MAGIC	"OPCUACAP"
+#define CAPTURE_VERSION	1
+
+/**
+ * A data change notification read back from a capture file
+ */
+class CapturedNotification
+{
+	public:
+		CapturedNotification() : offset(0), handle(0), critical(false) {};
+		int64_t		offset;		// Microseconds since the capture started
+		uint32_t	handle;		// The handle of the monitored item
+		OpcUa::NodeId	nodeId;		// The variable
+		std::string	assetPath;	// The asset path of the variable
+		bool		critical;	// Received on the critical subscription
+		OpcUa::DataValue value;		// The value, status and timestamps
+};
+
+/**
+ * Records the data change notifications received by the plugin to a
+ * compact binary file, so the conversion and ingest of the readings can
+ * be replayed without a server.
+ *
+ * The file starts with CAPTURE_MAGIC and CAPTURE_VERSION, followed by
+ * records each preceded by their length. The first time a variable is
+ * seen a node record gives its NodeId and asset path an index; each
+ * notification record then refers to the variable by that index and
+ * holds the DataValue in the OPC UA binary encoding, so that the value
+ * is replayed exactly as it was received.
+ */
+class NotificationCapture
+{
+	public:
+		NotificationCapture() : m_file(NULL), m_open(false), m_start(0), m_recorded(0) {};
+		~NotificationCapture();
+		void		open(const std::string& path);
+		void		close();
+		bool		isOpen() const { return m_open; };
+		const std::string&
+				getPath() const { return m_path; };
+		void		record(uint32_t handle, const OpcUa::NodeId& nodeId,
+					const std::string& assetPath, const OpcUa::DataValue& value,
+					bool critical);
+		uint64_t	getRecorded() const { return m_recorded; };
+
+	private:
+		void		write(const std::vector<char>& record);
+		std::string	m_path;
+		FILE		*m_file;
+		std::atomic<bool>
+				m_open;
+		int64_t		m_start;
+		uint64_t	m_recorded;
+		std::map<OpcUa::NodeId, uint32_t>
+				m_nodes;
+		std::mutex	m_mutex;
+};
+
+/**
+ * Reads the notifications back from a capture file, in the order they
+ * were received
+ */
+class CaptureReader
+{
+	public:
+		CaptureReader(const std::string& path);
+		~CaptureReader();
+		bool		next(CapturedNotification& notification);
+		void		rewind();
+
+	private:
+		bool		read(std::vector<char>& record);
+		FILE		*m_file;
+		long		m_first;
+		std::vector<OpcUa::NodeId>
+				m_nodeIds;
+		std::vector<std::string>
+				m_assetPaths;
+};
+#endif
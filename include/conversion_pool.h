@@ -0,0 +1,86 @@
+#ifndef _CONVERSION_POOL_H
+#define _CONVERSION_POOL_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <opc/ua/node.h>
+
+class OPCUA;
+class OpcUaClient;
+
+/**
+ * A data change notification waiting to be converted to a reading
+ */
+class PendingConversion
+{
+	public:
+		PendingConversion(OpcUaClient *client, const OpcUa::Node& node,
+				const OpcUa::DataValue& value, const OpcUa::DateTime& received) :
+			client(client), node(node), value(value), received(received) {};
+		OpcUaClient		*client;
+		OpcUa::Node		node;
+		OpcUa::DataValue	value;
+		OpcUa::DateTime		received;
+};
+
+/**
+ * A pool of threads that convert data change notifications to readings,
+ * so that the conversion of the values of many variables is spread over
+ * several cores rather than done on the thread that receives them.
+ *
+ * The notifications are divided into shards by their monitored item
+ * handle, each shard with its own queue and thread. All the values of a
+ * variable are therefore converted by the same thread, in the order they
+ * were received, and the readings of a variable are ingested in order.
+ * Each thread hands the readings it has converted to the ingest queues
+ * in batches.
+ */
+class ConversionPool
+{
+	public:
+		ConversionPool(OPCUA *opcua);
+		~ConversionPool();
+		void		start(int threads);
+		void		stop();
+		bool		isRunning() const { return m_running; };
+		void		dispatch(OpcUaClient *client, uint32_t handle, const OpcUa::Node& node,
+					const OpcUa::DataValue& value, const OpcUa::DateTime& received);
+		void		drain();
+		uint64_t	getBacklog();
+
+	private:
+		/**
+		 * The queue of notifications of a shard and the thread
+		 * that converts them
+		 */
+		class Shard
+		{
+			public:
+				Shard() : thread(NULL), running(true), queued(0), converted(0) {};
+				std::vector<PendingConversion>
+						queue;
+				std::thread	*thread;
+				bool		running;
+				uint64_t	queued;
+				uint64_t	converted;
+				std::mutex	mutex;
+				std::condition_variable
+						cv;
+		};
+		void			convertThread(Shard *shard);
+		OPCUA			*m_opcua;
+		std::vector<Shard *>	m_shards;
+		std::atomic<bool>	m_running;
+};
+#endif
@@ -0,0 +1,54 @@
+#ifndef _COUNTER_H
+#define _COUNTER_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE	64
+
+/**
+ * A statistics counter that is updated from many threads. Each counter
+ * is aligned and padded to a cache line of its own so that the threads
+ * updating neighbouring counters do not contend for the same cache line.
+ */
+class alignas(CACHE_LINE_SIZE) Counter
+{
+	public:
+		Counter() : m_value(0) {};
+		void		increment(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); };
+		uint64_t	value() const { return m_value.load(std::memory_order_relaxed); };
+
+	private:
+		std::atomic<uint64_t>	m_value;
+		char			m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+};
+static_assert(sizeof(Counter) == CACHE_LINE_SIZE, "A counter must fill one cache line");
+
+/**
+ * A base for classes that hold counters and are created with new. Before
+ * C++17 operator new only guarantees the alignment of the fundamental
+ * types, so the counters would not start on a cache line.
+ */
+class CacheAligned
+{
+	public:
+		static void	*operator new(size_t size)
+				{
+					void *p;
+					if (posix_memalign(&p, CACHE_LINE_SIZE, size) != 0)
+						throw std::bad_alloc();
+					return p;
+				};
+		static void	operator delete(void *p) { free(p); };
+};
+#endif
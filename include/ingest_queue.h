@@ -0,0 +1,77 @@
+#ifndef _INGEST_QUEUE_H
+#define _INGEST_QUEUE_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <reading.h>
+#include <latency_histogram.h>
+#include <counter.h>
+#include <spill_buffer.h>
+
+/**
+ * A queue of readings waiting to be sent to the south service, with the
+ * thread that sends them. Each queue records the time its readings wait
+ * to be ingested so that the latency of each queue can be reported.
+ */
+class IngestQueue
+{
+	public:
+		IngestQueue(const std::string& name);
+		~IngestQueue();
+		const std::string&
+				getName() const { return m_name; };
+		void		registerIngest(void *data, void (*cb)(void *, Reading))
+				{
+					m_ingest = cb;
+					m_data = data;
+				}
+		void		start();
+		void		stop();
+		void		push(Reading *reading);
+		void		push(const std::vector<Reading *>& readings);
+		void		setSpill(SpillBuffer *spill, size_t threshold)
+				{
+					m_spill = spill;
+					m_spillThreshold = threshold;
+				};
+		uint64_t	getBacklog();
+		int64_t		getIngestLatency() const { return m_ingestLatency; };
+		uint64_t	getIngested() const { return m_ingested.value(); };
+		LatencyHistogram&
+				getLatencyHistogram() { return m_latency; };
+
+	private:
+		void				ingestThread();
+		bool				spill(Reading *reading);
+		void				drainSpill();
+		std::string			m_name;
+		void				(*m_ingest)(void *, Reading);
+		void				*m_data;
+		std::thread			*m_thread;
+		bool				m_running;
+		std::vector<std::pair<Reading *, int64_t> >
+						m_queue;
+		int64_t				m_oldestQueued;
+		std::atomic<uint64_t>		m_backlog;
+		std::atomic<int64_t>		m_ingestLatency;
+		LatencyHistogram		m_latency;
+		Counter				m_ingested;
+		SpillBuffer			*m_spill;
+		size_t				m_spillThreshold;
+		bool				m_spilling;
+		std::mutex			m_mutex;
+		std::condition_variable		m_cv;
+};
+#endif
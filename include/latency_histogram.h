@@ -0,0 +1,63 @@
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+// Number of linear sub-buckets within each power of two
+#define HISTOGRAM_SUB_BUCKETS	16
+
+// Number of buckets, enough for values up to 2^40 microseconds
+#define HISTOGRAM_BUCKETS	(HISTOGRAM_SUB_BUCKETS * 40)
+
+/**
+ * Return a monotonic time in milliseconds
+ */
+inline int64_t monotonicTime()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Return a monotonic time in microseconds
+ */
+inline int64_t monotonicTimeMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A histogram of latencies in microseconds. As in an HDR histogram the
+ * width of the buckets grows with the value, so every value is counted
+ * with a precision of 1/HISTOGRAM_SUB_BUCKETS over the whole range.
+ * Recording a value is a single atomic increment, so the histogram can
+ * be updated from any thread without locking.
+ */
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram();
+		void		record(int64_t micros);
+		void		reset();
+		uint64_t	count() const;
+		int64_t		percentile(double percent) const;
+		int64_t		max() const { return m_max; };
+
+	private:
+		static int	bucket(int64_t value);
+		static int64_t	bucketValue(int bucket);
+		std::atomic<uint64_t>	m_counts[HISTOGRAM_BUCKETS];
+		std::atomic<int64_t>	m_max;
+};
+#endif
@@ -0,0 +1,95 @@
+#ifndef _OBJECT_SHADOW_H
+#define _OBJECT_SHADOW_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <sys/time.h>
+#include <reading.h>
+
+/**
+ * The latest values of the variables of objects, from which one reading
+ * per object is built rather than one reading per variable.
+ *
+ * The asset name of the reading of a variable is split at the path
+ * delimiter. The first segments, up to the object level, name the
+ * object and its reading; the remaining segments become nested
+ * dictionary datapoints of the reading of the object, with the value of
+ * the variable at the leaf. The readings of the variables are applied
+ * to the shadow as they arrive and the readings of the objects built
+ * when the shadow is flushed, holding either only the values that have
+ * changed since the last flush or every value of the object.
+ */
+class ObjectShadow
+{
+	public:
+		ObjectShadow();
+		~ObjectShadow();
+		void		configure(int level, const std::string& delimiter, bool full);
+		bool		isEnabled() const { return m_level > 0; };
+		void		update(Reading *reading);
+		void		update(const std::vector<Reading *>& readings);
+		void		flush(std::vector<Reading *>& readings);
+		void		clear();
+		size_t		getObjects();
+
+	private:
+		/**
+		 * The value of a variable and whether it has changed since the
+		 * shadow was last flushed
+		 */
+		class Leaf
+		{
+			public:
+				Leaf(const DatapointValue& value) : value(value), changed(true) {};
+				DatapointValue	value;
+				bool		changed;
+		};
+		/**
+		 * A level of the hierarchy below an object
+		 */
+		class Branch
+		{
+			public:
+				Branch() : changed(false) {};
+				~Branch();
+				Branch		*child(const std::string& name);
+				std::map<std::string, Leaf>
+						leaves;
+				std::map<std::string, Branch *>
+						branches;
+				bool		changed;
+		};
+		/**
+		 * An object and the timestamp of its latest value
+		 */
+		class Object
+		{
+			public:
+				Object() : changed(false) { timestamp.tv_sec = 0; timestamp.tv_usec = 0; };
+				Branch		root;
+				struct timeval	timestamp;
+				bool		changed;
+		};
+		void		apply(Reading *reading);
+		std::vector<Datapoint *>
+				*build(Branch& branch);
+		std::map<std::string, Object *>
+				m_objects;
+		std::atomic<int>
+				m_level;
+		std::string	m_delimiter;
+		bool		m_full;
+		std::mutex	m_mutex;
+};
+#endif
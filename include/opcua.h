@@ -16,7 +16,22 @@
 #include <reading.h>
 #include <logger.h>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <set>
+#include <memory>
 #include <stdlib.h>
+#include <ingest_queue.h>
+#include <type_dictionary.h>
+#include <tag_file.h>
+#include <counter.h>
+#include <capture.h>
+#include <conversion_pool.h>
+#include <object_shadow.h>
 
 enum class AssetNameType
 {
@@ -28,72 +43,536 @@ enum class AssetNameType
 	FullPathWithBrowseName
 };
 
+// Request sizes used with a server that does not report a limit
+#define DEFAULT_MAX_NODES_PER_READ		1000
+#define DEFAULT_MAX_NODES_PER_WRITE		1000
+#define DEFAULT_MAX_NODES_PER_BROWSE		1000
+#define DEFAULT_MAX_MONITORED_ITEMS_PER_CALL	1000
+
+/**
+ * The maximum size of the requests made to a server. These are set from
+ * the OperationLimits of the server and reduced if the server rejects a
+ * request because it contains too many operations.
+ */
+class OperationLimits
+{
+	public:
+		OperationLimits() : maxNodesPerRead(DEFAULT_MAX_NODES_PER_READ),
+			maxNodesPerWrite(DEFAULT_MAX_NODES_PER_WRITE),
+			maxNodesPerBrowse(DEFAULT_MAX_NODES_PER_BROWSE),
+			maxMonitoredItemsPerCall(DEFAULT_MAX_MONITORED_ITEMS_PER_CALL),
+			maxBrowseContinuationPoints(0) {};
+		uint32_t	maxNodesPerRead;
+		uint32_t	maxNodesPerWrite;
+		uint32_t	maxNodesPerBrowse;
+		uint32_t	maxMonitoredItemsPerCall;
+		uint32_t	maxBrowseContinuationPoints;
+};
+
+/**
+ * An object node browsed during discovery. The position of the node in
+ * the browse is recorded so that the subtree below it can be browsed
+ * again, on its own, when the address space of the server changes.
+ */
+class BrowsedNode
+{
+	public:
+		BrowsedNode() : hasParent(false), active(false), fingerprint(0) {};
+		OpcUa::NodeId	parent;
+		bool		hasParent;
+		std::string	parentPath;
+		bool		active;
+		uint64_t	fingerprint;
+};
+
 class OpcUaClient;
+// The number of OPC UA built in data types, the VariantTypes
+#define VARIANT_TYPES	26
+
+class OPCUAServer;
 
-class OPCUA
+class OPCUA : public CacheAligned
 {
 	public:
 		OPCUA(const std::string& url);
 		~OPCUA();
 		void		clearSubscription();
 		void		addSubscription(const std::string& parent);
+		std::vector<std::string>
+				getSubscriptions();
+		void		clearServers();
+		void		addServer(const std::string& url, const std::string& backupURL = "");
+		void		setBackupURL(const std::string& url) { m_backupURL = url; };
+		void		setKeepAliveTimeout(long value) { m_keepAliveTimeout = value; };
+		long		getKeepAliveTimeout() const { return m_keepAliveTimeout; };
+		bool		getOperationLimits(const std::string& url, OperationLimits& limits);
+		void		setOperationLimits(const std::string& url, const OperationLimits& limits);
+		bool		getEndpoint(const std::string& url, OpcUa::EndpointDescription& endpoint);
+		void		setEndpoint(const std::string& url, const OpcUa::EndpointDescription& endpoint);
+		void		clearEndpoint(const std::string& url);
 		void		setAssetName(const std::string& name);
 		void		setPathDelimiter(const std::string& delmiter);
+		const std::string&
+				getPathDelimiter() const { return m_pathDelimiter; };
 		void		setAssetNameSource(const std::string& assetNameSource);
-		std::string	getAssetPath(const OpcUa::NodeId& nodeId);
 		std::string getNodeName(const OpcUa::Node& node);
+		std::string	NodeIdString(const OpcUa::Node& node);
+		std::string	createAssetName(const OpcUa::Node& node, const std::string subscriptionPath);
 		void		restart();
 		void		newURL(const std::string& url) { m_url = url; };
 		void		subscribeById(bool byId) { m_subscribeById = byId; };
+		bool		isSubscribeById() const { return m_subscribeById; };
 		void		start();
-		void		stop();
-		void		ingest(std::vector<Datapoint *> & points, const std::string & assetPath, OpcUa::DateTime sourceTimestamp);
+		void		stop(bool keepSessions = false);
+		void		ingest(std::vector<Datapoint *> & points, const std::string & assetPath,
+					OpcUa::DateTime sourceTimestamp, bool critical = false);
+		void		ingest(const std::vector<Reading *>& readings, bool critical);
+		void		ingest(Reading *reading, bool critical);
+		void		recordLatency(const OpcUa::DataValue& dval, const OpcUa::DateTime& received,
+					int64_t conversion);
+		void		setStatisticsInterval(long value) { m_statisticsInterval = value; };
+		void		notificationReceived() { m_notifications.increment(); };
+		void		valueDropped() { m_dropped.increment(); };
+		void		conversionFailed(OpcUa::VariantType type)
+				{
+					if ((int)type < VARIANT_TYPES)
+						m_conversionFailures[(int)type].increment();
+				};
+		Reading		*createReading(std::vector<Datapoint *> & points, const std::string & assetPath,
+					OpcUa::DateTime sourceTimestamp);
+		void		setInitialSnapshot(bool snapshot) { m_initialSnapshot = snapshot; };
+		bool		getInitialSnapshot() const { return m_initialSnapshot; };
+		std::vector<OpcUa::StatusCode>
+				write(const std::vector<std::pair<std::string, std::string> >& values);
 		void		setReportingInterval(long value);
+		long		getReportingInterval() const { return m_reportingInterval; };
+		long		getPublishingInterval() const { return m_reportingInterval * m_throttle; };
+		void		clearCriticalTags();
+		void		addCriticalTag(const std::string& pattern);
+		bool		hasCriticalTags();
+		bool		isCritical(const OpcUa::Node& node, const std::string& assetPath);
+		void		setCriticalInterval(long value) { m_criticalInterval = value; };
+		long		getCriticalInterval() const { return m_criticalInterval; };
+		void		setTagFile(const std::string& path);
+		const std::vector<Tag>&
+				getTags() const { return m_tagFile.getTags(); };
+		const Tag	*findTag(const OpcUa::NodeId& nodeId) const { return m_tagFile.find(nodeId); };
+		void		setModelCheckInterval(long value) { m_modelCheckInterval = value; };
+		long		getModelCheckInterval() const { return m_modelCheckInterval; };
+		void		setAdaptiveSampling(bool enable) { m_adaptiveSampling = enable; };
+		void		setBacklogLimits(long high, long low, long latency)
+				{
+					m_backlogHigh = high;
+					m_backlogLow = low;
+					m_backlogLatency = latency;
+				};
+		void		setPublishRequests(int value) { m_publishRequests = value; };
+		int		getPublishRequests() const { return m_publishRequests; };
+		void		setMaxNotificationsPerPublish(uint32_t value) { m_maxNotificationsPerPublish = value; };
+		uint32_t	getMaxNotificationsPerPublish() const { return m_maxNotificationsPerPublish; };
+		void		setLifetimeCount(uint32_t value) { m_lifetimeCount = value; };
+		uint32_t	getLifetimeCount() const { return m_lifetimeCount; };
+		void		setKeepAliveCount(uint32_t value) { m_keepAliveCount = value; };
+		uint32_t	getKeepAliveCount() const { return m_keepAliveCount; };
 		void		registerIngest(void *data, void (*cb)(void *, Reading))
 				{
-					m_ingest = cb;
-					m_data = data;
+					m_bulkQueue.registerIngest(data, cb);
+					m_criticalQueue.registerIngest(data, cb);
 				}
+		void		setCaptureFile(const std::string& path);
+		void		setSpill(const std::string& path, long size, long threshold, bool overwrite);
+		bool		isCapturing() const { return m_capture.isOpen(); };
+		void		capture(uint32_t handle, const OpcUa::NodeId& nodeId, const std::string& assetPath,
+					const OpcUa::DataValue& value, bool critical)
+				{
+					m_capture.record(handle, nodeId, assetPath, value, critical);
+				};
+		uint64_t	replay(CaptureReader& reader, bool realTime);
+		void		setConversionThreads(int threads) { m_conversionThreads = threads; };
+		bool		isConverting() const { return m_conversionPool.isRunning(); };
+		void		dispatch(OpcUaClient *client, uint32_t handle, const OpcUa::Node& node,
+					const OpcUa::DataValue& value, const OpcUa::DateTime& received)
+				{
+					m_conversionPool.dispatch(client, handle, node, value, received);
+				};
+		void		drainConversions() { m_conversionPool.drain(); };
+		void		setObjectReadings(int level, bool full)
+				{
+					m_objectLevel = level;
+					m_fullObjects = full;
+				};
 
 	private:
-		int					addSubscribe(const OpcUa::Node& node, std::string& subscriptionParentPath, bool active);
+		void				monitorThread();
+		void				checkBacklog();
+		void				reportStatistics(int64_t elapsed);
+		void				reportCounters(int64_t elapsed, std::vector<Datapoint *>& points);
+		void				flushObjects();
+		void				reportLatency(const std::string& stage, LatencyHistogram& latency,
+							std::vector<Datapoint *>& points);
+		OPCUAServer			*createServer(const std::string& url, const std::string& backupURL,
+							int index);
+		void				closeSessions();
 		std::vector<std::string>	m_subscriptions;
 		std::string			m_url;
+		std::string			m_backupURL;
+		std::vector<std::string>	m_serverURLs;
+		std::map<std::string, std::string>
+						m_backupURLs;
+		std::vector<OPCUAServer *>	m_servers;
+		std::mutex			m_serversMutex;
+		std::vector<std::pair<OPCUAServer *, OPCUAServer *> >
+						m_redundantPairs;
+		std::vector<OPCUAServer *>	m_singleServers;
+		long				m_keepAliveTimeout;
+		std::thread			*m_monitorThread;
+		bool				m_monitoring;
+		std::mutex			m_monitorMutex;
+		std::condition_variable		m_monitorCV;
+		std::map<std::string, OperationLimits>
+						m_operationLimits;
+		std::mutex			m_limitsMutex;
+		std::map<std::string, OpcUa::EndpointDescription>
+						m_endpoints;
+		std::map<std::string, std::unique_ptr<OpcUa::UaClient> >
+						m_sessions;
 		std::string			m_asset;
 		std::string			m_pathDelimiter;
-		OpcUa::UaClient			*m_client;
-		void				(*m_ingest)(void *, Reading);
-		void				*m_data;
-		OpcUaClient			*m_subClient;
-		OpcUa::Subscription::SharedPtr	m_sub;
 		std::mutex			m_configMutex;
 		bool				m_subscribeById;
-		bool				m_connected;
 		bool				m_useBrowseName;
 		long				m_reportingInterval;
+		int				m_publishRequests;
+		uint32_t			m_maxNotificationsPerPublish;
+		uint32_t			m_lifetimeCount;
+		uint32_t			m_keepAliveCount;
 		AssetNameType		m_assetNameType;
-		std::map<OpcUa::NodeId, std::string> m_assetPathNames;
-		std::string			createAssetName(const OpcUa::Node& node, const std::string subscriptionPath);
-		std::string			NodeIdString(const OpcUa::Node& node);
+		std::vector<std::string>	m_criticalTags;
+		long				m_criticalInterval;
+		long				m_modelCheckInterval;
+		TagFile				m_tagFile;
+		bool				m_initialSnapshot;
+		SpillBuffer			m_spill;
+		IngestQueue			m_bulkQueue;
+		IngestQueue			m_criticalQueue;
+		int64_t				m_lastLatencyReport;
+		long				m_statisticsInterval;
+		LatencyHistogram		m_sourceLatency;
+		LatencyHistogram		m_networkLatency;
+		LatencyHistogram		m_conversionLatency;
+		Counter				m_notifications;
+		Counter				m_dropped;
+		Counter				m_conversionFailures[VARIANT_TYPES];
+		uint64_t			m_lastNotifications;
+		uint64_t			m_lastIngested;
+		bool				m_adaptiveSampling;
+		long				m_backlogHigh;
+		long				m_backlogLow;
+		long				m_backlogLatency;
+		std::atomic<int>		m_throttle;
+		int				m_pressureChecks;
+		int				m_drainedChecks;
+		NotificationCapture		m_capture;
+		int				m_conversionThreads;
+		ConversionPool			m_conversionPool;
+		int				m_objectLevel;
+		bool				m_fullObjects;
+		ObjectShadow			m_objects;
 		void				getNodeFullPath(const OpcUa::Node& node, std::string& fullPath);
 };
 
+/**
+ * A connection to a single OPC UA server. Each server has its own
+ * session, subscription and discovery state; the readings from all
+ * the servers of a plugin instance are funnelled into the ingest
+ * queue of the owning OPCUA instance.
+ *
+ * The server is watched for changes to its address space by the model
+ * change events it publishes and by periodically comparing a fingerprint
+ * of each browsed object, less often if the server accepts a subscription
+ * to the events. Only the objects that have changed are browsed again.
+ *
+ * Critical tags are subscribed to on a second subscription of the
+ * session, which keeps its own reporting interval and whose readings
+ * are sent through the critical ingest queue.
+ *
+ * A server may be one half of a redundant pair, in which case the
+ * standby server keeps its session and subscriptions open but its
+ * data change notifications are discarded until it is made active.
+ * Its subscriptions are published at a long interval meanwhile, and
+ * the current values of its variables are read when it is made active.
+ *
+ * The session and subscriptions are created and released by the thread
+ * that starts or recovers the server, while other threads, such as the
+ * monitor thread changing the publishing interval and the thread writing
+ * values, use them. The client, subscriptions and their handlers are
+ * only replaced with m_clientMutex held, and the other threads hold it
+ * for as long as they use them.
+ */
+class OPCUAServer
+{
+	public:
+		OPCUAServer(OPCUA *opcua, const std::string& url);
+		~OPCUAServer();
+		const std::string&
+				getURL() const { return m_url; };
+		bool		isConnected() const { return m_connected; };
+		void		setActive(bool active);
+		void		setTagServer(const std::set<std::string>& keys) { m_tagServer = keys; };
+		bool		isActive() const { return m_active; };
+		void		alive();
+		bool		isAlive(long timeout);
+		std::string	getAssetPath(const OpcUa::NodeId& nodeId);
+		void		setAssetPath(const OpcUa::NodeId& nodeId, const std::string& path);
+		void		updateTimestamp(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp);
+		void		expectInitialValues(const std::vector<OpcUa::ReadValueId>& items);
+		bool		isInitialValue(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp);
+		bool		isReported(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp);
+		void		checkOverflow(OpcUa::StatusCode status);
+		void		statusChange(OpcUa::StatusCode status);
+		void		setPublishingInterval(long interval);
+		bool		inDeadband(const OpcUa::NodeId& nodeId, const DatapointValue& value, double deadband);
+		void		modelEvent(const OpcUa::Event& event);
+		bool		decodeStructure(const OpcUa::ExtensionObject& object, DatapointValue& value)
+				{
+					return m_types.decode(object, value);
+				};
+		int		writeValues(const std::vector<std::pair<std::string, std::string> >& values,
+					const std::string& asset, std::vector<OpcUa::StatusCode>& status,
+					std::vector<bool>& resolved);
+		uint64_t	getQueueOverflows() const { return m_queueOverflows; };
+		uint64_t	getStatusChanges() const { return m_statusChanges; };
+		void		start();
+		void		startInBackground();
+		void		stop();
+		std::unique_ptr<OpcUa::UaClient>
+				park();
+		void		adopt(std::unique_ptr<OpcUa::UaClient> client) { m_adopted = std::move(client); };
+		void		recover();
+		bool		isDiscovering() const { return m_discovering; };
+		int		getDiscoveryProgress();
+		uint64_t	getDiscoveryDuration() const { return m_discoveryDuration; };
+		uint64_t	getNodesBrowsed() const { return m_nodesBrowsed; };
+		uint64_t	getItemsSubscribed() const { return m_itemsSubscribed; };
+		uint64_t	getItemsFailed() const { return m_itemsFailed; };
+		uint64_t	getReconnects() const { return m_reconnects; };
+		uint64_t	getReconnectLatency() const { return m_reconnectLatency; };
+		uint64_t	getMaxReconnectLatency() const { return m_maxReconnectLatency; };
+		uint64_t	getLostNotifications() const { return m_lostNotifications; };
+
+	private:
+		int				addSubscribe(const OpcUa::Node& node, std::string& subscriptionParentPath, bool active);
+		void				connect();
+		void				probeLimits();
+		void				setLimits(const OperationLimits& limits);
+		void				reduceLimit(std::atomic<uint32_t>& limit, uint32_t failed, const char *name);
+		void				discover();
+		int				resubscribe();
+		std::vector<OpcUa::DataValue>	readAttributes(const std::vector<OpcUa::NodeId>& nodes,
+							OpcUa::AttributeId attribute,
+							OpcUa::TimestampsToReturn timestamps = OpcUa::TimestampsToReturn::Neither);
+		void				snapshot(const std::vector<OpcUa::Node>& nodes,
+							const std::vector<OpcUa::DataValue>& values, bool critical);
+		void				disconnect();
+		void				stopRecovery();
+		void				joinThreads();
+		void				release();
+		void				startKeepAlive();
+		void				keepAlive();
+		void				modelThread();
+		void				checkModel();
+		void				resolveTypes();
+		int				rescan(const OpcUa::NodeId& nodeId);
+		int				addTags();
+		int				foundVariable(const OpcUa::Node& var, const OpcUa::NodeId& parent,
+							const std::string& assetPath);
+		void				recoverThread();
+		void				startThread();
+		int				browsed();
+		int				queueSubscribe(const OpcUa::Node& node);
+		int				flushSubscribe();
+		int				flushItems(std::vector<OpcUa::Node>& pending,
+							OpcUa::Subscription::SharedPtr sub);
+		void				queueItem(const OpcUa::Node& node, const std::string& assetPath);
+		OpcUa::Subscription::SharedPtr	createSubscription(OpcUaClient& handler, long interval,
+							uint8_t priority);
+		void				setRates();
+		void				modifySubscription(OpcUa::Subscription::SharedPtr sub, long interval,
+							uint8_t priority);
+		OPCUA				*m_opcua;
+		std::string			m_url;
+		std::vector<std::string>	m_subscriptions;
+		std::set<std::string>		m_tagServer;
+		std::unique_ptr<OpcUa::UaClient> m_client;
+		std::unique_ptr<OpcUa::UaClient> m_adopted;
+		std::unique_ptr<OpcUaClient>	m_subClient;
+		OpcUa::Subscription::SharedPtr	m_sub;
+		std::unique_ptr<OpcUaClient>	m_criticalClient;
+		OpcUa::Subscription::SharedPtr	m_criticalSub;
+		std::mutex			m_clientMutex;
+		std::atomic<bool>		m_connected;
+		std::atomic<bool>		m_active;
+		std::atomic<int64_t>		m_lastAlive;
+		std::thread			*m_keepAliveThread;
+		std::thread			*m_modelThread;
+		std::thread			*m_recoverThread;
+		bool				m_running;
+		std::atomic<bool>		m_stopping;
+		bool				m_recovering;
+		std::mutex			m_stateMutex;
+		std::condition_variable		m_stateCV;
+		std::map<std::string, bool>	m_subscriptionVariables;
+		std::mutex			m_itemMutex;
+		std::map<OpcUa::NodeId, std::string> m_assetPathNames;
+		std::map<OpcUa::NodeId, OpcUa::VariantType> m_writeTypes;
+		std::map<OpcUa::NodeId, int64_t> m_lastTimestamps;
+		std::map<OpcUa::NodeId, double>	m_deadbandValues;
+		std::map<OpcUa::NodeId, std::pair<bool, int64_t> > m_initialValues;
+		std::set<OpcUa::NodeId>		m_resubscribed;
+		std::mutex			m_browseMutex;
+		std::map<OpcUa::NodeId, BrowsedNode> m_browsedNodes;
+		std::map<OpcUa::NodeId, OpcUa::NodeId> m_itemParents;
+		std::map<OpcUa::NodeId, std::pair<bool, uint32_t> > m_itemHandles;
+		bool				m_scanning;
+		std::map<OpcUa::NodeId, std::string> m_scanned;
+		std::set<OpcUa::NodeId>		m_modelChanges;
+		std::atomic<bool>		m_modelEvents;
+		TypeDictionary			m_types;
+		int64_t				m_gapStart;
+		std::atomic<uint64_t>		m_reconnects;
+		std::atomic<uint64_t>		m_reconnectLatency;
+		std::atomic<uint64_t>		m_maxReconnectLatency;
+		std::atomic<uint64_t>		m_lostNotifications;
+		std::atomic<bool>		m_discovering;
+		std::atomic<int64_t>		m_discoveryStart;
+		std::atomic<uint64_t>		m_discoveryDuration;
+		std::atomic<uint64_t>		m_nodesBrowsed;
+		std::atomic<uint64_t>		m_nodesPending;
+		std::atomic<uint64_t>		m_itemsSubscribed;
+		std::atomic<uint64_t>		m_itemsFailed;
+		std::vector<OpcUa::Node>	m_pendingItems;
+		std::vector<OpcUa::Node>	m_pendingCritical;
+		std::atomic<uint32_t>		m_maxNodesPerRead;
+		std::atomic<uint32_t>		m_maxNodesPerWrite;
+		std::atomic<uint32_t>		m_maxNodesPerBrowse;
+		std::atomic<uint32_t>		m_maxMonitoredItemsPerCall;
+		std::atomic<uint32_t>		m_maxBrowseContinuationPoints;
+		std::atomic<uint64_t>		m_queueOverflows;
+		std::atomic<uint64_t>		m_statusChanges;
+		int64_t				m_oldestPending;
+		int64_t				m_lastProgress;
+};
+
 class OpcUaClient : public OpcUa::SubscriptionHandler
 { 
 	public:
-	  	OpcUaClient(OPCUA *opcua) : m_opcua(opcua) {};
+	  	OpcUaClient(OPCUA *opcua, OPCUAServer *server, bool critical) :
+			m_opcua(opcua), m_server(server), m_critical(critical) {};
 		void DataValueChange(uint32_t handle,
 				const OpcUa::Node & node,
 				const OpcUa::DataValue & dval,
 				OpcUa::AttributeId attr) override
+		{
+			int64_t receivedMicros = monotonicTimeMicros();
+			OpcUa::DateTime received = OpcUa::DateTime::Current();
+			m_server->alive();
+			if (!m_server->isActive())
+				return;
+			m_opcua->notificationReceived();
+			if (m_opcua->isCapturing())
+				m_opcua->capture(handle, node.GetId(), m_server->getAssetPath(node.GetId()),
+						dval, m_critical);
+			m_server->checkOverflow(dval.Status);
+			if (m_opcua->isConverting())
+			{
+				m_opcua->dispatch(this, handle, node, dval, received);
+				return;
+			}
+			Reading *reading = convert(node, dval, received, receivedMicros);
+			if (reading)
+				m_opcua->ingest(reading, m_critical);
+		};
+		/**
+		 * Create the reading of a data change notification
+		 *
+		 * @param node		The variable
+		 * @param dval		The value of the variable
+		 * @param received	The time the notification was received
+		 * @param started	The monotonic time in microseconds the
+		 *			conversion started
+		 * @return		The reading or NULL if the value is not
+		 *			to be reported
+		 */
+		Reading *convert(const OpcUa::Node& node, const OpcUa::DataValue& dval,
+				const OpcUa::DateTime& received, int64_t started)
+		{
+			if (m_server->isInitialValue(node.GetId(), dval.SourceTimestamp))
+			{
+				m_opcua->valueDropped();
+				return NULL;
+			}
+			std::vector<Datapoint *> points;
+			if (!toDatapoints(node, dval, points))
+				return NULL;
+			m_server->updateTimestamp(node.GetId(), dval.SourceTimestamp);
+			Reading *reading = m_opcua->createReading(points, m_server->getAssetPath(node.GetId()),
+					dval.SourceTimestamp);
+			m_opcua->recordLatency(dval, received, monotonicTimeMicros() - started);
+			return reading;
+		};
+		bool isCritical() const { return m_critical; };
+		/**
+		 * Convert the value of a variable to the datapoints of a reading
+		 *
+		 * @param node		The variable
+		 * @param dval		The value of the variable
+		 * @param points	Populated with the datapoints
+		 * @return		False if the value is not to be reported
+		 */
+		bool toDatapoints(const OpcUa::Node& node, const OpcUa::DataValue& dval,
+				std::vector<Datapoint *>& points)
 		{
 			OpcUa::Variant val(dval.Value);
 			if (val.IsNul())
-				return;
+			{
+				// A variable without a value is not a failure to convert
+				m_opcua->valueDropped();
+				return false;
+			}
 			// We don't support non-scalar or Nul values as conversion
 			// to string does not work.
 			DatapointValue value(0L);
-			if (!val.IsScalar())
+			if (val.Type() == OpcUa::VariantType::EXTENSION_OBJECT)
+			{
+				// Structured values are decoded using the data types of the server
+				if (val.IsScalar())
+				{
+					if (!m_server->decodeStructure(static_cast<OpcUa::ExtensionObject>(val), value))
+					{
+						value = DatapointValue(val.ToString());
+					}
+				}
+				else
+				{
+					std::vector<OpcUa::ExtensionObject> objects = static_cast<std::vector<OpcUa::ExtensionObject> >(val);
+					std::vector<Datapoint *> *list = new std::vector<Datapoint *>;
+					for (size_t i = 0; i < objects.size(); i++)
+					{
+						DatapointValue element(0L);
+						if (!m_server->decodeStructure(objects[i], element))
+						{
+							for (auto point : *list)
+								delete point;
+							delete list;
+							m_opcua->conversionFailed(OpcUa::VariantType::EXTENSION_OBJECT);
+							return false;
+						}
+						list->push_back(new Datapoint(std::to_string(i), element));
+					}
+					value = DatapointValue(list, false);
+				}
+			}
+			else if (!val.IsScalar())
 			{
 				std::vector<double> dvec;
 				switch (val.Type())
@@ -199,7 +678,8 @@ class OpcUaClient : public OpcUa::SubscriptionHandler
 						break;
 					}
 					default:
-						return;
+						m_opcua->conversionFailed(val.Type());
+						return false;
 				}
 				value = DatapointValue(dvec);
 			}
@@ -306,11 +786,18 @@ class OpcUaClient : public OpcUa::SubscriptionHandler
 				}
 			}
 
-			std::vector<Datapoint *> points;
-			std::string dpname = m_opcua->getNodeName(node);
+			// Apply the overrides of the tag file
+			const Tag *tag = m_opcua->findTag(node.GetId());
+			if (tag && tag->deadband > 0 && m_server->inDeadband(node.GetId(), value, tag->deadband))
+			{
+				m_opcua->valueDropped();
+				return false;
+			}
+
+			std::string dpname = tag && !tag->name.empty() ? tag->name : m_opcua->getNodeName(node);
 
 			if (dpname.length() == 0) {
-				Logger::getLogger()->error("No name for data change event: %s", m_opcua->getAssetPath(node.GetId()));
+				Logger::getLogger()->error("No name for data change event: %s", m_server->getAssetPath(node.GetId()).c_str());
 			}
 
 			// Strip " from Datapoint name
@@ -320,9 +807,20 @@ class OpcUaClient : public OpcUa::SubscriptionHandler
 				dpname.erase(pos, 1);
 			}
 			points.push_back(new Datapoint(dpname, value));
-			m_opcua->ingest(points, m_opcua->getAssetPath(node.GetId()), dval.SourceTimestamp);
+			return true;
+		};
+		void Event(uint32_t handle, const OpcUa::Event& event) override
+		{
+			m_server->alive();
+			m_server->modelEvent(event);
+		};
+		void StatusChange(OpcUa::StatusCode status) override
+		{
+			m_server->statusChange(status);
 		};
 	private:
 		OPCUA		*m_opcua;
+		OPCUAServer	*m_server;
+		bool		m_critical;
 };
 #endif
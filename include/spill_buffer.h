@@ -0,0 +1,84 @@
+#ifndef _SPILL_BUFFER_H
+#define _SPILL_BUFFER_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <reading.h>
+
+// The first bytes of a spill file and the version of its format
+#define SPILL_MAGIC	"OPCUASPL"
+#define SPILL_VERSION	1
+
+/**
+ * The header at the start of a spill file. The offsets are of the data
+ * area that follows the header.
+ */
+struct SpillHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	reserved;
+	uint64_t	capacity;	// Size of the data area
+	uint64_t	head;		// Offset the next record is written at
+	uint64_t	tail;		// Offset of the oldest record
+	uint64_t	used;		// Bytes between the tail and the head
+	uint64_t	count;		// Number of records held
+};
+
+/**
+ * A ring buffer of serialized readings in a memory mapped file, used to
+ * hold readings the south service can not yet accept without growing
+ * the memory of the plugin. Readings are appended at the head and read
+ * back in order from the tail. Each record is preceded by its length; a
+ * record that does not fit before the end of the file is written at the
+ * start, leaving a marker in its place.
+ *
+ * When the buffer is full either the oldest readings are overwritten or
+ * the new reading is discarded. The positions are kept in the header
+ * of the file, so readings that are spilled but not yet ingested when
+ * the plugin stops are ingested when it starts again.
+ */
+class SpillBuffer
+{
+	public:
+		SpillBuffer();
+		~SpillBuffer();
+		void		open(const std::string& path, size_t capacity, bool overwrite);
+		void		close();
+		bool		isOpen() const { return m_header != NULL; };
+		const std::string&
+				getPath() const { return m_path; };
+		size_t		getCapacity() const { return m_header ? m_header->capacity : 0; };
+		void		setOverwrite(bool overwrite) { m_overwrite = overwrite; };
+		bool		write(Reading *reading);
+		Reading		*read();
+		bool		isEmpty();
+		uint64_t	getCount();
+		uint64_t	getDropped() const { return m_dropped; };
+
+	private:
+		void		reset(size_t capacity);
+		const uint8_t	*oldest(uint32_t& length);
+		void		pop(uint32_t length);
+		std::string	m_path;
+		SpillHeader	*m_header;
+		uint8_t		*m_data;
+		size_t		m_mapped;
+		bool		m_overwrite;
+		std::atomic<uint64_t>
+				m_dropped;
+		std::vector<uint8_t>
+				m_record;
+		std::mutex	m_mutex;
+};
+#endif
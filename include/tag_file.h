@@ -0,0 +1,69 @@
+#ifndef _TAG_FILE_H
+#define _TAG_FILE_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <opc/ua/node.h>
+
+/**
+ * A row of the tag file: a variable to subscribe to and the overrides
+ * of the way its values are reported.
+ */
+class Tag
+{
+	public:
+		Tag() : deadband(0.0), hash(0) {};
+		OpcUa::NodeId	nodeId;
+		std::string	name;		// Datapoint name, the node name if empty
+		std::string	group;		// Asset the values are reported under
+		double		deadband;	// Change below which values are not reported
+		std::string	server;		// URL or index of the server, empty for the main server
+		uint64_t	hash;		// Hash of the row the tag was read from
+};
+
+/**
+ * A table of the variables to subscribe to, read from a local CSV or
+ * JSON Lines file rather than the configuration category. The file is
+ * read a line at a time, so its size is not limited by the size of the
+ * configuration. The rows are held sorted by NodeId so the tag of a
+ * variable can be found quickly as its values arrive.
+ *
+ * When the file is reloaded it is only read if it has been modified,
+ * and only the rows that have changed are parsed again.
+ *
+ * A CSV row has the columns nodeid, name, group, deadband and server,
+ * all but the first of which may be empty or omitted. A JSON Lines row
+ * is an object with the same members.
+ */
+class TagFile
+{
+	public:
+		TagFile() : m_mtime(0), m_size(0), m_parsed(0) {};
+		bool		load(const std::string& path);
+		void		clear();
+		const std::string&
+				getPath() const { return m_path; };
+		const std::vector<Tag>&
+				getTags() const { return m_tags; };
+		const Tag	*find(const OpcUa::NodeId& nodeId) const;
+		size_t		getParsed() const { return m_parsed; };
+
+	private:
+		bool		parseCSV(const std::string& line, Tag& tag);
+		bool		parseJSON(const std::string& line, Tag& tag);
+		std::string	m_path;
+		time_t		m_mtime;
+		off_t		m_size;
+		std::vector<Tag> m_tags;
+		size_t		m_parsed;
+};
+#endif
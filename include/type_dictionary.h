@@ -0,0 +1,123 @@
+#ifndef _TYPE_DICTIONARY_H
+#define _TYPE_DICTIONARY_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <opc/ua/node.h>
+#include <reading.h>
+
+class StructType;
+class BinaryReader;
+
+/**
+ * A field of a compiled structured data type. A field is either of a
+ * built in type or of another structured type.
+ */
+class StructField
+{
+	public:
+		StructField() : builtin(OpcUa::VariantType::NUL), array(false), optional(false), offset(0) {};
+		std::string			name;
+		OpcUa::VariantType		builtin;
+		std::shared_ptr<const StructType> type;
+		bool				array;
+		bool				optional;
+		size_t				offset;
+};
+
+/**
+ * A structured data type compiled from its DataTypeDefinition. If every
+ * field of the structure has a fixed size the offset of each field in
+ * the encoded value is computed when the type is compiled, so the value
+ * can be decoded without walking the fields in turn.
+ */
+class StructType
+{
+	public:
+		StructType() : structureType(0), fixedSize(false), size(0) {};
+		int32_t				structureType;
+		std::vector<StructField>	fields;
+		bool				fixedSize;
+		size_t				size;
+};
+
+/**
+ * The structured data types of a server. The types are looked up the
+ * first time a value of the type is received and cached for the
+ * lifetime of the session, after which values of the type are decoded
+ * straight into nested datapoints.
+ *
+ * Values are decoded on the threads that receive data change
+ * notifications, which cannot make requests of the server. Encodings
+ * that are not yet known are collected and looked up by the server
+ * connection on another thread; until then the values are reported
+ * as strings.
+ */
+class TypeDictionary
+{
+	public:
+		void		clear();
+		bool		decode(const OpcUa::ExtensionObject& object, DatapointValue& value);
+		std::vector<OpcUa::NodeId>
+				getWanted();
+		void		addEncoding(const OpcUa::NodeId& encoding, const OpcUa::NodeId& dataType);
+		std::vector<OpcUa::NodeId>
+				getUndefined();
+		void		addDefinition(const OpcUa::NodeId& dataType, const OpcUa::DataValue& definition);
+		int		compile();
+		void		retry();
+
+	private:
+		class FieldDefinition
+		{
+			public:
+				std::string	name;
+				OpcUa::NodeId	dataType;
+				int32_t		valueRank;
+				bool		optional;
+		};
+		class Definition
+		{
+			public:
+				Definition() : kind(Unknown), structureType(0) {};
+				enum { Unknown, Structure, Enumeration }
+						kind;
+				int32_t		structureType;
+				std::vector<FieldDefinition>
+						fields;
+		};
+		std::shared_ptr<const StructType>
+				compileType(const OpcUa::NodeId& dataType, int depth);
+		bool		decodeBody(const OpcUa::NodeId& typeId, const uint8_t *data, size_t size,
+					DatapointValue& value);
+		std::vector<Datapoint *>
+				*decodeStruct(const StructType& type, BinaryReader& reader);
+		DatapointValue	decodeField(const StructField& field, BinaryReader& reader);
+		DatapointValue	decodeValue(const StructField& field, BinaryReader& reader);
+		std::mutex	m_mutex;
+		std::map<OpcUa::NodeId, std::shared_ptr<const StructType> >
+				m_encodings;
+		std::set<OpcUa::NodeId>
+				m_wanted;
+		std::set<OpcUa::NodeId>
+				m_requested;
+		std::map<OpcUa::NodeId, OpcUa::NodeId>
+				m_encodingTypes;
+		std::map<OpcUa::NodeId, Definition>
+				m_definitions;
+		std::map<OpcUa::NodeId, std::shared_ptr<const StructType> >
+				m_compiled;
+};
+#endif
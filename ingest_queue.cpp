@@ -0,0 +1,254 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <ingest_queue.h>
+#include <logger.h>
+
+// The number of readings taken from the spill buffer at a time
+#define SPILL_BATCH	1000
+
+using namespace std;
+
+/**
+ * Constructor for an ingest queue
+ *
+ * @param name	The name of the queue, used when reporting on it
+ */
+IngestQueue::IngestQueue(const string& name) : m_name(name), m_ingest(NULL), m_data(NULL),
+	m_thread(NULL), m_running(false), m_oldestQueued(0), m_backlog(0), m_ingestLatency(0),
+	m_spill(NULL), m_spillThreshold(0), m_spilling(false)
+{
+}
+
+/**
+ * Destructor for the ingest queue
+ */
+IngestQueue::~IngestQueue()
+{
+	stop();
+}
+
+/**
+ * Start the thread that sends the queued readings to the south service.
+ * Readings left in the spill buffer when the queue was last stopped are
+ * sent before any new readings.
+ */
+void
+IngestQueue::start()
+{
+	if (m_thread)
+	{
+		return;
+	}
+	m_spilling = m_spill && !m_spill->isEmpty();
+	m_running = true;
+	m_thread = new thread(&IngestQueue::ingestThread, this);
+}
+
+/**
+ * Stop the ingest thread once the readings already queued have been sent
+ */
+void
+IngestQueue::stop()
+{
+	if (m_thread)
+	{
+		{
+			lock_guard<mutex> guard(m_mutex);
+			m_running = false;
+		}
+		m_cv.notify_all();
+		m_thread->join();
+		delete m_thread;
+		m_thread = NULL;
+	}
+}
+
+/**
+ * Add a reading to the queue. The queue takes ownership of the reading.
+ *
+ * @param reading	The reading to send to the south service
+ */
+void
+IngestQueue::push(Reading *reading)
+{
+	int64_t now = monotonicTimeMicros();
+	lock_guard<mutex> guard(m_mutex);
+	if (spill(reading))
+	{
+		return;
+	}
+	if (m_queue.empty())
+	{
+		m_oldestQueued = now / 1000;
+	}
+	m_queue.push_back(make_pair(reading, now));
+	m_backlog++;
+	m_cv.notify_all();
+}
+
+/**
+ * Queue a set of readings to be ingested, taking the queue lock once
+ * for the whole set
+ *
+ * @param readings	The readings, the queue takes ownership of them
+ */
+void
+IngestQueue::push(const vector<Reading *>& readings)
+{
+	if (readings.empty())
+	{
+		return;
+	}
+	int64_t now = monotonicTimeMicros();
+	lock_guard<mutex> guard(m_mutex);
+	if (m_queue.empty())
+	{
+		m_oldestQueued = now / 1000;
+	}
+	for (auto reading : readings)
+	{
+		if (!spill(reading))
+		{
+			m_queue.push_back(make_pair(reading, now));
+			m_backlog++;
+		}
+	}
+	m_cv.notify_all();
+}
+
+/**
+ * Write a reading to the spill buffer rather than the queue if the
+ * queue has reached the spill threshold. Once readings are being spilled
+ * every reading is spilled until the spill buffer has been drained, so
+ * the readings are ingested in the order they were queued. Called with
+ * the queue lock held.
+ *
+ * @param reading	The reading, deleted if it is spilled
+ * @return		True if the reading was spilled
+ */
+bool
+IngestQueue::spill(Reading *reading)
+{
+	if (!m_spill || !m_spill->isOpen())
+	{
+		return false;
+	}
+	if (!m_spilling)
+	{
+		if (m_queue.size() < m_spillThreshold)
+		{
+			return false;
+		}
+		m_spilling = true;
+		Logger::getLogger()->warn("The %s ingest queue has %lu readings waiting, "
+				"spilling readings to %s", m_name.c_str(), (unsigned long)m_queue.size(),
+				m_spill->getPath().c_str());
+	}
+	m_spill->write(reading);
+	delete reading;
+	m_cv.notify_all();
+	return true;
+}
+
+/**
+ * Return the number of readings waiting to be ingested, in the queue
+ * and in the spill buffer
+ */
+uint64_t
+IngestQueue::getBacklog()
+{
+	uint64_t backlog = m_backlog;
+	if (m_spill)
+	{
+		backlog += m_spill->getCount();
+	}
+	return backlog;
+}
+
+/**
+ * Send a batch of readings from the spill buffer to the south service
+ */
+void
+IngestQueue::drainSpill()
+{
+	for (int i = 0; i < SPILL_BATCH; i++)
+	{
+		Reading *reading = m_spill->read();
+		if (!reading)
+		{
+			break;
+		}
+		if (m_ingest)
+		{
+			(*m_ingest)(m_data, *reading);
+		}
+		delete reading;
+		m_ingested.increment();
+	}
+}
+
+/**
+ * The ingest thread. Readings are removed from the queue in batches
+ * and passed to the south service. Taking the whole queue at once keeps
+ * the time the data change callbacks of the servers wait on the queue
+ * lock to a minimum.
+ */
+void
+IngestQueue::ingestThread()
+{
+	unique_lock<mutex> lck(m_mutex);
+	while (m_running || !m_queue.empty())
+	{
+		while (m_running && m_queue.empty() && !m_spilling)
+		{
+			m_cv.wait(lck);
+		}
+		if (m_queue.empty() && m_spilling)
+		{
+			// Readings left spilled when the queue stops are kept
+			// in the spill buffer for when it is started again
+			if (!m_running)
+			{
+				break;
+			}
+			lck.unlock();
+			drainSpill();
+			lck.lock();
+			if (m_spill->isEmpty())
+			{
+				m_spilling = false;
+				Logger::getLogger()->info("The %s ingest queue spill buffer has been drained",
+						m_name.c_str());
+			}
+			continue;
+		}
+		vector<pair<Reading *, int64_t> > batch;
+		batch.swap(m_queue);
+		int64_t queued = m_oldestQueued;
+		lck.unlock();
+		for (auto& item : batch)
+		{
+			if (m_ingest)
+			{
+				(*m_ingest)(m_data, *item.first);
+			}
+			delete item.first;
+			m_backlog--;
+			m_ingested.increment();
+			m_latency.record(monotonicTimeMicros() - item.second);
+		}
+		if (!batch.empty())
+		{
+			// The time the oldest reading of the batch waited to be ingested
+			m_ingestLatency = monotonicTime() - queued;
+		}
+		lck.lock();
+	}
+}
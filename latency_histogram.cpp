@@ -0,0 +1,132 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <latency_histogram.h>
+#include <math.h>
+
+/**
+ * Constructor for the latency histogram
+ */
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+/**
+ * Return the bucket a value is counted in. Values below the number of
+ * sub-buckets have a bucket each, above that each power of two is
+ * split into HISTOGRAM_SUB_BUCKETS linear buckets.
+ *
+ * @param value	The value in microseconds
+ * @return	The index of the bucket
+ */
+int
+LatencyHistogram::bucket(int64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return value < 0 ? 0 : (int)value;
+	}
+	int msb = 63 - __builtin_clzll((uint64_t)value);
+	int shift = msb - 4;
+	int index = shift * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift);
+	return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Return the largest value counted in a bucket
+ *
+ * @param bucket	The index of the bucket
+ * @return		The value in microseconds
+ */
+int64_t
+LatencyHistogram::bucketValue(int bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	int64_t mantissa = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * Record a latency
+ *
+ * @param micros	The latency in microseconds
+ */
+void
+LatencyHistogram::record(int64_t micros)
+{
+	m_counts[bucket(micros)].fetch_add(1, std::memory_order_relaxed);
+	int64_t max = m_max.load(std::memory_order_relaxed);
+	while (micros > max && !m_max.compare_exchange_weak(max, micros, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * Clear the histogram ahead of a new reporting period
+ */
+void
+LatencyHistogram::reset()
+{
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		m_counts[i].store(0, std::memory_order_relaxed);
+	}
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Return the number of latencies recorded
+ */
+uint64_t
+LatencyHistogram::count() const
+{
+	uint64_t total = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		total += m_counts[i].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+/**
+ * Return the latency below which the given percentage of the recorded
+ * latencies fall.
+ *
+ * @param percent	The percentile, e.g. 99.9
+ * @return		The latency in microseconds, 0 if nothing has been recorded
+ */
+int64_t
+LatencyHistogram::percentile(double percent) const
+{
+	uint64_t total = count();
+	if (total == 0)
+	{
+		return 0;
+	}
+	uint64_t target = (uint64_t)ceil(total * percent / 100.0);
+	if (target == 0)
+	{
+		target = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += m_counts[i].load(std::memory_order_relaxed);
+		if (seen >= target)
+		{
+			int64_t value = bucketValue(i);
+			return value < m_max ? value : (int64_t)m_max;
+		}
+	}
+	return m_max;
+}
@@ -0,0 +1,271 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <object_shadow.h>
+#include <logger.h>
+
+using namespace std;
+
+/**
+ * Destructor for a branch of an object, deletes the branches below it
+ */
+ObjectShadow::Branch::~Branch()
+{
+	for (auto& branch : branches)
+	{
+		delete branch.second;
+	}
+}
+
+/**
+ * Return the branch of the given name below this one, creating it if
+ * this is the first value below it
+ *
+ * @param name	The name of the branch
+ * @return	The branch
+ */
+ObjectShadow::Branch *
+ObjectShadow::Branch::child(const string& name)
+{
+	auto it = branches.find(name);
+	if (it != branches.end())
+	{
+		return it->second;
+	}
+	Branch *branch = new Branch();
+	branches[name] = branch;
+	return branch;
+}
+
+/**
+ * Constructor for the object shadow, which is disabled until configured
+ */
+ObjectShadow::ObjectShadow() : m_level(0), m_delimiter("/"), m_full(false)
+{
+}
+
+/**
+ * Destructor for the object shadow
+ */
+ObjectShadow::~ObjectShadow()
+{
+	clear();
+}
+
+/**
+ * Configure the building of object readings. The values held are
+ * discarded if the level or delimiter changes, as they no longer
+ * describe the same objects.
+ *
+ * @param level		The number of segments of the asset name that name
+ *			an object, 0 for one reading per variable
+ * @param delimiter	The delimiter between the segments of an asset name
+ * @param full		Each reading of an object holds every value of the
+ *			object rather than only those that have changed
+ */
+void
+ObjectShadow::configure(int level, const string& delimiter, bool full)
+{
+	if (level < 0)
+	{
+		level = 0;
+	}
+	if (level != m_level || delimiter != m_delimiter)
+	{
+		clear();
+	}
+	lock_guard<mutex> guard(m_mutex);
+	m_level = level;
+	m_delimiter = delimiter.empty() ? "/" : delimiter;
+	m_full = full;
+}
+
+/**
+ * Apply the values of the reading of a variable to the shadow of its
+ * object. The shadow takes ownership of the reading.
+ *
+ * @param reading	The reading of a variable
+ */
+void
+ObjectShadow::update(Reading *reading)
+{
+	lock_guard<mutex> guard(m_mutex);
+	apply(reading);
+}
+
+/**
+ * Apply the values of a set of readings, taking the lock once for the
+ * whole set. The shadow takes ownership of the readings.
+ *
+ * @param readings	The readings of the variables
+ */
+void
+ObjectShadow::update(const vector<Reading *>& readings)
+{
+	lock_guard<mutex> guard(m_mutex);
+	for (auto reading : readings)
+	{
+		apply(reading);
+	}
+}
+
+/**
+ * Apply the values of a reading to the shadow and delete the reading.
+ * Called with the mutex held.
+ *
+ * @param reading	The reading of a variable
+ */
+void
+ObjectShadow::apply(Reading *reading)
+{
+	vector<string> segments;
+	string asset = reading->getAssetName();
+	size_t start = 0, pos;
+	while ((pos = asset.find(m_delimiter, start)) != string::npos)
+	{
+		segments.push_back(asset.substr(start, pos - start));
+		start = pos + m_delimiter.length();
+	}
+	segments.push_back(asset.substr(start));
+
+	size_t level = min((size_t)m_level, segments.size());
+	string name = segments[0];
+	for (size_t i = 1; i < level; i++)
+	{
+		name += m_delimiter + segments[i];
+	}
+	Object *&object = m_objects[name];
+	if (!object)
+	{
+		object = new Object();
+	}
+
+	struct timeval tm;
+	reading->getUserTimestamp(&tm);
+	if (tm.tv_sec > object->timestamp.tv_sec
+			|| (tm.tv_sec == object->timestamp.tv_sec && tm.tv_usec > object->timestamp.tv_usec))
+	{
+		object->timestamp = tm;
+	}
+	object->changed = true;
+
+	vector<Datapoint *> points = reading->getReadingData();
+	for (auto point : points)
+	{
+		// The asset path may end with the name of the variable, which
+		// is not repeated as a branch above its own value
+		size_t depth = segments.size();
+		if (depth > level && segments[depth - 1] == point->getName())
+		{
+			depth--;
+		}
+		Branch *branch = &object->root;
+		branch->changed = true;
+		for (size_t i = level; i < depth; i++)
+		{
+			branch = branch->child(segments[i]);
+			branch->changed = true;
+		}
+		auto it = branch->leaves.find(point->getName());
+		if (it == branch->leaves.end())
+		{
+			branch->leaves.insert(make_pair(point->getName(), Leaf(point->getData())));
+		}
+		else
+		{
+			it->second.value = point->getData();
+			it->second.changed = true;
+		}
+	}
+	delete reading;
+}
+
+/**
+ * Build the readings of the objects that have changed since the last
+ * flush
+ *
+ * @param readings	The readings of the objects are appended to this,
+ *			the caller takes ownership of them
+ */
+void
+ObjectShadow::flush(vector<Reading *>& readings)
+{
+	lock_guard<mutex> guard(m_mutex);
+	for (auto& item : m_objects)
+	{
+		Object *object = item.second;
+		if (!object->changed)
+		{
+			continue;
+		}
+		vector<Datapoint *> *points = build(object->root);
+		Reading *reading = new Reading(item.first, *points);
+		delete points;
+		reading->setUserTimestamp(object->timestamp);
+		readings.push_back(reading);
+		object->changed = false;
+	}
+}
+
+/**
+ * Build the datapoints of a branch of an object, the branches below it
+ * becoming dictionary datapoints, and mark the branch as unchanged.
+ * Called with the mutex held.
+ *
+ * @param branch	The branch
+ * @return		The datapoints, the caller takes ownership of them
+ */
+vector<Datapoint *> *
+ObjectShadow::build(Branch& branch)
+{
+	vector<Datapoint *> *points = new vector<Datapoint *>;
+	for (auto& leaf : branch.leaves)
+	{
+		if (m_full || leaf.second.changed)
+		{
+			points->push_back(new Datapoint(leaf.first, leaf.second.value));
+			leaf.second.changed = false;
+		}
+	}
+	for (auto& child : branch.branches)
+	{
+		if (m_full || child.second->changed)
+		{
+			vector<Datapoint *> *children = build(*child.second);
+			DatapointValue value(children, true);
+			points->push_back(new Datapoint(child.first, value));
+		}
+	}
+	branch.changed = false;
+	return points;
+}
+
+/**
+ * Discard the values of all the objects
+ */
+void
+ObjectShadow::clear()
+{
+	lock_guard<mutex> guard(m_mutex);
+	for (auto& item : m_objects)
+	{
+		delete item.second;
+	}
+	m_objects.clear();
+}
+
+/**
+ * Return the number of objects in the shadow
+ */
+size_t
+ObjectShadow::getObjects()
+{
+	lock_guard<mutex> guard(m_mutex);
+	return m_objects.size();
+}
@@ -11,17 +11,32 @@
 #include <reading.h>
 #include <logger.h>
 #include <map>
+#include <fnmatch.h>
+#include <algorithm>
 
 using namespace std;
 
-// Hold subscription variables
-map<string, bool> subscriptionVariables;
+// Maximum factor by which the publishing interval is increased under backlog
+#define MAX_THROTTLE	16
+
+// Number of consecutive checks the backlog must be high, or low, to change the publishing interval
+#define THROTTLE_CHECKS	5
+
+// Interval in milliseconds between reports of the ingest latency of each lane
+#define LATENCY_REPORT_INTERVAL	60000
+
 /**
  * Constructor for the opcua plugin
  */
 OPCUA::OPCUA(const string& url) : m_url(url), m_subscribeById(false),
-	m_connected(false), m_client(NULL), m_subClient(NULL), m_reportingInterval(100),
-	m_pathDelimiter("/"), m_useBrowseName(false), m_assetNameType(AssetNameType::NodeIdAsName)
+	m_reportingInterval(100),
+	m_publishRequests(2), m_maxNotificationsPerPublish(0), m_lifetimeCount(2400), m_keepAliveCount(10),
+	m_pathDelimiter("/"), m_useBrowseName(false), m_assetNameType(AssetNameType::NodeIdAsName),
+	m_criticalInterval(100), m_modelCheckInterval(60000), m_initialSnapshot(true), m_bulkQueue("bulk"), m_criticalQueue("critical"), m_lastLatencyReport(0), m_statisticsInterval(0), m_lastNotifications(0), m_lastIngested(0),
+	m_keepAliveTimeout(3000), m_monitorThread(NULL), m_monitoring(false),
+	m_adaptiveSampling(false), m_backlogHigh(10000), m_backlogLow(1000),
+	m_backlogLatency(5000), m_throttle(1), m_pressureChecks(0), m_drainedChecks(0),
+	m_conversionThreads(0), m_conversionPool(this), m_objectLevel(0), m_fullObjects(false)
 {
 }
 
@@ -30,10 +45,8 @@ OPCUA::OPCUA(const string& url) : m_url(url), m_subscribeById(false),
  */
 OPCUA::~OPCUA()
 {
-	if (m_subClient)
-	{
-		delete m_subClient;
-	}
+	stop();
+	closeSessions();
 }
 
 /**
@@ -116,6 +129,91 @@ OPCUA::setAssetNameSource(const std::string& assetNameSource)
 	}
 }
 
+/**
+ * Set the tag file that lists variables to subscribe to in addition to
+ * the subscriptions of the configuration. The file is only read again
+ * if it has changed since it was last loaded. If the file cannot be
+ * read the tags previously loaded from it are kept.
+ *
+ * @param path	The path of the tag file, empty for none
+ */
+void
+OPCUA::setTagFile(const string& path)
+{
+	if (path.empty())
+	{
+		m_tagFile.clear();
+		return;
+	}
+	try {
+		m_tagFile.load(path);
+	} catch (exception& e) {
+		Logger::getLogger()->error("Failed to load the tag file: %s", e.what());
+	}
+}
+
+/**
+ * Set the spill buffer readings are written to when the south service
+ * can not keep up with them. The spill file is only opened again if its
+ * path or size changes; reopening it with a different size discards
+ * the readings it holds.
+ *
+ * @param path		The path of the spill file, empty for no spill buffer
+ * @param size		The size of the spill file in megabytes
+ * @param threshold	The number of readings waiting in memory above
+ *			which readings are spilled
+ * @param overwrite	Overwrite the oldest spilled readings when the spill
+ *			file is full, rather than discarding new readings
+ */
+void
+OPCUA::setSpill(const string& path, long size, long threshold, bool overwrite)
+{
+	if (path.empty() || size <= 0)
+	{
+		m_bulkQueue.setSpill(NULL, 0);
+		m_spill.close();
+		return;
+	}
+	size_t capacity = (size_t)size * 1024 * 1024;
+	if (!m_spill.isOpen() || m_spill.getPath() != path || m_spill.getCapacity() != capacity)
+	{
+		try {
+			m_spill.open(path, capacity, overwrite);
+		} catch (exception& e) {
+			Logger::getLogger()->error("Readings will not be spilled: %s", e.what());
+			m_bulkQueue.setSpill(NULL, 0);
+			return;
+		}
+	}
+	m_spill.setOverwrite(overwrite);
+	m_bulkQueue.setSpill(&m_spill, threshold > 0 ? threshold : 0);
+}
+
+/**
+ * Set the file the data change notifications received are recorded to.
+ * Recording is restarted, replacing the file, only if the path changes.
+ *
+ * @param path	The path of the capture file, empty to stop recording
+ */
+void
+OPCUA::setCaptureFile(const string& path)
+{
+	if (path.empty())
+	{
+		m_capture.close();
+		return;
+	}
+	if (m_capture.isOpen() && m_capture.getPath() == path)
+	{
+		return;
+	}
+	try {
+		m_capture.open(path);
+	} catch (exception& e) {
+		Logger::getLogger()->error("Failed to start recording notifications: %s", e.what());
+	}
+}
+
 /**
  * Set the minimum interval between data change events for subscriptions
  *
@@ -147,6 +245,192 @@ OPCUA::addSubscription(const string& parent)
 	m_subscriptions.push_back(parent);
 }
 
+/**
+ * Return a copy of the subscription parent nodes. Each server takes
+ * its own copy as the discovery process may remove malformed entries.
+ */
+vector<string>
+OPCUA::getSubscriptions()
+{
+	lock_guard<mutex> guard(m_configMutex);
+	return m_subscriptions;
+}
+
+/**
+ * Clear down the additional servers ahead of reconfiguration
+ */
+void
+OPCUA::clearServers()
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_serverURLs.clear();
+	m_backupURLs.clear();
+}
+
+/**
+ * Add an additional OPC UA server to collect data from. Each
+ * server is given its own session and subscription.
+ *
+ * @param url		The URL of the OPC UA server
+ * @param backupURL	The URL of a redundant backup server, empty if none
+ */
+void
+OPCUA::addServer(const string& url, const string& backupURL)
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_serverURLs.push_back(url);
+	if (!backupURL.empty())
+	{
+		m_backupURLs[url] = backupURL;
+	}
+}
+
+/**
+ * Clear down the critical tags ahead of reconfiguration
+ */
+void
+OPCUA::clearCriticalTags()
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_criticalTags.clear();
+}
+
+/**
+ * Add a pattern matching critical tags. Data changes of the critical
+ * tags are subscribed to on a subscription of their own and sent to the
+ * south service through a separate queue, so that they are not delayed
+ * behind the bulk of the data.
+ *
+ * @param pattern	A NodeId or asset name, which may include the wildcards * and ?
+ */
+void
+OPCUA::addCriticalTag(const string& pattern)
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_criticalTags.push_back(pattern);
+}
+
+/**
+ * Return true if any critical tags have been configured
+ */
+bool
+OPCUA::hasCriticalTags()
+{
+	lock_guard<mutex> guard(m_configMutex);
+	return !m_criticalTags.empty();
+}
+
+/**
+ * Check whether a variable is a critical tag. Both the NodeId of the
+ * variable and the asset name created for it are matched against the
+ * critical tag patterns.
+ *
+ * @param node		The variable node
+ * @param assetPath	The asset name created for the node
+ * @return		True if the node matches a critical tag pattern
+ */
+bool
+OPCUA::isCritical(const OpcUa::Node& node, const string& assetPath)
+{
+	lock_guard<mutex> guard(m_configMutex);
+	if (m_criticalTags.empty())
+	{
+		return false;
+	}
+	string nodeId = NodeIdString(node);
+	for (auto& pattern : m_criticalTags)
+	{
+		if (fnmatch(pattern.c_str(), nodeId.c_str(), 0) == 0
+				|| fnmatch(pattern.c_str(), assetPath.c_str(), 0) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Get the cached request sizes for a server
+ *
+ * @param url		The URL of the OPC UA server
+ * @param limits	Populated with the cached request sizes
+ * @return		True if the request sizes for the server are cached
+ */
+bool
+OPCUA::getOperationLimits(const string& url, OperationLimits& limits)
+{
+	lock_guard<mutex> guard(m_limitsMutex);
+	auto it = m_operationLimits.find(url);
+	if (it == m_operationLimits.end())
+	{
+		return false;
+	}
+	limits = it->second;
+	return true;
+}
+
+/**
+ * Cache the request sizes for a server. The cache is kept for the
+ * lifetime of the plugin, so the limits of a server are only read once
+ * and any reductions made are kept over reconnects and reconfigures.
+ *
+ * @param url		The URL of the OPC UA server
+ * @param limits	The request sizes
+ */
+void
+OPCUA::setOperationLimits(const string& url, const OperationLimits& limits)
+{
+	lock_guard<mutex> guard(m_limitsMutex);
+	m_operationLimits[url] = limits;
+}
+
+/**
+ * Return the endpoint selected the last time a server was connected to
+ *
+ * @param url		The URL of the server
+ * @param endpoint	Set to the endpoint of the server
+ * @return		False if no endpoint has been selected for the server
+ */
+bool
+OPCUA::getEndpoint(const string& url, OpcUa::EndpointDescription& endpoint)
+{
+	lock_guard<mutex> guard(m_limitsMutex);
+	auto it = m_endpoints.find(url);
+	if (it == m_endpoints.end())
+	{
+		return false;
+	}
+	endpoint = it->second;
+	return true;
+}
+
+/**
+ * Record the endpoint selected for a server, so that it need not be
+ * requested from the server when the plugin next connects to it
+ *
+ * @param url		The URL of the server
+ * @param endpoint	The endpoint of the server
+ */
+void
+OPCUA::setEndpoint(const string& url, const OpcUa::EndpointDescription& endpoint)
+{
+	lock_guard<mutex> guard(m_limitsMutex);
+	m_endpoints[url] = endpoint;
+}
+
+/**
+ * Forget the endpoint selected for a server, after it could not be
+ * connected to
+ *
+ * @param url		The URL of the server
+ */
+void
+OPCUA::clearEndpoint(const string& url)
+{
+	lock_guard<mutex> guard(m_limitsMutex);
+	m_endpoints.erase(url);
+}
+
 /**
  * Generate a string representation of a NodeId
  *
@@ -238,514 +522,644 @@ std::string	OPCUA::getNodeName(const OpcUa::Node& node)
 }
 
 /**
- * Read an Asset Path from the NodeId-to-Path map
+ * Restart the OPCUA connection
+ */
+void
+OPCUA::restart()
+{
+	stop();
+	start();
+}
+
+/**
+ * Create the server connection for a URL and, if a backup URL is
+ * given, the standby connection to the backup server.
+ *
+ * The rows of the tag file are subscribed to on the server they name
+ * in their server column, by its URL, the URL of its backup or its
+ * index. Rows that name no server belong to the main server.
  *
- * @param nodeId			OPC UA NodeId
- * @return					Asset Path
+ * @param url		The URL of the OPC UA server
+ * @param backupURL	The URL of the backup server, empty if none
+ * @param index		The index of the server, 0 for the main server
+ *			and from 1 for the additional servers
+ * @return		The primary server connection
  */
-std::string	OPCUA::getAssetPath(const OpcUa::NodeId& nodeId)
+OPCUAServer *
+OPCUA::createServer(const string& url, const string& backupURL, int index)
 {
-	try
+	set<string> tagServer = { url, to_string(index) };
+	if (!backupURL.empty())
 	{
-		return m_assetPathNames.at(nodeId);
+		tagServer.insert(backupURL);
 	}
-	catch (const std::out_of_range&)
+	if (index == 0)
 	{
-		return std::string("");
+		tagServer.insert("");
 	}
+	OPCUAServer *server = new OPCUAServer(this, url);
+	server->setTagServer(tagServer);
+	m_servers.push_back(server);
+	if (!backupURL.empty())
+	{
+		OPCUAServer *backup = new OPCUAServer(this, backupURL);
+		backup->setTagServer(tagServer);
+		backup->setActive(false);
+		m_servers.push_back(backup);
+		m_redundantPairs.push_back(make_pair(server, backup));
+	}
+	else
+	{
+		m_singleServers.push_back(server);
+	}
+	return server;
 }
 
 /**
- * Restart the OPCUA connection
+ * Close the sessions kept over a reconfiguration that no server has
+ * taken
  */
 void
-OPCUA::restart()
+OPCUA::closeSessions()
 {
-	stop();
-	start();
+	for (auto& session : m_sessions)
+	{
+		try {
+			session.second->Disconnect();
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Error disconnecting from OPCUA server %s: %s",
+					session.first.c_str(), e.what());
+		}
+	}
+	m_sessions.clear();
 }
 
 /**
- * Recurse the object tree and add subscriptions for all variables that are found.
- * The member variable m_subscriptions holds filters that wil be applied to the
- * subscription process. If this is non-empty then it contains a set of strings which
- * are matched against the name of the items in the object tree. Only variables that are in
- * a node that is a descendant of one of these named nodes is added to the subscription list.
+ * Starts the plugin
  *
- * @param	The node to recurse from
- * @active	Should subscriptions be added, i.e. have we satisfied any filtering requirements.
- * @return	The number of subscriptions added
+ * Start the ingest thread and then connect to each of the configured
+ * OPC UA servers. The servers are started in the background, each on
+ * its own thread, as discovery of a large server may take some time;
+ * this call returns without waiting for them. Backup servers are
+ * started at the same time so that their subscriptions are in place
+ * should the primary fail. A primary that cannot be reached at start
+ * up is failed over by the monitor thread.
  */
-int OPCUA::addSubscribe(const OpcUa::Node& node, std::string& subscriptionParentPath, bool active)
+void
+OPCUA::start()
 {
-	int n_subscriptions = 0;
+	m_bulkQueue.start();
+	m_criticalQueue.start();
+	m_conversionPool.start(m_conversionThreads);
+	m_objects.configure(m_objectLevel, m_pathDelimiter, m_fullObjects);
+	m_objects.clear();
+	m_lastLatencyReport = monotonicTime();
 
-	std::string subscriptionPath;
-	if (subscriptionParentPath.length() == 0)
 	{
-		subscriptionPath = getNodeName(node);
+		lock_guard<mutex> guard(m_configMutex);
+		lock_guard<mutex> serversGuard(m_serversMutex);
+		createServer(m_url, m_backupURL, 0);
+		int index = 1;
+		for (auto& url : m_serverURLs)
+		{
+			auto it = m_backupURLs.find(url);
+			createServer(url, it == m_backupURLs.end() ? "" : it->second, index++);
+		}
+
+		// Hand the sessions kept over a reconfiguration to the servers
+		// that are still configured
+		for (auto server : m_servers)
+		{
+			auto it = m_sessions.find(server->getURL());
+			if (it != m_sessions.end())
+			{
+				server->adopt(std::move(it->second));
+				m_sessions.erase(it);
+			}
+		}
 	}
-	else
+	closeSessions();
+
+	for (auto server : m_servers)
 	{
-		subscriptionPath = subscriptionParentPath + m_pathDelimiter + getNodeName(node);
+		server->startInBackground();
 	}
 
-	try {
-		OpcUa::QualifiedName nName = node.GetBrowseName();
-		Logger::getLogger()->debug("addSubscribe: node (%d:%s) %s",
-					   nName.NamespaceIndex,
-					   nName.Name.c_str(),
-					   active ? "true" : "false");
-
-		vector<OpcUa::Node> variables = node.GetVariables();
+	m_monitoring = true;
+	m_monitorThread = new thread(&OPCUA::monitorThread, this);
+}
 
-		if (variables.size() > 0)
+/**
+ * Stop all the server connections and then the ingest threads
+ *
+ * @param keepSessions	Keep the healthy sessions with the servers open,
+ *			to be used again by the next start of the servers
+ *			with the same URLs, as when the plugin is
+ *			reconfigured
+ */
+void
+OPCUA::stop(bool keepSessions)
+{
+	if (m_monitorThread)
+	{
 		{
-			Logger::getLogger()->debug("Node (%d:%s) has %d variables",
-						   nName.NamespaceIndex,
-						   nName.Name.c_str(),
-						   variables.size());
+			lock_guard<mutex> guard(m_monitorMutex);
+			m_monitoring = false;
 		}
+		m_monitorCV.notify_all();
+		m_monitorThread->join();
+		delete m_monitorThread;
+		m_monitorThread = NULL;
+	}
+	m_redundantPairs.clear();
+	m_singleServers.clear();
 
-		// Special case of being called with a variable
-		if (m_subscribeById &&
-		    node.GetNodeClass() == OpcUa::NodeClass::Variable)
+	{
+		lock_guard<mutex> guard(m_serversMutex);
+		for (auto server : m_servers)
 		{
-			// Get ParentName
-			OpcUa::Node parent = node.GetParent();
-			string key;
-			try {
-				OpcUa::QualifiedName pName = parent.GetBrowseName();
-				// Create key
-				key = to_string(nName.NamespaceIndex) + ":" + pName.Name + ":" + nName.Name;
-			} catch (...) {
-				Logger::getLogger()->warn("Failed to get parent browse name for a variable (%d:%s)", nName.NamespaceIndex, nName.Name.c_str());
-				key = to_string(nName.NamespaceIndex) + ":_:" +  nName.Name;
-			}
-
-			// Add variable if not existant
-			if (subscriptionVariables.find(key) == subscriptionVariables.end())
+			if (keepSessions)
 			{
-				subscriptionVariables[key] = true;
-				Logger::getLogger()->debug("Adding subscription variable by Id (%s) to "
-							   "the map, key (%s)",
-				nName.Name.c_str(),
-				key.c_str());
-
-				m_assetPathNames[node.GetId()] = createAssetName(node, subscriptionPath);
-
-				try {
-					m_sub->SubscribeDataChange(node);
-					n_subscriptions++;
-				} catch (exception& e) {
-					Logger::getLogger()->warn("Subscription to variable (%s) failed, %s", nName.Name.c_str(), e.what());
+				unique_ptr<OpcUa::UaClient> client = server->park();
+				if (client)
+				{
+					// Of two servers with the same URL, the session
+					// of the first is kept
+					m_sessions.insert(make_pair(server->getURL(), std::move(client)));
 				}
 			}
-			return n_subscriptions;
+			else
+			{
+				server->stop();
+			}
+			delete server;
 		}
+		m_servers.clear();
+	}
 
-		// Get variables
-		for (auto var : variables)
+	m_conversionPool.stop();
+	flushObjects();
+	m_criticalQueue.stop();
+	m_bulkQueue.stop();
+}
+
+/**
+ * Replay the notifications of a capture file through the data change
+ * handling of the plugin, without a server. The readings are ingested
+ * through the ingest queues as they would be for a live server.
+ *
+ * @param reader	The capture file to replay
+ * @param realTime	Replay the notifications with the timing they were
+ *			received with, rather than as fast as possible
+ * @return		The number of notifications replayed
+ */
+uint64_t
+OPCUA::replay(CaptureReader& reader, bool realTime)
+{
+	m_bulkQueue.start();
+	m_criticalQueue.start();
+	m_conversionPool.start(m_conversionThreads);
+	m_objects.configure(m_objectLevel, m_pathDelimiter, m_fullObjects);
+	OPCUAServer server(this, "replay");
+	OpcUaClient bulk(this, &server, false);
+	OpcUaClient critical(this, &server, true);
+
+	// The replayed variables have no session to read their browse names
+	// with, so datapoints are named by NodeId whatever the naming mode
+	bool useBrowseName = m_useBrowseName;
+	if (useBrowseName)
+	{
+		Logger::getLogger()->info("Notifications are replayed with datapoints named by NodeId, "
+				"browse names are not recorded in capture files");
+		m_useBrowseName = false;
+	}
+	set<OpcUa::NodeId> known;
+	CapturedNotification notification;
+	uint64_t replayed = 0;
+	int64_t start = monotonicTimeMicros();
+	try {
+		while (reader.next(notification))
 		{
-			bool varMatched = false;
-			OpcUa::QualifiedName qName = var.GetBrowseName();
-			// Create key for variables std::map
-			// key is : NameSpaceIndex : NodeName : VarName 
-			string key = to_string(qName.NamespaceIndex) + ":" + nName.Name + ":" + qName.Name;
-
-			// Get configuration items: ObjectNames or Variables
-			for (auto it = m_subscriptions.begin();
-				  it != m_subscriptions.end(); ++it)
+			if (known.insert(notification.nodeId).second)
 			{
-				size_t pos;
-				string subName = *it;
-		
-				if (m_subscribeById)
-				{
-					// Check whether to add variable to the map
-					if (subscriptionVariables.find(key) == subscriptionVariables.end())
-					{
-						varMatched = true;
-						subscriptionVariables[key] = true;
-						Logger::getLogger()->debug("Adding subscription variable (%s) to "
-									   "the map, key (%s)",
-									   subName.c_str(),
-									   key.c_str());
-					}
-				}
-				else if ((pos = subName.find(":")) != string::npos)
-				{
-					unsigned long pns = 0;
-					try {
-						pns = stoul(subName.substr(0, pos), NULL, 10);
-					}
-					catch (exception& e)
-					{
-						Logger::getLogger()->error("Exception while parsing "
-									   "configuration element '%s' in node '%d:%s', "
-									   "error '%s'. Configuration element removed.",
-									   subName.c_str(),
-									   qName.NamespaceIndex,
-									   qName.Name.c_str(),
-									   e.what());
-
-						// Remove configuration item
-						m_subscriptions.erase(it);
-						continue;
-					}
-					Logger::getLogger()->debug("Variable %s has namespace in it, pns %d",
-								   subName.c_str(),
-								   pns);
-					if (qName.Name.compare(subName.substr(pos + 1)) == 0 
-							&& pns == qName.NamespaceIndex)
-					{
-						// Check whether to add variable to the map
-						if (subscriptionVariables.find(key) == subscriptionVariables.end())
-						{
-							varMatched = true;
-							subscriptionVariables[key] = true;
-							Logger::getLogger()->debug("Adding subscription variable (%s) to "
-										   "the map, key (%s)",
-										   subName.c_str(),
-										   key.c_str());
-						}
-					}
-				}
-				else if (subName.compare(qName.Name) == 0)
-				{
-					// Check whether to add variable to the map
-					if (subscriptionVariables.find(key) == subscriptionVariables.end())
-					{
-						varMatched = true;
-						subscriptionVariables[key] = true;
-						Logger::getLogger()->debug("Adding subscription variable (%s) to the map "
-									   " key (%s)",
-									   subName.c_str(),
-									   key.c_str());
-					}
-				}
+				server.setAssetPath(notification.nodeId, notification.assetPath);
 			}
-
-			// Now handleSubscribeDataChange call
-			if (active || varMatched)
+			if (realTime)
 			{
-				// Handle variable
-				if (varMatched)
+				int64_t wait = start + notification.offset - monotonicTimeMicros();
+				if (wait > 0)
 				{
-					auto it = subscriptionVariables.find(key);
-					if (it != subscriptionVariables.end())
-					{
-						if ((*it).second == true)
-						{
-							Logger::getLogger()->debug("Subscribing to individual variable (%s)",
-										   key.c_str());
-
-							m_assetPathNames[var.GetId()] = createAssetName(var, subscriptionPath);
-						   
-							try {
-								m_sub->SubscribeDataChange(var);
-								n_subscriptions++;
-							} catch (exception& e) {
-								Logger::getLogger()->warn("Subscription to variable (%s) failed, %s",
-											  key.c_str(),
-											  e.what());
-							}
-							// We're done with this variable
-							(*it).second = false;
-						}
-					}
-				}
-
-				// Handle ObjectNode
-				if (active)
-				{
-					auto it = subscriptionVariables.find(key);
-					// Check whether an existing variable has to be subscribed
-					bool subscribeVariable = true;
-					if (it != subscriptionVariables.end())
-					{
-						subscribeVariable = (*it).second;
-						if (subscribeVariable)
-						{
-							(*it).second = false;
-						}
-					}
-
-					if (subscribeVariable)
-					{
-						Logger::getLogger()->debug("Subscribing to variable (%s), belonging to (%d:%s)",
-									   qName.Name.c_str(),
-									   qName.NamespaceIndex,
-									   nName.Name.c_str());
-
-						m_assetPathNames[var.GetId()] = createAssetName(var, subscriptionPath);
-
-						try {
-							m_sub->SubscribeDataChange(var);
-							n_subscriptions++;
-						} catch (exception& e) {
-							Logger::getLogger()->warn("Subscription to variable (%s) failed, %s",
-										  key.c_str(),
-										  e.what());
-						}
-					}
+					this_thread::sleep_for(chrono::microseconds(wait));
 				}
 			}
+			OpcUa::Node node(OpcUa::Services::SharedPtr(), notification.nodeId);
+			(notification.critical ? critical : bulk).DataValueChange(notification.handle, node,
+					notification.value, OpcUa::AttributeId::Value);
+			replayed++;
 		}
+	} catch (exception& e) {
+		m_conversionPool.stop();
+		m_criticalQueue.stop();
+		m_bulkQueue.stop();
+		m_useBrowseName = useBrowseName;
+		throw;
+	}
+	m_conversionPool.stop();
+	flushObjects();
+	m_criticalQueue.stop();
+	m_bulkQueue.stop();
+	m_useBrowseName = useBrowseName;
+	return replayed;
+}
 
-		vector<OpcUa::Node> children = node.GetChildren();
-		Logger::getLogger()->debug("Node (%d:%s) has %d children",
-					   nName.NamespaceIndex,
-					   nName.Name.c_str(),
-					   children.size());
-
-		for (auto child : children)
+/**
+ * Watch the health of the server connections. Once every reporting
+ * interval check that we have heard from each server and reconnect,
+ * in the background, to any that we have not.
+ *
+ * For the redundant server pairs, if the active server has been lost
+ * and the standby server is alive, make the standby active. The failed
+ * server becomes the standby once it has been reconnected. Each server
+ * of a pair that has been lost is reconnected, so a pair that has lost
+ * both servers fails over to whichever is reached first.
+ */
+void
+OPCUA::monitorThread()
+{
+	unique_lock<mutex> lck(m_monitorMutex);
+	while (m_monitoring)
+	{
+		m_monitorCV.wait_for(lck, chrono::milliseconds(m_reportingInterval));
+		if (!m_monitoring)
 		{
-			bool child_active = active;
-			if (! child_active)
+			break;
+		}
+		for (auto& pair : m_redundantPairs)
+		{
+			OPCUAServer *active = pair.first->isActive() ? pair.first : pair.second;
+			OPCUAServer *standby = pair.first->isActive() ? pair.second : pair.first;
+			if (!active->isAlive(m_keepAliveTimeout) && standby->isAlive(m_keepAliveTimeout))
 			{
-				OpcUa::QualifiedName qName = child.GetBrowseName();
-				for (auto it = m_subscriptions.begin();
-					  it != m_subscriptions.end(); ++it)
-				{
-					string parent = *it;
-					{
-						size_t pos;
-						if ((pos = parent.find(":")) != string::npos)
-						{
-							unsigned long pns = 0;
-							try {
-								pns = stoul(parent.substr(0, pos), NULL, 10);
-							}
-							catch (exception& e)
-							{
-								Logger::getLogger()->error("Exception while parsing "
-											   "configuration element '%s' in "
-											   "child node '%d:%s', error '%s'. "
-											   "Configuration element removed.",
-											   parent.c_str(),
-											   qName.NamespaceIndex,
-											   qName.Name.c_str(),
-											   e.what());
-
-								// Remove configuration item
-								m_subscriptions.erase(it);
-								continue;
-							}
-							if (qName.Name.compare(parent.substr(pos + 1)) == 0 
-									&& pns == qName.NamespaceIndex)
-							{
-								child_active = true;
-							}
-						}
-						else if (parent.compare(qName.Name) == 0)
-						{
-							child_active = true;
-						}
-					}
-				}
+				Logger::getLogger()->warn("OPCUA server %s is not responding, failing over to %s",
+						active->getURL().c_str(), standby->getURL().c_str());
+				standby->setActive(true);
+				active->setActive(false);
 			}
-			try {
-				OpcUa::QualifiedName cName = child.GetBrowseName();
-				n_subscriptions += addSubscribe(child, subscriptionPath, child_active);
-			} catch (exception& e) {
-				OpcUa::QualifiedName cName = child.GetBrowseName();
-				Logger::getLogger()->warn("Failed to add subscriptions for child %d:%s, %s",
-						cName.NamespaceIndex, cName.Name.c_str(), e.what());
+			// Both servers are recovered whichever is active, so that
+			// the pair is back as soon as either of them is reached
+			if (!pair.first->isAlive(m_keepAliveTimeout))
+			{
+				pair.first->recover();
+			}
+			if (!pair.second->isAlive(m_keepAliveTimeout))
+			{
+				pair.second->recover();
 			}
 		}
-
-		return n_subscriptions;
-	} catch(const std::runtime_error& re) {
-		Logger::getLogger()->error("addSubscribe: Runtime error: %s", re.what());
-	} catch(const exception& e) {
-		Logger::getLogger()->error("addSubscribe: Exception: %s", e.what());
-	} catch(...) {
-		Logger::getLogger()->error("addSubscribe: Unknown error occured");
+		for (auto server : m_singleServers)
+		{
+			if (!server->isAlive(m_keepAliveTimeout))
+			{
+				server->recover();
+			}
+		}
+		flushObjects();
+		checkBacklog();
+		long interval = m_statisticsInterval > 0 ? m_statisticsInterval : LATENCY_REPORT_INTERVAL;
+		int64_t elapsed = monotonicTime() - m_lastLatencyReport;
+		if (elapsed >= interval)
+		{
+			m_lastLatencyReport = monotonicTime();
+			reportStatistics(elapsed);
+		}
 	}
-	return 0;
 }
 
+/**
+ * Report the latency of each stage of the handling of notifications over
+ * the reporting period, and start a new reporting period. The latencies
+ * are logged and, if a statistics interval is set, ingested together
+ * with the counters of the plugin as a reading of the statistics asset.
+ *
+ * @param elapsed	The length of the reporting period in milliseconds
+ */
+void
+OPCUA::reportStatistics(int64_t elapsed)
+{
+	vector<Datapoint *> points;
+	if (m_statisticsInterval > 0)
+	{
+		reportCounters(elapsed, points);
+	}
+	reportLatency("sourceToServer", m_sourceLatency, points);
+	reportLatency("serverToPlugin", m_networkLatency, points);
+	reportLatency("conversion", m_conversionLatency, points);
+	reportLatency("criticalIngest", m_criticalQueue.getLatencyHistogram(), points);
+	reportLatency("bulkIngest", m_bulkQueue.getLatencyHistogram(), points);
+	if (m_statisticsInterval <= 0 || points.empty())
+	{
+		for (auto point : points)
+		{
+			delete point;
+		}
+		return;
+	}
+	Reading *reading = new Reading(m_asset + "Statistics", points);
+	m_bulkQueue.push(reading);
+}
 
 /**
- * Starts the plugin
+ * Add the counters of the plugin to the statistics reading. The rates
+ * are over the reporting period, the other counters are totals since
+ * the plugin was started or the server connections last restarted.
  *
- * We register with the OPC UA server, retrieve all the objects under the parent
- * to which we are subscribing and start the process to enable OPC UA to send us
- * change notifications for those items.
+ * @param elapsed	The length of the reporting period in milliseconds
+ * @param points	The datapoints of the statistics reading
  */
 void
-OPCUA::start()
+OPCUA::reportCounters(int64_t elapsed, vector<Datapoint *>& points)
 {
-int n_subscriptions = 0;
+	static const char *typeNames[VARIANT_TYPES] = {
+		"Null", "Boolean", "SByte", "Byte", "Int16", "UInt16", "Int32", "UInt32",
+		"Int64", "UInt64", "Float", "Double", "String", "DateTime", "Guid", "ByteString",
+		"XmlElement", "NodeId", "ExpandedNodeId", "StatusCode", "QualifiedName",
+		"LocalizedText", "ExtensionObject", "DataValue", "Variant", "DiagnosticInfo"
+	};
 
-	subscriptionVariables.clear();
-	m_assetPathNames.clear();
-	std::string subscriptionParentPath;
+	uint64_t notifications = m_notifications.value();
+	uint64_t ingested = m_bulkQueue.getIngested() + m_criticalQueue.getIngested();
+	double seconds = elapsed > 0 ? elapsed / 1000.0 : 1.0;
+	double notificationRate = (notifications - m_lastNotifications) / seconds;
+	double ingestRate = (ingested - m_lastIngested) / seconds;
+	m_lastNotifications = notifications;
+	m_lastIngested = ingested;
 
-	m_client = new OpcUa::UaClient(Logger::getLogger());
-	try {
-		m_client->Connect(m_url);
-	} catch (exception &e) {
-		Logger::getLogger()->error("Failed to connect to OPCUA server %s: %s", m_url.c_str(), e.what());
-		throw e;
+	long conflated = 0, statusChanges = 0, lost = 0, reconnects = 0, discovery = 0;
+	long subscribed = 0, failed = 0;
+	for (auto server : m_servers)
+	{
+		conflated += server->getQueueOverflows();
+		statusChanges += server->getStatusChanges();
+		lost += server->getLostNotifications();
+		reconnects += server->getReconnects();
+		discovery = max(discovery, (long)server->getDiscoveryDuration());
+		subscribed += server->getItemsSubscribed();
+		failed += server->getItemsFailed();
 	}
-	m_connected = true;
 
-
-
-	try {
-		m_subClient = new OpcUaClient(this);
-		m_sub = m_client->CreateSubscription(m_reportingInterval, *m_subClient);
-	} catch (exception &e) {
-		Logger::getLogger()->error("Failed to setup subscription infrastructure for OPCUA server %s: %s", m_url.c_str(), e.what());
-		throw e;
+	DatapointValue vNotificationRate(notificationRate), vIngestRate(ingestRate);
+	DatapointValue vDropped((long)m_dropped.value()), vConflated(conflated), vLost(lost);
+	DatapointValue vStatusChanges(statusChanges);
+	DatapointValue vReconnects(reconnects), vDiscovery(discovery);
+	DatapointValue vSubscribed(subscribed), vFailed(failed);
+	points.push_back(new Datapoint("notificationsPerSecond", vNotificationRate));
+	points.push_back(new Datapoint("ingestedPerSecond", vIngestRate));
+	points.push_back(new Datapoint("dropped", vDropped));
+	points.push_back(new Datapoint("conflated", vConflated));
+	points.push_back(new Datapoint("statusChanges", vStatusChanges));
+	points.push_back(new Datapoint("lost", vLost));
+	points.push_back(new Datapoint("reconnects", vReconnects));
+	points.push_back(new Datapoint("discoveryDuration", vDiscovery));
+	points.push_back(new Datapoint("itemsSubscribed", vSubscribed));
+	points.push_back(new Datapoint("itemsFailed", vFailed));
+	if (m_spill.isOpen())
+	{
+		DatapointValue vSpilled((long)m_spill.getCount()), vSpillDropped((long)m_spill.getDropped());
+		points.push_back(new Datapoint("spilled", vSpilled));
+		points.push_back(new Datapoint("spillDropped", vSpillDropped));
+	}
+	if (m_conversionPool.isRunning())
+	{
+		DatapointValue vConversionBacklog((long)m_conversionPool.getBacklog());
+		points.push_back(new Datapoint("conversionBacklog", vConversionBacklog));
 	}
 
-	if (m_subscribeById)
+	vector<Datapoint *> *failures = new vector<Datapoint *>;
+	for (int i = 0; i < VARIANT_TYPES; i++)
 	{
-		for (auto it = m_subscriptions.begin(); it != m_subscriptions.end(); ++it)
+		uint64_t count = m_conversionFailures[i].value();
+		if (count)
 		{
-			string subscription = (*it);
-			// Parse out ns=..;s=...
-			size_t sStart = subscription.find("s=");
-			size_t iStart = subscription.find("i=");
-			size_t nsStart = subscription.find("ns=");
-			size_t delim = subscription.find(";");
-
-			if (sStart != string::npos && nsStart != string::npos && sStart == nsStart + 1)
-			{
-				sStart = subscription.find("s=", sStart + 1);
-			}
-			if ((sStart == string::npos && iStart == string::npos) || nsStart == string::npos || delim == string::npos)
-			{
-				Logger::getLogger()->error(
-					"Malformed subscription string '%s', must be of the form ns=...;s=... or ns=...;i=...",
-						subscription.c_str());
-				continue;
-			}
-			string str;
-			int ns;
-			if (sStart != string::npos)
-			{
-				if (sStart < delim)
-					str = subscription.substr(sStart + 2, delim - (sStart + 2));
-				else if (sStart > delim)
-					str = subscription.substr(sStart + 2);
-				if (nsStart < delim)
-					ns = atoi(subscription.substr(nsStart + 3, delim - (nsStart + 3)).c_str());
-				else if (nsStart > delim)
-					ns = atoi(subscription.substr(nsStart + 3).c_str());
-				try {
-					OpcUa::NodeId nodeid(str, ns);
-					Logger::getLogger()->info("Add string subscription %s", str.c_str());
-					OpcUa::Node node = m_client->GetNode(nodeid);
-					n_subscriptions += addSubscribe(node, subscriptionParentPath, true);
-				} catch (...) {
-					Logger::getLogger()->error("Failed to find node ns=%d;s=%s", ns, str.c_str());
-				}
-			}
-			else if (iStart != string::npos)
-			{
-				if (iStart < delim)
-					str = subscription.substr(iStart + 2, delim - (iStart + 2));
-				else if (iStart > delim)
-					str = subscription.substr(iStart + 2);
-				if (nsStart < delim)
-					ns = atoi(subscription.substr(nsStart + 3, delim - (nsStart + 3)).c_str());
-				else if (nsStart > delim)
-					ns = atoi(subscription.substr(nsStart + 3).c_str());
-				uint32_t nodeNum = atoi(str.c_str());
-				try {
-					Logger::getLogger()->info("Add integer subscription %d:%d", ns, nodeNum);
-					OpcUa::NodeId nodeid(nodeNum, ns);
-					OpcUa::Node node = m_client->GetNode(nodeid);
-					n_subscriptions += addSubscribe(node, subscriptionParentPath, true);
-				} catch (exception& e) {
-					Logger::getLogger()->error("Failed to find node ns=%d;i=%d: %s", ns, nodeNum, e.what());
-				} catch (...) {
-					Logger::getLogger()->error("Failed to find node ns=%d;i=%d", ns, nodeNum);
-				}
-			}
-
+			DatapointValue vCount((long)count);
+			failures->push_back(new Datapoint(typeNames[i], vCount));
 		}
 	}
+	if (failures->empty())
+	{
+		delete failures;
+	}
 	else
 	{
+		DatapointValue vFailures(failures, true);
+		points.push_back(new Datapoint("conversionFailures", vFailures));
+	}
+}
 
+/**
+ * Log the percentiles of the latency of a stage since the last report,
+ * add them to the statistics reading in milliseconds and start a new
+ * reporting period.
+ *
+ * @param stage		The name of the stage
+ * @param latency	The latencies recorded for the stage
+ * @param points	The datapoints of the statistics reading
+ */
+void
+OPCUA::reportLatency(const string& stage, LatencyHistogram& latency, vector<Datapoint *>& points)
+{
+	uint64_t count = latency.count();
+	if (count == 0)
+	{
+		return;
+	}
+	double p50 = latency.percentile(50) / 1000.0;
+	double p99 = latency.percentile(99) / 1000.0;
+	double p999 = latency.percentile(99.9) / 1000.0;
+	double max = latency.max() / 1000.0;
+	Logger::getLogger()->info("Latency of %s over %lu values: "
+			"p50 %.1f ms, p99 %.1f ms, p99.9 %.1f ms, max %.1f ms",
+			stage.c_str(), count, p50, p99, p999, max);
+	DatapointValue v50(p50), v99(p99), v999(p999), vmax(max);
+	points.push_back(new Datapoint(stage + "P50", v50));
+	points.push_back(new Datapoint(stage + "P99", v99));
+	points.push_back(new Datapoint(stage + "P999", v999));
+	points.push_back(new Datapoint(stage + "Max", vmax));
+	latency.reset();
+}
 
-		OpcUa::Node root;
-		try {
-			root = m_client->GetRootNode();
-		} catch (exception &e) {
-			Logger::getLogger()->error("Failed to fetch root node from OPCUA server %s: %s", m_url.c_str(), e.what());
-			throw e;
+/**
+ * Adapt the publishing interval of the subscriptions to the backlog of
+ * readings waiting to be ingested. If the backlog or the time readings
+ * wait to be ingested stays above the high water mark the publishing
+ * interval is doubled, up to MAX_THROTTLE times the reporting interval.
+ * Once the backlog has stayed below the low water mark it is halved
+ * again. A change is only made after the condition has held for
+ * THROTTLE_CHECKS consecutive checks, to avoid oscillation.
+ *
+ * Only the bulk lane is considered and throttled; the subscriptions of
+ * the critical tags keep the critical reporting interval.
+ */
+void
+OPCUA::checkBacklog()
+{
+	if (!m_adaptiveSampling)
+	{
+		return;
+	}
+	long backlog = m_bulkQueue.getBacklog() + m_conversionPool.getBacklog();
+	long latency = backlog ? (long)m_bulkQueue.getIngestLatency() : 0;
+	int throttle = m_throttle;
+	if (backlog > m_backlogHigh || latency > m_backlogLatency)
+	{
+		m_drainedChecks = 0;
+		if (++m_pressureChecks >= THROTTLE_CHECKS && throttle < MAX_THROTTLE)
+		{
+			m_pressureChecks = 0;
+			m_throttle = throttle * 2;
 		}
-
-		/*
-		 * First look under the Objects root for any variables to subscribe to that
-		 * match out filter criteria for subscriptions.
-		 */
-		Logger::getLogger()->info("Look for variable to subscribe to under ObjectsNode");
-		lock_guard<mutex> guard(m_configMutex);
-		try {
-			n_subscriptions = addSubscribe(m_client->GetObjectsNode(), subscriptionParentPath,
-						m_subscriptions.size() == 0 ? true : false);
-		} catch (exception& e) {
-			Logger::getLogger()->error("Failed to create subscriptions from Objects node: %s", e.what());
+	}
+	else if (backlog < m_backlogLow && latency < m_backlogLatency / 2)
+	{
+		m_pressureChecks = 0;
+		if (++m_drainedChecks >= THROTTLE_CHECKS && throttle > 1)
+		{
+			m_drainedChecks = 0;
+			m_throttle = throttle / 2;
 		}
+	}
+	else
+	{
+		m_pressureChecks = 0;
+		m_drainedChecks = 0;
+	}
 
-		/*
-		 * If we failed to find subscriptions under the Objects node then
-		 * we will try again from the root.
-		 */
-		if (n_subscriptions == 0)
+	if (m_throttle != throttle)
+	{
+		Logger::getLogger()->warn("Ingest backlog is %ld readings with a latency of %ld ms, "
+				"changing publishing interval from %ld ms to %ld ms",
+				backlog, latency, m_reportingInterval * throttle, getPublishingInterval());
+		for (auto server : m_servers)
 		{
-			Logger::getLogger()->warn("Look for variable to subscribe to under the root node");
-			try {
-				n_subscriptions != addSubscribe(root, subscriptionParentPath, m_subscriptions.size() == 0 ? true : false);
-			} catch (exception& e) {
-				Logger::getLogger()->error("Failed to create subscriptions from root node: %s", e.what());
-			}
+			server->setPublishingInterval(getPublishingInterval());
 		}
 	}
-	if (n_subscriptions == 0)
+}
+
+/**
+ * Called when a data changed event is received from any of the servers. The reading
+ * is added to the ingest queue of its lane and sent to the south service by the
+ * ingest thread of that lane.
+ *
+ * @param points	        The points in the reading we must create
+ * @param assetPath			Full path to the Asset
+ * @param sourceTimestamp	Timestamp from the OPC UA server Source
+ * @param critical		The reading is of a critical tag
+ */
+void OPCUA::ingest(vector<Datapoint *> & points, const std::string & assetPath, OpcUa::DateTime sourceTimestamp,
+		bool critical)
+{
+	ingest(createReading(points, assetPath, sourceTimestamp), critical);
+}
+
+/**
+ * Add a reading to the ingest queue of its lane. When readings are
+ * built per object the reading of a bulk variable is applied to the
+ * shadow of its object instead.
+ *
+ * @param reading	The reading, created by createReading
+ * @param critical	The reading is of a critical tag
+ */
+void OPCUA::ingest(Reading *reading, bool critical)
+{
+	if (critical)
+	{
+		m_criticalQueue.push(reading);
+	}
+	else if (m_objects.isEnabled())
 	{
-		Logger::getLogger()->warn("No eligible variables in OPC UA server to which to subscribe");
+		m_objects.update(reading);
 	}
 	else
 	{
-		Logger::getLogger()->info("Added %d variable subscriptions.", n_subscriptions);
+		m_bulkQueue.push(reading);
 	}
 }
 
 /**
- * Stop all subscriptions and disconnect from the OPCUA server
+ * Record the time a data change notification spent in each stage before
+ * its reading was queued for ingest: from the source of the value to the
+ * server, from the server to the plugin and being converted to a reading.
+ * The first two are measured with the clocks of different hosts so are
+ * only as accurate as the clocks are synchronised. The time the reading
+ * then waits to be ingested is recorded by the ingest queue.
+ *
+ * @param dval		The value of the notification
+ * @param received	The time the notification was received
+ * @param conversion	The time taken to convert the value in microseconds
  */
-void
-OPCUA::stop()
+void OPCUA::recordLatency(const OpcUa::DataValue& dval, const OpcUa::DateTime& received, int64_t conversion)
 {
-	if (m_connected)
+	int64_t source = dval.SourceTimestamp;
+	int64_t server = dval.ServerTimestamp;
+	if (source && server)
 	{
-		subscriptionVariables.clear();
-		m_assetPathNames.clear();
-		m_client->Disconnect();
+		m_sourceLatency.record((server - source) / 10);	// 100 nanosecond units to microseconds
 	}
-	if (m_client)
+	if (server)
 	{
-		delete m_client;
+		m_networkLatency.record(((int64_t)received - server) / 10);
 	}
+	m_conversionLatency.record(conversion);
 }
 
 /**
- * Called when a data changed event is received. This calls back to the south service
- * and adds the points to the readings queue to send.
+ * Add a set of readings to the ingest queue of their lane in one go,
+ * or to the shadows of their objects when readings are built per object
  *
- * @param points	        The points in the reading we must create
- * @param assetPath			Full path to the Asset
+ * @param readings	The readings, created by createReading
+ * @param critical	The readings are of critical tags
+ */
+void OPCUA::ingest(const vector<Reading *>& readings, bool critical)
+{
+	if (critical)
+	{
+		m_criticalQueue.push(readings);
+	}
+	else if (m_objects.isEnabled())
+	{
+		m_objects.update(readings);
+	}
+	else
+	{
+		m_bulkQueue.push(readings);
+	}
+}
+
+/**
+ * Queue the readings of the objects whose variables have changed since
+ * the objects were last flushed, when readings are built per object
+ */
+void OPCUA::flushObjects()
+{
+	if (!m_objects.isEnabled())
+	{
+		return;
+	}
+	vector<Reading *> readings;
+	m_objects.flush(readings);
+	m_bulkQueue.push(readings);
+}
+
+/**
+ * Create the reading of a value of a variable
+ *
+ * @param points	The points in the reading
+ * @param assetPath	Full path to the Asset
  * @param sourceTimestamp	Timestamp from the OPC UA server Source
+ * @return		The reading
  */
-void OPCUA::ingest(vector<Datapoint *> & points, const std::string & assetPath, OpcUa::DateTime sourceTimestamp)
+Reading *OPCUA::createReading(vector<Datapoint *> & points, const std::string & assetPath,
+		OpcUa::DateTime sourceTimestamp)
 {
 	string asset = m_asset + assetPath;
 
@@ -755,8 +1169,46 @@ void OPCUA::ingest(vector<Datapoint *> & points, const std::string & assetPath,
 	tm.tv_sec = OpcUa::DateTime::ToTimeT(sourceTimestamp);
 	tm.tv_usec = (suseconds_t) (1E6 * modf(TimeAsSecondsFloat, &integerPart));	// convert fraction to number of microseconds
 
-	Reading reading(asset, points);
-	reading.setUserTimestamp(tm);
+	Reading *reading = new Reading(asset, points);
+	reading->setUserTimestamp(tm);
+	return reading;
+}
 
-	(*m_ingest)(m_data, reading);
+/**
+ * Write values to the variables of the servers. Each variable is named
+ * by the NodeId, asset path or asset name its values are reported under.
+ * The values for each server are sent in batched Write requests on the
+ * session the plugin already holds with the server. Of a redundant pair
+ * only the active server is written to.
+ *
+ * @param values	The names of the variables and the values to write
+ * @return		The status of the write of each value
+ */
+vector<OpcUa::StatusCode>
+OPCUA::write(const vector<pair<string, string> >& values)
+{
+	vector<OpcUa::StatusCode> status(values.size(), OpcUa::StatusCode::BadNodeIdUnknown);
+	vector<bool> resolved(values.size(), false);
+	lock_guard<mutex> guard(m_serversMutex);
+	size_t n_resolved = 0;
+	for (auto server : m_servers)
+	{
+		if (n_resolved == values.size())
+		{
+			break;
+		}
+		if (server->isActive())
+		{
+			n_resolved += server->writeValues(values, m_asset, status, resolved);
+		}
+	}
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		if (status[i] != OpcUa::StatusCode::Good)
+		{
+			Logger::getLogger()->warn("Write of %s to %s failed: %s", values[i].second.c_str(),
+					values[i].first.c_str(), OpcUa::ToString(status[i]).c_str());
+		}
+	}
+	return status;
 }
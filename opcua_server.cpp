@@ -0,0 +1,2621 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <opcua.h>
+#include <reading.h>
+#include <logger.h>
+#include <map>
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+using namespace std;
+
+// Delay between attempts to reconnect to a server that has failed
+#define RECONNECT_DELAY	5000
+
+// Maximum time in milliseconds a discovered variable waits to be subscribed to
+#define SUBSCRIBE_FLUSH_INTERVAL	200
+
+// Interval in milliseconds between discovery progress reports
+#define PROGRESS_INTERVAL	5000
+
+// NodeIds of the server capabilities that limit the size of requests
+#define MAX_BROWSE_CONTINUATION_POINTS	2735
+#define MAX_NODES_PER_READ		11705
+#define MAX_NODES_PER_WRITE		11707
+#define MAX_NODES_PER_BROWSE		11710
+#define MAX_MONITORED_ITEMS_PER_CALL	11714
+
+// The InfoType and Overflow bits of a StatusCode, set by the server when a
+// monitored item queue has overflowed
+#define STATUS_OVERFLOW	0x00000480
+
+// NodeIds of the Server object and the event types that report address space changes
+#define SERVER_OBJECT			2253
+#define BASE_MODEL_CHANGE_EVENT		2132
+#define GENERAL_MODEL_CHANGE_EVENT	2133
+#define SEMANTIC_CHANGE_EVENT		2738
+
+// Publishing interval in milliseconds, keep alive count and lifetime count of
+// the subscriptions of a standby server, whose notifications are not used
+#define STANDBY_PUBLISHING_INTERVAL	30000
+#define STANDBY_KEEP_ALIVE_COUNT	20
+#define STANDBY_LIFETIME_COUNT		60
+
+// Time in milliseconds over which model change events are collected before acting on them
+#define MODEL_CHANGE_DELAY	1000
+
+// Factor by which the address space check is slowed for servers that accept a
+// subscription to model change events, as some never raise them
+#define MODEL_EVENT_CHECK_FACTOR	10
+
+// Maximum depth of the browse tree, guards against reference loops
+#define MAX_BROWSE_DEPTH	1000
+
+// The HasEncoding reference type and the DataTypeDefinition attribute
+#define HAS_ENCODING		38
+#define DATA_TYPE_DEFINITION	26
+
+// Maximum number of rounds of reading the definitions of nested data types
+#define MAX_TYPE_LOOKUPS	16
+
+
+/**
+ * Constructor for a connection to a single OPC UA server
+ *
+ * @param opcua	The plugin instance that owns this server connection
+ * @param url	The URL of the OPC UA server
+ */
+OPCUAServer::OPCUAServer(OPCUA *opcua, const string& url) : m_opcua(opcua), m_url(url),
+	m_connected(false), m_active(true),
+	m_lastAlive(0), m_keepAliveThread(NULL), m_modelThread(NULL), m_recoverThread(NULL),
+	m_scanning(false), m_modelEvents(false),
+	m_running(false), m_stopping(false), m_recovering(false), m_gapStart(0),
+	m_reconnects(0), m_reconnectLatency(0), m_maxReconnectLatency(0), m_lostNotifications(0),
+	m_discovering(false), m_discoveryStart(0), m_discoveryDuration(0), m_nodesBrowsed(0),
+	m_nodesPending(0), m_itemsSubscribed(0), m_itemsFailed(0), m_oldestPending(0), m_lastProgress(0),
+	m_queueOverflows(0), m_statusChanges(0)
+{
+	setLimits(OperationLimits());
+}
+
+/**
+ * Destructor for the server connection
+ */
+OPCUAServer::~OPCUAServer()
+{
+	stop();
+	if (m_adopted)
+	{
+		try {
+			m_adopted->Disconnect();
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Error disconnecting from OPCUA server %s: %s", m_url.c_str(), e.what());
+		}
+	}
+}
+
+/**
+ * Check if an exception thrown by a request is the server rejecting
+ * the number of operations in the request
+ */
+static bool tooManyOperations(const exception& e)
+{
+	return strstr(e.what(), "TooManyOperations") != NULL;
+}
+
+/**
+ * Check if the status of a read of the Value attribute of a node allows
+ * a monitored item to be created for it. Only the statuses that describe
+ * the node itself, rather than the current value of the variable, are
+ * taken to mean it can not.
+ *
+ * @param status	The status of the read
+ * @return		True if the node can be monitored
+ */
+static bool canMonitor(OpcUa::StatusCode status)
+{
+	switch (status)
+	{
+		case OpcUa::StatusCode::BadNodeIdUnknown:
+		case OpcUa::StatusCode::BadNodeIdInvalid:
+		case OpcUa::StatusCode::BadAttributeIdInvalid:
+		case OpcUa::StatusCode::BadNotReadable:
+		case OpcUa::StatusCode::BadUserAccessDenied:
+			return false;
+		default:
+			return true;
+	}
+}
+
+/**
+ * Convert the value of a server capability to an integer
+ *
+ * @param value	The value read from the server
+ * @return	The capability, 0 if the value could not be read
+ */
+static uint32_t capability(const OpcUa::DataValue& value)
+{
+	if (value.Status != OpcUa::StatusCode::Good || value.Value.IsNul())
+	{
+		return 0;
+	}
+	switch (value.Value.Type())
+	{
+		case OpcUa::VariantType::UINT16:
+			return static_cast<uint16_t>(value.Value);
+		case OpcUa::VariantType::UINT32:
+			return static_cast<uint32_t>(value.Value);
+		case OpcUa::VariantType::INT32:
+			return static_cast<int32_t>(value.Value);
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Compute a fingerprint of the variables and child nodes of an object,
+ * independent of the order in which the server returns them.
+ *
+ * @param variables	The variables of the object
+ * @param children	The child nodes of the object
+ * @return		An FNV-1a hash of the NodeIds
+ */
+static uint64_t fingerprint(const vector<OpcUa::Node>& variables, const vector<OpcUa::Node>& children)
+{
+	vector<string> ids;
+	for (auto& var : variables)
+	{
+		ids.push_back(OpcUa::ToString(var.GetId()));
+	}
+	for (auto& child : children)
+	{
+		ids.push_back(OpcUa::ToString(child.GetId()));
+	}
+	sort(ids.begin(), ids.end());
+
+	uint64_t hash = 14695981039346656037ULL;
+	for (auto& id : ids)
+	{
+		for (auto c : id)
+		{
+			hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+		}
+		hash = (hash ^ 0xff) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Record that we have heard from the server, either by a data change
+ * notification or a response to a keep alive request.
+ */
+void
+OPCUAServer::alive()
+{
+	m_lastAlive = monotonicTime();
+}
+
+/**
+ * Account for a value the server has flagged as having overflowed the
+ * queue of its monitored item, i.e. the server has discarded values
+ * because they were changing faster than they could be published.
+ *
+ * @param status	The status of the data value
+ */
+void
+OPCUAServer::checkOverflow(OpcUa::StatusCode status)
+{
+	if ((static_cast<uint32_t>(status) & STATUS_OVERFLOW) == STATUS_OVERFLOW)
+	{
+		m_queueOverflows++;
+	}
+}
+
+/**
+ * Called when the server reports a change in the status of the subscription
+ *
+ * @param status	The new status of the subscription
+ */
+void
+OPCUAServer::statusChange(OpcUa::StatusCode status)
+{
+	m_statusChanges++;
+	Logger::getLogger()->warn("Subscription status of OPCUA server %s changed to %s",
+			m_url.c_str(), OpcUa::ToString(status).c_str());
+}
+
+/**
+ * Change the publishing interval of the subscription. The subscription
+ * of the critical tags, if any, is left at the critical reporting interval.
+ * The subscriptions of a standby server are left at the standby interval.
+ *
+ * @param interval	The new publishing interval in milliseconds
+ */
+void
+OPCUAServer::setPublishingInterval(long interval)
+{
+	lock_guard<mutex> guard(m_clientMutex);
+	if (!m_active || !m_connected || !m_client || !m_sub)
+	{
+		return;
+	}
+	modifySubscription(m_sub, interval, 0);
+}
+
+/**
+ * Make the server the active or the standby server of a redundant pair.
+ *
+ * The notifications of a standby server are discarded, so its
+ * subscriptions are published at STANDBY_PUBLISHING_INTERVAL with few
+ * keep alive messages, and are put back to the configured intervals
+ * when it is made active. The values discarded may be the latest values
+ * of variables that change slowly, so once active the current values of
+ * all the variables are read and reported; those no newer than the
+ * values already reported, or than the notifications received since,
+ * are dropped.
+ *
+ * A server that is made the standby because it has been lost has its
+ * subscriptions recreated, or set, at the standby interval once it has
+ * been reconnected.
+ *
+ * @param active	True to make the server the active server
+ */
+void
+OPCUAServer::setActive(bool active)
+{
+	lock_guard<mutex> guard(m_clientMutex);
+	if (active == m_active)
+	{
+		return;
+	}
+	if (!active || !m_connected || !m_client)
+	{
+		m_active = active;
+		if (isAlive(m_opcua->getKeepAliveTimeout()))
+		{
+			setRates();
+		}
+		return;
+	}
+
+	map<OpcUa::NodeId, string> variables;
+	{
+		lock_guard<mutex> itemGuard(m_itemMutex);
+		variables = m_assetPathNames;
+	}
+	vector<OpcUa::NodeId> ids;
+	vector<OpcUa::ReadValueId> items;
+	ids.reserve(variables.size());
+	items.reserve(variables.size());
+	for (auto& variable : variables)
+	{
+		ids.push_back(variable.first);
+		OpcUa::ReadValueId rv;
+		rv.NodeId = variable.first;
+		rv.AttributeId = OpcUa::AttributeId::Value;
+		items.push_back(rv);
+	}
+	// Notifications may arrive before the current values are read
+	expectInitialValues(items);
+	m_active = true;
+	setRates();
+	if (ids.empty())
+	{
+		return;
+	}
+
+	vector<OpcUa::DataValue> values;
+	try {
+		values = readAttributes(ids, OpcUa::AttributeId::Value, OpcUa::TimestampsToReturn::Source);
+	} catch (exception& e) {
+		Logger::getLogger()->warn("Unable to read the current values of %d variables from OPCUA server %s: %s",
+				(int)ids.size(), m_url.c_str(), e.what());
+		return;
+	}
+	vector<OpcUa::Node> bulkNodes, criticalNodes;
+	vector<OpcUa::DataValue> bulkValues, criticalValues;
+	size_t i = 0;
+	for (auto& variable : variables)
+	{
+		if (i >= values.size())
+		{
+			break;
+		}
+		OpcUa::Node node = m_client->GetNode(variable.first);
+		if (m_criticalSub && m_opcua->isCritical(node, variable.second))
+		{
+			criticalNodes.push_back(node);
+			criticalValues.push_back(values[i]);
+		}
+		else
+		{
+			bulkNodes.push_back(node);
+			bulkValues.push_back(values[i]);
+		}
+		i++;
+	}
+	snapshot(criticalNodes, criticalValues, true);
+	snapshot(bulkNodes, bulkValues, false);
+	Logger::getLogger()->info("Read the current values of %d variables of OPCUA server %s after making it active",
+			(int)values.size(), m_url.c_str());
+}
+
+/**
+ * Set the publishing intervals of the subscriptions to the configured
+ * intervals or, for a standby server, to the standby interval. Called
+ * with m_clientMutex held.
+ */
+void
+OPCUAServer::setRates()
+{
+	if (!m_connected || !m_client)
+	{
+		return;
+	}
+	if (m_sub)
+	{
+		modifySubscription(m_sub, m_opcua->getPublishingInterval(), 0);
+	}
+	if (m_criticalSub)
+	{
+		modifySubscription(m_criticalSub, m_opcua->getCriticalInterval(), 255);
+	}
+}
+
+/**
+ * Change the publishing interval of a subscription, or for a standby
+ * server set the standby interval. Called with m_clientMutex held.
+ *
+ * @param sub		The subscription
+ * @param interval	The publishing interval in milliseconds
+ * @param priority	The priority of the subscription
+ */
+void
+OPCUAServer::modifySubscription(OpcUa::Subscription::SharedPtr sub, long interval, uint8_t priority)
+{
+	bool standby = !m_active;
+	try {
+		OpcUa::ModifySubscriptionParameters params;
+		params.SubscriptionId = sub->GetId();
+		params.RequestedPublishingInterval = standby ? STANDBY_PUBLISHING_INTERVAL : interval;
+		params.RequestedLifetimeCount = standby ? STANDBY_LIFETIME_COUNT : m_opcua->getLifetimeCount();
+		params.RequestedMaxKeepAliveCount = standby ? STANDBY_KEEP_ALIVE_COUNT : m_opcua->getKeepAliveCount();
+		params.MaxNotificationsPerPublish = m_opcua->getMaxNotificationsPerPublish();
+		params.Priority = priority;
+		OpcUa::ModifySubscriptionResponse response =
+			m_client->GetRootNode().GetServices()->Subscriptions()->ModifySubscription(params);
+		Logger::getLogger()->info("Publishing interval of OPCUA server %s set to %.0f ms",
+				m_url.c_str(), response.Parameters.RevisedPublishingInterval);
+	} catch (exception& e) {
+		Logger::getLogger()->warn("Unable to change the publishing interval of OPCUA server %s: %s",
+				m_url.c_str(), e.what());
+	}
+}
+
+/**
+ * Check if we have heard from the server recently
+ *
+ * @param timeout	The time in milliseconds after which the server is considered lost
+ * @return	True if we have heard from the server within the timeout
+ */
+bool
+OPCUAServer::isAlive(long timeout)
+{
+	return m_connected && monotonicTime() - m_lastAlive < timeout;
+}
+
+/**
+ * Read an Asset Path from the NodeId-to-Path map
+ *
+ * @param nodeId			OPC UA NodeId
+ * @return					Asset Path
+ */
+std::string	OPCUAServer::getAssetPath(const OpcUa::NodeId& nodeId)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	try
+	{
+		return m_assetPathNames.at(nodeId);
+	}
+	catch (const std::out_of_range&)
+	{
+		return std::string("");
+	}
+}
+
+/**
+ * Add a subscribed variable to the NodeId-to-Path map. The map also
+ * serves as the list of monitored items to recreate should the session
+ * to the server be lost.
+ *
+ * @param nodeId	OPC UA NodeId
+ * @param path		Asset Path
+ */
+void OPCUAServer::setAssetPath(const OpcUa::NodeId& nodeId, const std::string& path)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	m_assetPathNames[nodeId] = path;
+}
+
+/**
+ * Record the source timestamp of a value received for a variable. If
+ * this is the first value following the recreation of the monitored
+ * items and the value has changed since the session was lost then at
+ * least one notification has been lost.
+ *
+ * @param nodeId	OPC UA NodeId
+ * @param timestamp	The source timestamp of the value
+ */
+void OPCUAServer::updateTimestamp(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	int64_t ts = static_cast<int64_t>(timestamp);
+	if (m_resubscribed.erase(nodeId) && ts > m_gapStart)
+	{
+		m_lostNotifications++;
+	}
+	m_lastTimestamps[nodeId] = ts;
+}
+
+/**
+ * Recurse the object tree and add subscriptions for all variables that are found.
+ * The member variable m_subscriptions holds filters that wil be applied to the
+ * subscription process. If this is non-empty then it contains a set of strings which
+ * are matched against the name of the items in the object tree. Only variables that are in
+ * a node that is a descendant of one of these named nodes is added to the subscription list.
+ *
+ * Variables are queued and subscribed to in batches, so the number returned only
+ * includes those variables whose batch has been sent to the server.
+ *
+ * @param	The node to recurse from
+ * @active	Should subscriptions be added, i.e. have we satisfied any filtering requirements.
+ * @return	The number of subscriptions added
+ */
+int OPCUAServer::addSubscribe(const OpcUa::Node& node, std::string& subscriptionParentPath, bool active)
+{
+	int n_subscriptions = 0;
+
+	if (m_stopping)
+	{
+		return 0;
+	}
+	n_subscriptions += browsed();
+
+	std::string subscriptionPath;
+	if (subscriptionParentPath.length() == 0)
+	{
+		subscriptionPath = m_opcua->getNodeName(node);
+	}
+	else
+	{
+		subscriptionPath = subscriptionParentPath + m_opcua->getPathDelimiter() + m_opcua->getNodeName(node);
+	}
+
+	BrowsedNode& browsedNode = m_browsedNodes[node.GetId()];
+	browsedNode.parentPath = subscriptionParentPath;
+	browsedNode.active = active;
+
+	try {
+		OpcUa::QualifiedName nName = node.GetBrowseName();
+		Logger::getLogger()->debug("addSubscribe: node (%d:%s) %s",
+					   nName.NamespaceIndex,
+					   nName.Name.c_str(),
+					   active ? "true" : "false");
+
+		vector<OpcUa::Node> variables = node.GetVariables();
+
+		if (variables.size() > 0)
+		{
+			Logger::getLogger()->debug("Node (%d:%s) has %d variables",
+						   nName.NamespaceIndex,
+						   nName.Name.c_str(),
+						   variables.size());
+		}
+
+		// Special case of being called with a variable
+		if (m_opcua->isSubscribeById() &&
+		    node.GetNodeClass() == OpcUa::NodeClass::Variable)
+		{
+			// Get ParentName
+			OpcUa::Node parent = node.GetParent();
+			string key;
+			try {
+				OpcUa::QualifiedName pName = parent.GetBrowseName();
+				// Create key
+				key = to_string(nName.NamespaceIndex) + ":" + pName.Name + ":" + nName.Name;
+			} catch (...) {
+				Logger::getLogger()->warn("Failed to get parent browse name for a variable (%d:%s)", nName.NamespaceIndex, nName.Name.c_str());
+				key = to_string(nName.NamespaceIndex) + ":_:" +  nName.Name;
+			}
+
+			// Add variable if not existant
+			if (m_subscriptionVariables.find(key) == m_subscriptionVariables.end())
+			{
+				m_subscriptionVariables[key] = true;
+				Logger::getLogger()->debug("Adding subscription variable by Id (%s) to "
+							   "the map, key (%s)",
+				nName.Name.c_str(),
+				key.c_str());
+
+				n_subscriptions += foundVariable(node, node.GetId(),
+						m_opcua->createAssetName(node, subscriptionPath));
+			}
+			return n_subscriptions;
+		}
+
+		// Get variables
+		for (auto var : variables)
+		{
+			bool varMatched = false;
+			OpcUa::QualifiedName qName = var.GetBrowseName();
+			// Create key for variables std::map
+			// key is : NameSpaceIndex : NodeName : VarName 
+			string key = to_string(qName.NamespaceIndex) + ":" + nName.Name + ":" + qName.Name;
+
+			// Get configuration items: ObjectNames or Variables
+			for (auto it = m_subscriptions.begin();
+				  it != m_subscriptions.end(); ++it)
+			{
+				size_t pos;
+				string subName = *it;
+		
+				if (m_opcua->isSubscribeById())
+				{
+					// Check whether to add variable to the map
+					if (m_subscriptionVariables.find(key) == m_subscriptionVariables.end())
+					{
+						varMatched = true;
+						m_subscriptionVariables[key] = true;
+						Logger::getLogger()->debug("Adding subscription variable (%s) to "
+									   "the map, key (%s)",
+									   subName.c_str(),
+									   key.c_str());
+					}
+				}
+				else if ((pos = subName.find(":")) != string::npos)
+				{
+					unsigned long pns = 0;
+					try {
+						pns = stoul(subName.substr(0, pos), NULL, 10);
+					}
+					catch (exception& e)
+					{
+						Logger::getLogger()->error("Exception while parsing "
+									   "configuration element '%s' in node '%d:%s', "
+									   "error '%s'. Configuration element removed.",
+									   subName.c_str(),
+									   qName.NamespaceIndex,
+									   qName.Name.c_str(),
+									   e.what());
+
+						// Remove configuration item
+						m_subscriptions.erase(it);
+						continue;
+					}
+					Logger::getLogger()->debug("Variable %s has namespace in it, pns %d",
+								   subName.c_str(),
+								   pns);
+					if (qName.Name.compare(subName.substr(pos + 1)) == 0 
+							&& pns == qName.NamespaceIndex)
+					{
+						// Check whether to add variable to the map
+						if (m_subscriptionVariables.find(key) == m_subscriptionVariables.end())
+						{
+							varMatched = true;
+							m_subscriptionVariables[key] = true;
+							Logger::getLogger()->debug("Adding subscription variable (%s) to "
+										   "the map, key (%s)",
+										   subName.c_str(),
+										   key.c_str());
+						}
+					}
+				}
+				else if (subName.compare(qName.Name) == 0)
+				{
+					// Check whether to add variable to the map
+					if (m_subscriptionVariables.find(key) == m_subscriptionVariables.end())
+					{
+						varMatched = true;
+						m_subscriptionVariables[key] = true;
+						Logger::getLogger()->debug("Adding subscription variable (%s) to the map "
+									   " key (%s)",
+									   subName.c_str(),
+									   key.c_str());
+					}
+				}
+			}
+
+			// Now handleSubscribeDataChange call
+			if (active || varMatched)
+			{
+				// Handle variable
+				if (varMatched)
+				{
+					auto it = m_subscriptionVariables.find(key);
+					if (it != m_subscriptionVariables.end())
+					{
+						if ((*it).second == true)
+						{
+							Logger::getLogger()->debug("Subscribing to individual variable (%s)",
+										   key.c_str());
+
+							n_subscriptions += foundVariable(var, node.GetId(),
+									m_opcua->createAssetName(var, subscriptionPath));
+							// We're done with this variable
+							(*it).second = false;
+						}
+					}
+				}
+
+				// Handle ObjectNode
+				if (active)
+				{
+					auto it = m_subscriptionVariables.find(key);
+					// Check whether an existing variable has to be subscribed
+					bool subscribeVariable = true;
+					if (it != m_subscriptionVariables.end())
+					{
+						subscribeVariable = (*it).second;
+						if (subscribeVariable)
+						{
+							(*it).second = false;
+						}
+					}
+
+					if (subscribeVariable)
+					{
+						Logger::getLogger()->debug("Subscribing to variable (%s), belonging to (%d:%s)",
+									   qName.Name.c_str(),
+									   qName.NamespaceIndex,
+									   nName.Name.c_str());
+
+						n_subscriptions += foundVariable(var, node.GetId(),
+								m_opcua->createAssetName(var, subscriptionPath));
+					}
+				}
+			}
+		}
+
+		vector<OpcUa::Node> children = node.GetChildren();
+		Logger::getLogger()->debug("Node (%d:%s) has %d children",
+					   nName.NamespaceIndex,
+					   nName.Name.c_str(),
+					   children.size());
+		m_nodesPending += children.size();
+		browsedNode.fingerprint = fingerprint(variables, children);
+
+		for (auto child : children)
+		{
+			bool child_active = active;
+			if (! child_active)
+			{
+				OpcUa::QualifiedName qName = child.GetBrowseName();
+				for (auto it = m_subscriptions.begin();
+					  it != m_subscriptions.end(); ++it)
+				{
+					string parent = *it;
+					{
+						size_t pos;
+						if ((pos = parent.find(":")) != string::npos)
+						{
+							unsigned long pns = 0;
+							try {
+								pns = stoul(parent.substr(0, pos), NULL, 10);
+							}
+							catch (exception& e)
+							{
+								Logger::getLogger()->error("Exception while parsing "
+											   "configuration element '%s' in "
+											   "child node '%d:%s', error '%s'. "
+											   "Configuration element removed.",
+											   parent.c_str(),
+											   qName.NamespaceIndex,
+											   qName.Name.c_str(),
+											   e.what());
+
+								// Remove configuration item
+								m_subscriptions.erase(it);
+								continue;
+							}
+							if (qName.Name.compare(parent.substr(pos + 1)) == 0 
+									&& pns == qName.NamespaceIndex)
+							{
+								child_active = true;
+							}
+						}
+						else if (parent.compare(qName.Name) == 0)
+						{
+							child_active = true;
+						}
+					}
+				}
+			}
+			m_nodesPending--;
+			BrowsedNode& childNode = m_browsedNodes[child.GetId()];
+			childNode.parent = node.GetId();
+			childNode.hasParent = true;
+			try {
+				n_subscriptions += addSubscribe(child, subscriptionPath, child_active);
+			} catch (exception& e) {
+				OpcUa::QualifiedName cName = child.GetBrowseName();
+				Logger::getLogger()->warn("Failed to add subscriptions for child %d:%s, %s",
+						cName.NamespaceIndex, cName.Name.c_str(), e.what());
+			}
+		}
+
+		return n_subscriptions;
+	} catch(const std::runtime_error& re) {
+		Logger::getLogger()->error("addSubscribe: Runtime error: %s", re.what());
+	} catch(const exception& e) {
+		Logger::getLogger()->error("addSubscribe: Exception: %s", e.what());
+	} catch(...) {
+		Logger::getLogger()->error("addSubscribe: Unknown error occured");
+	}
+	return 0;
+}
+
+/**
+ * Called by the browse for each variable that matches the subscription
+ * configuration. The variable is queued to be subscribed to or, if the
+ * server is being browsed again to look for changes, recorded.
+ *
+ * @param var		The variable found
+ * @param parent	The object the variable was found in
+ * @param assetPath	The asset name for the variable
+ * @return		The number of variables subscribed to
+ */
+int
+OPCUAServer::foundVariable(const OpcUa::Node& var, const OpcUa::NodeId& parent, const string& assetPath)
+{
+	m_itemParents[var.GetId()] = parent;
+	if (m_scanning)
+	{
+		m_scanned[var.GetId()] = assetPath;
+		return 0;
+	}
+	setAssetPath(var.GetId(), assetPath);
+	return queueSubscribe(var);
+}
+
+/**
+ * Starts the plugin
+ *
+ * We register with the OPC UA server, retrieve all the objects under the parent
+ * to which we are subscribing and start the process to enable OPC UA to send us
+ * change notifications for those items.
+ */
+void
+OPCUAServer::start()
+{
+	m_subscriptionVariables.clear();
+	{
+		lock_guard<mutex> guard(m_itemMutex);
+		m_assetPathNames.clear();
+		m_writeTypes.clear();
+		m_lastTimestamps.clear();
+		m_deadbandValues.clear();
+		m_initialValues.clear();
+		m_resubscribed.clear();
+	}
+	{
+		lock_guard<mutex> guard(m_browseMutex);
+		m_browsedNodes.clear();
+		m_itemParents.clear();
+		m_itemHandles.clear();
+	}
+	m_subscriptions = m_opcua->getSubscriptions();
+
+	connect();
+	startKeepAlive();
+	discover();
+}
+
+/**
+ * Start the server in the background. The server is connected to and
+ * browsed on a separate thread, retrying until the server is reached.
+ * The subscriptions are created in batches as the server is browsed,
+ * so data will start to flow before discovery is complete.
+ */
+void
+OPCUAServer::startInBackground()
+{
+	lock_guard<mutex> guard(m_stateMutex);
+	m_recovering = true;
+	m_recoverThread = new thread(&OPCUAServer::startThread, this);
+}
+
+/**
+ * Thread that starts the server, retrying until successful or asked to stop
+ */
+void
+OPCUAServer::startThread()
+{
+	unique_lock<mutex> lck(m_stateMutex);
+	while (!m_stopping)
+	{
+		lck.unlock();
+		bool started = false;
+		try {
+			start();
+			started = true;
+		} catch (...) {
+			// Failure has already been logged
+			disconnect();
+		}
+		lck.lock();
+		if (started)
+		{
+			break;
+		}
+		m_stateCV.wait_for(lck, chrono::milliseconds(RECONNECT_DELAY));
+	}
+	m_recovering = false;
+}
+
+/**
+ * Create the session with the OPC UA server and the subscription that
+ * the monitored items will be added to. Anything left from a previous
+ * session is released first, so repeated attempts to connect do not
+ * accumulate clients.
+ *
+ * A session handed over by adopt() is used if it still responds. Else
+ * the endpoint selected the last time the plugin connected to the URL
+ * is used, saving the request for the endpoints of the server; it is
+ * selected again if the connection fails. The time of each phase of
+ * connecting is logged.
+ */
+void
+OPCUAServer::connect()
+{
+	release();
+	int64_t started = monotonicTimeMicros();
+	int64_t endpointTime = 0, sessionTime = 0;
+	string endpointSource = "cached";
+	unique_ptr<OpcUa::UaClient> client(std::move(m_adopted));
+	if (client)
+	{
+		// A session kept from before the plugin was reconfigured
+		try {
+			client->GetNode(OpcUa::NodeId(OpcUa::ObjectId::Server_ServerStatus_State)).GetValue();
+			endpointSource = "reused session";
+		} catch (exception& e) {
+			Logger::getLogger()->info("The session with OPCUA server %s can not be reused: %s",
+					m_url.c_str(), e.what());
+			try {
+				client->Disconnect();
+			} catch (...) {
+				// The session is already unusable
+			}
+			client.reset();
+		}
+		sessionTime = monotonicTimeMicros() - started;
+	}
+	for (int attempt = 0; !client; attempt++)
+	{
+		unique_ptr<OpcUa::UaClient> fresh(new OpcUa::UaClient(Logger::getLogger()));
+		OpcUa::EndpointDescription endpoint;
+		bool cached = attempt == 0 && m_opcua->getEndpoint(m_url, endpoint);
+		int64_t phase = monotonicTimeMicros();
+		try {
+			if (!cached)
+			{
+				// As UaClient::Connect(url) does, but keeping the endpoint
+				// so that the next connection need not request it again
+				endpoint = fresh->SelectEndpoint(m_url);
+				endpoint.EndpointUrl = m_url;
+				endpointSource = "selected";
+			}
+			endpointTime = monotonicTimeMicros() - phase;
+			phase = monotonicTimeMicros();
+			fresh->Connect(endpoint);
+			sessionTime = monotonicTimeMicros() - phase;
+		} catch (exception &e) {
+			if (cached)
+			{
+				Logger::getLogger()->info("Unable to connect to the cached endpoint of OPCUA server %s, "
+						"selecting the endpoint again: %s", m_url.c_str(), e.what());
+				m_opcua->clearEndpoint(m_url);
+				continue;
+			}
+			Logger::getLogger()->error("Failed to connect to OPCUA server %s: %s", m_url.c_str(), e.what());
+			throw;
+		}
+		if (!cached)
+		{
+			m_opcua->setEndpoint(m_url, endpoint);
+		}
+		client = std::move(fresh);
+	}
+	{
+		lock_guard<mutex> guard(m_clientMutex);
+		m_client = std::move(client);
+	}
+	m_connected = true;
+	alive();
+	m_types.clear();
+	int64_t subscriptionStart = monotonicTimeMicros();
+
+	try {
+		{
+			lock_guard<mutex> guard(m_clientMutex);
+			m_subClient.reset(new OpcUaClient(m_opcua, this, false));
+			m_sub = createSubscription(*m_subClient, m_opcua->getPublishingInterval(), 0);
+		}
+
+		// The critical tags have a subscription of their own, with a higher
+		// priority, so the server publishes their notifications first and
+		// they are not queued behind the bulk of the data.
+		if (m_opcua->hasCriticalTags())
+		{
+			lock_guard<mutex> guard(m_clientMutex);
+			m_criticalClient.reset(new OpcUaClient(m_opcua, this, true));
+			m_criticalSub = createSubscription(*m_criticalClient, m_opcua->getCriticalInterval(), 255);
+		}
+
+		// Watch for nodes being added to or removed from the server
+		try {
+			m_sub->SubscribeEvents(m_client->GetNode(OpcUa::NodeId(SERVER_OBJECT, 0)),
+					m_client->GetNode(OpcUa::NodeId(BASE_MODEL_CHANGE_EVENT, 0)));
+			m_modelEvents = true;
+		} catch (exception& e) {
+			m_modelEvents = false;
+			Logger::getLogger()->info("OPCUA server %s does not publish model change events, "
+					"its address space will be checked for changes every %ld ms: %s",
+					m_url.c_str(), m_opcua->getModelCheckInterval(), e.what());
+		}
+
+		// The client library keeps one publish request outstanding, add
+		// more so the server always has one to respond to on links with
+		// a long round trip time.
+		OpcUa::Services::SharedPtr services = m_client->GetRootNode().GetServices();
+		for (int i = 1; i < m_opcua->getPublishRequests(); i++)
+		{
+			services->Subscriptions()->Publish(OpcUa::PublishRequest());
+		}
+	} catch (exception &e) {
+		Logger::getLogger()->error("Failed to setup subscription infrastructure for OPCUA server %s: %s", m_url.c_str(), e.what());
+		throw;
+	}
+
+	int64_t limitsStart = monotonicTimeMicros();
+	probeLimits();
+	int64_t finished = monotonicTimeMicros();
+	Logger::getLogger()->info("Connected to OPCUA server %s in %.1f ms: endpoint %.1f ms (%s), "
+			"session %.1f ms, subscriptions %.1f ms, operation limits %.1f ms",
+			m_url.c_str(), (finished - started) / 1000.0, endpointTime / 1000.0,
+			endpointSource.c_str(), sessionTime / 1000.0,
+			(limitsStart - subscriptionStart) / 1000.0, (finished - limitsStart) / 1000.0);
+}
+
+/**
+ * Create a subscription on the session with the server. The
+ * subscriptions of a standby server are created with the standby
+ * publishing interval.
+ *
+ * @param handler	The handler for the notifications of the subscription
+ * @param interval	The requested publishing interval in milliseconds
+ * @param priority	The priority of the subscription relative to the others of the session
+ * @return		The subscription
+ */
+OpcUa::Subscription::SharedPtr
+OPCUAServer::createSubscription(OpcUaClient& handler, long interval, uint8_t priority)
+{
+	bool standby = !m_active;
+	OpcUa::CreateSubscriptionParameters params;
+	params.RequestedPublishingInterval = standby ? STANDBY_PUBLISHING_INTERVAL : interval;
+	params.RequestedLifetimeCount = standby ? STANDBY_LIFETIME_COUNT : m_opcua->getLifetimeCount();
+	params.RequestedMaxKeepAliveCount = standby ? STANDBY_KEEP_ALIVE_COUNT : m_opcua->getKeepAliveCount();
+	params.MaxNotificationsPerPublish = m_opcua->getMaxNotificationsPerPublish();
+	params.PublishingEnabled = true;
+	params.Priority = priority;
+	return std::make_shared<OpcUa::Subscription>(m_client->GetRootNode().GetServices(), params,
+			handler, Logger::getLogger());
+}
+
+/**
+ * Set the size of the requests we make to the server from the
+ * OperationLimits it reports. The limits are only read the first time
+ * we connect to a server, after that the limits cached by the plugin,
+ * which include any reductions made because the server rejected a
+ * request, are used.
+ */
+void
+OPCUAServer::probeLimits()
+{
+	OperationLimits limits;
+	if (m_opcua->getOperationLimits(m_url, limits))
+	{
+		setLimits(limits);
+		return;
+	}
+
+	vector<OpcUa::NodeId> nodes;
+	nodes.push_back(OpcUa::NodeId(MAX_NODES_PER_READ, 0));
+	nodes.push_back(OpcUa::NodeId(MAX_NODES_PER_WRITE, 0));
+	nodes.push_back(OpcUa::NodeId(MAX_NODES_PER_BROWSE, 0));
+	nodes.push_back(OpcUa::NodeId(MAX_MONITORED_ITEMS_PER_CALL, 0));
+	nodes.push_back(OpcUa::NodeId(MAX_BROWSE_CONTINUATION_POINTS, 0));
+	try {
+		vector<OpcUa::DataValue> values = readAttributes(nodes, OpcUa::AttributeId::Value);
+		if (values.size() == nodes.size())
+		{
+			// A limit of zero means the server does not impose a limit
+			if (capability(values[0]))
+				limits.maxNodesPerRead = capability(values[0]);
+			if (capability(values[1]))
+				limits.maxNodesPerWrite = capability(values[1]);
+			if (capability(values[2]))
+				limits.maxNodesPerBrowse = capability(values[2]);
+			if (capability(values[3]))
+				limits.maxMonitoredItemsPerCall = capability(values[3]);
+			limits.maxBrowseContinuationPoints = capability(values[4]);
+		}
+	} catch (exception& e) {
+		Logger::getLogger()->warn("Unable to read the operation limits of OPCUA server %s, using defaults: %s",
+				m_url.c_str(), e.what());
+	}
+	Logger::getLogger()->info("OPCUA server %s operation limits: read %u, write %u, browse %u, "
+			"monitored items %u, browse continuation points %u",
+			m_url.c_str(), limits.maxNodesPerRead, limits.maxNodesPerWrite,
+			limits.maxNodesPerBrowse, limits.maxMonitoredItemsPerCall,
+			limits.maxBrowseContinuationPoints);
+	setLimits(limits);
+	m_opcua->setOperationLimits(m_url, limits);
+}
+
+/**
+ * Set the request sizes we use with the server
+ *
+ * @param limits	The request sizes
+ */
+void
+OPCUAServer::setLimits(const OperationLimits& limits)
+{
+	m_maxNodesPerRead = limits.maxNodesPerRead;
+	m_maxNodesPerWrite = limits.maxNodesPerWrite;
+	m_maxNodesPerBrowse = limits.maxNodesPerBrowse;
+	m_maxMonitoredItemsPerCall = limits.maxMonitoredItemsPerCall;
+	m_maxBrowseContinuationPoints = limits.maxBrowseContinuationPoints;
+}
+
+/**
+ * Reduce one of the request sizes after the server rejected a request
+ * of the given size. The reduced size is cached so that the next session
+ * with the server starts with it.
+ *
+ * @param limit		The request size to reduce
+ * @param failed	The size of the rejected request
+ * @param name		The name of the limit, for logging
+ */
+void
+OPCUAServer::reduceLimit(atomic<uint32_t>& limit, uint32_t failed, const char *name)
+{
+	uint32_t reduced = failed > 1 ? failed / 2 : 1;
+	if (reduced < limit)
+	{
+		limit = reduced;
+	}
+	Logger::getLogger()->warn("OPCUA server %s rejected %u nodes per %s, reducing to %u",
+			m_url.c_str(), failed, name, (uint32_t)limit);
+
+	OperationLimits limits;
+	limits.maxNodesPerRead = m_maxNodesPerRead;
+	limits.maxNodesPerWrite = m_maxNodesPerWrite;
+	limits.maxNodesPerBrowse = m_maxNodesPerBrowse;
+	limits.maxMonitoredItemsPerCall = m_maxMonitoredItemsPerCall;
+	limits.maxBrowseContinuationPoints = m_maxBrowseContinuationPoints;
+	m_opcua->setOperationLimits(m_url, limits);
+}
+
+/**
+ * Browse the server for the variables that match the subscription
+ * configuration and add a monitored item for each of them.
+ */
+void
+OPCUAServer::discover()
+{
+int n_subscriptions = 0;
+std::string subscriptionParentPath;
+
+	lock_guard<mutex> guard(m_browseMutex);
+	m_discovering = true;
+	m_discoveryStart = monotonicTime();
+	m_lastProgress = m_discoveryStart;
+	m_nodesBrowsed = 0;
+	m_nodesPending = 0;
+	m_itemsSubscribed = 0;
+	m_itemsFailed = 0;
+	m_pendingItems.clear();
+	m_pendingCritical.clear();
+
+	if (m_opcua->isSubscribeById())
+	{
+		for (auto it = m_subscriptions.begin(); it != m_subscriptions.end(); ++it)
+		{
+			string subscription = (*it);
+			// Parse out ns=..;s=...
+			size_t sStart = subscription.find("s=");
+			size_t iStart = subscription.find("i=");
+			size_t nsStart = subscription.find("ns=");
+			size_t delim = subscription.find(";");
+
+			if (sStart != string::npos && nsStart != string::npos && sStart == nsStart + 1)
+			{
+				sStart = subscription.find("s=", sStart + 1);
+			}
+			if ((sStart == string::npos && iStart == string::npos) || nsStart == string::npos || delim == string::npos)
+			{
+				Logger::getLogger()->error(
+					"Malformed subscription string '%s', must be of the form ns=...;s=... or ns=...;i=...",
+						subscription.c_str());
+				continue;
+			}
+			string str;
+			int ns;
+			if (sStart != string::npos)
+			{
+				if (sStart < delim)
+					str = subscription.substr(sStart + 2, delim - (sStart + 2));
+				else if (sStart > delim)
+					str = subscription.substr(sStart + 2);
+				if (nsStart < delim)
+					ns = atoi(subscription.substr(nsStart + 3, delim - (nsStart + 3)).c_str());
+				else if (nsStart > delim)
+					ns = atoi(subscription.substr(nsStart + 3).c_str());
+				try {
+					OpcUa::NodeId nodeid(str, ns);
+					Logger::getLogger()->info("Add string subscription %s", str.c_str());
+					OpcUa::Node node = m_client->GetNode(nodeid);
+					n_subscriptions += addSubscribe(node, subscriptionParentPath, true);
+				} catch (...) {
+					Logger::getLogger()->error("Failed to find node ns=%d;s=%s", ns, str.c_str());
+				}
+			}
+			else if (iStart != string::npos)
+			{
+				if (iStart < delim)
+					str = subscription.substr(iStart + 2, delim - (iStart + 2));
+				else if (iStart > delim)
+					str = subscription.substr(iStart + 2);
+				if (nsStart < delim)
+					ns = atoi(subscription.substr(nsStart + 3, delim - (nsStart + 3)).c_str());
+				else if (nsStart > delim)
+					ns = atoi(subscription.substr(nsStart + 3).c_str());
+				uint32_t nodeNum = atoi(str.c_str());
+				try {
+					Logger::getLogger()->info("Add integer subscription %d:%d", ns, nodeNum);
+					OpcUa::NodeId nodeid(nodeNum, ns);
+					OpcUa::Node node = m_client->GetNode(nodeid);
+					n_subscriptions += addSubscribe(node, subscriptionParentPath, true);
+				} catch (exception& e) {
+					Logger::getLogger()->error("Failed to find node ns=%d;i=%d: %s", ns, nodeNum, e.what());
+				} catch (...) {
+					Logger::getLogger()->error("Failed to find node ns=%d;i=%d", ns, nodeNum);
+				}
+			}
+
+		}
+		n_subscriptions += flushSubscribe();
+	}
+	else if (!m_subscriptions.empty() || m_opcua->getTags().empty())
+	{
+		OpcUa::Node root;
+		try {
+			root = m_client->GetRootNode();
+		} catch (exception &e) {
+			Logger::getLogger()->error("Failed to fetch root node from OPCUA server %s: %s", m_url.c_str(), e.what());
+			throw;
+		}
+
+		/*
+		 * First look under the Objects root for any variables to subscribe to that
+		 * match out filter criteria for subscriptions.
+		 */
+		Logger::getLogger()->info("Look for variable to subscribe to under ObjectsNode");
+		try {
+			n_subscriptions = addSubscribe(m_client->GetObjectsNode(), subscriptionParentPath,
+						m_subscriptions.size() == 0 ? true : false);
+			n_subscriptions += flushSubscribe();
+		} catch (exception& e) {
+			Logger::getLogger()->error("Failed to create subscriptions from Objects node: %s", e.what());
+		}
+
+		/*
+		 * If we failed to find subscriptions under the Objects node then
+		 * we will try again from the root.
+		 */
+		if (n_subscriptions == 0)
+		{
+			Logger::getLogger()->warn("Look for variable to subscribe to under the root node");
+			try {
+				n_subscriptions = addSubscribe(root, subscriptionParentPath, m_subscriptions.size() == 0 ? true : false);
+				n_subscriptions += flushSubscribe();
+			} catch (exception& e) {
+				Logger::getLogger()->error("Failed to create subscriptions from root node: %s", e.what());
+			}
+		}
+	}
+	n_subscriptions += addTags();
+	if (n_subscriptions == 0)
+	{
+		Logger::getLogger()->warn("No eligible variables in OPC UA server %s to which to subscribe", m_url.c_str());
+	}
+	else
+	{
+		Logger::getLogger()->info("Added %d variable subscriptions for %s.", n_subscriptions, m_url.c_str());
+	}
+	m_discoveryDuration = monotonicTime() - m_discoveryStart;
+	m_discovering = false;
+	Logger::getLogger()->info("Discovery of OPCUA server %s completed in %ld ms, %ld nodes browsed, %ld subscriptions failed",
+			m_url.c_str(), (long)m_discoveryDuration, (long)m_nodesBrowsed, (long)m_itemsFailed);
+}
+
+/**
+ * Record that a node has been browsed and periodically report the
+ * progress of the discovery. The completion is estimated from the
+ * number of nodes browsed and the number found but not yet browsed.
+ *
+ * The queued variables are subscribed to once the oldest has waited
+ * SUBSCRIBE_FLUSH_INTERVAL, so they are not held while the browse walks
+ * objects that have no variables.
+ *
+ * @return	The number of variables subscribed to
+ */
+int
+OPCUAServer::browsed()
+{
+	m_nodesBrowsed++;
+	int64_t t = monotonicTime();
+	if (t - m_lastProgress >= PROGRESS_INTERVAL)
+	{
+		m_lastProgress = t;
+		Logger::getLogger()->info("Discovery of OPCUA server %s is %d%% complete, %ld nodes browsed, %ld variables subscribed",
+				m_url.c_str(), getDiscoveryProgress(), (long)m_nodesBrowsed, (long)m_itemsSubscribed);
+	}
+	if (m_oldestPending && t - m_oldestPending >= SUBSCRIBE_FLUSH_INTERVAL)
+	{
+		return flushSubscribe();
+	}
+	return 0;
+}
+
+/**
+ * Return an estimate of how complete the discovery of the server is
+ *
+ * @return	The percentage of the discovery that is complete
+ */
+int
+OPCUAServer::getDiscoveryProgress()
+{
+	if (!m_discovering)
+	{
+		return m_discoveryStart ? 100 : 0;
+	}
+	uint64_t browsed = m_nodesBrowsed;
+	uint64_t pending = m_nodesPending;
+	return (int)((browsed * 100) / (browsed + pending + 1));
+}
+
+/**
+ * Queue a variable to be subscribed to. The queue is sent to the server
+ * when it is full or the oldest entry has waited long enough.
+ *
+ * @param node	The variable to subscribe to
+ * @return	The number of variables subscribed to
+ */
+int
+OPCUAServer::queueSubscribe(const OpcUa::Node& node)
+{
+	queueItem(node, getAssetPath(node.GetId()));
+	if (m_pendingItems.size() + m_pendingCritical.size() >= m_maxMonitoredItemsPerCall
+			|| monotonicTime() - m_oldestPending >= SUBSCRIBE_FLUSH_INTERVAL)
+	{
+		return flushSubscribe();
+	}
+	return 0;
+}
+
+/**
+ * Subscribe to the variables of the tag file that are on this server.
+ * The rows of the tag file name variables, so they are subscribed to
+ * without browsing the server. Only the rows whose server column names
+ * this server are used; rows that name no server are on the main server.
+ * The values of a variable are reported under the group of its tag,
+ * or if it has none the name of its tag or its NodeId.
+ *
+ * @return	The number of variables subscribed to
+ */
+int
+OPCUAServer::addTags()
+{
+	const vector<Tag>& tags = m_opcua->getTags();
+	if (tags.empty())
+	{
+		return 0;
+	}
+	int n_subscriptions = 0, n_tags = 0;
+	for (auto& tag : tags)
+	{
+		if (m_stopping)
+		{
+			break;
+		}
+		if (m_tagServer.find(tag.server) == m_tagServer.end())
+		{
+			continue;
+		}
+		n_tags++;
+		if (!getAssetPath(tag.nodeId).empty())
+		{
+			// Already subscribed to through the subscriptions of the configuration
+			continue;
+		}
+		OpcUa::Node node = m_client->GetNode(tag.nodeId);
+		string assetPath = tag.group;
+		if (assetPath.empty())
+		{
+			assetPath = tag.name.empty() ? m_opcua->NodeIdString(node) : tag.name;
+		}
+		n_subscriptions += foundVariable(node, tag.nodeId, assetPath);
+	}
+	Logger::getLogger()->info("Subscribing to %d variables of the tag file on OPCUA server %s",
+			n_tags, m_url.c_str());
+	return n_subscriptions + flushSubscribe();
+}
+
+/**
+ * Check if a value of a variable with a deadband differs from the last
+ * value reported by no more than the deadband. Values of other than
+ * numeric types are always reported.
+ *
+ * @param nodeId	The NodeId of the variable
+ * @param value		The value received
+ * @param deadband	The deadband of the variable
+ * @return		True if the value should not be reported
+ */
+bool
+OPCUAServer::inDeadband(const OpcUa::NodeId& nodeId, const DatapointValue& value, double deadband)
+{
+	double current;
+	if (value.getType() == DatapointValue::T_INTEGER)
+		current = value.toInt();
+	else if (value.getType() == DatapointValue::T_FLOAT)
+		current = value.toDouble();
+	else
+		return false;
+
+	lock_guard<mutex> guard(m_itemMutex);
+	auto it = m_deadbandValues.find(nodeId);
+	if (it != m_deadbandValues.end() && fabs(current - it->second) <= deadband)
+	{
+		return true;
+	}
+	m_deadbandValues[nodeId] = current;
+	return false;
+}
+
+/**
+ * Add a variable to the queue of the subscription it belongs to,
+ * the subscription of the critical tags or the bulk subscription.
+ *
+ * @param node		The variable to subscribe to
+ * @param assetPath	The asset name created for the variable
+ */
+void
+OPCUAServer::queueItem(const OpcUa::Node& node, const string& assetPath)
+{
+	if (m_pendingItems.empty() && m_pendingCritical.empty())
+	{
+		m_oldestPending = monotonicTime();
+	}
+	if (m_criticalSub && m_opcua->isCritical(node, assetPath))
+	{
+		m_pendingCritical.push_back(node);
+	}
+	else
+	{
+		m_pendingItems.push_back(node);
+	}
+}
+
+/**
+ * Create the monitored items for the queued variables, the critical
+ * tags first.
+ *
+ * @return	The number of variables subscribed to
+ */
+int
+OPCUAServer::flushSubscribe()
+{
+	m_oldestPending = 0;
+	int n_subscriptions = flushItems(m_pendingCritical, m_criticalSub);
+	n_subscriptions += flushItems(m_pendingItems, m_sub);
+	m_itemsSubscribed += n_subscriptions;
+	return n_subscriptions;
+}
+
+/**
+ * Create the monitored items for a queue of variables, with as few
+ * requests as the server's MaxMonitoredItemsPerCall allows. If the server
+ * rejects the size of a request the limit is reduced and the request
+ * retried.
+ *
+ * The client library stops at the first monitored item the server fails
+ * to create, leaving the items before it subscribed and those after it
+ * created on the server but unknown to the subscription. So the Value
+ * attribute of the variables of each request is read first and the
+ * variables whose status shows they can not be monitored are skipped;
+ * only the others are sent. Should a request still fail its variables
+ * are not sent again, as some of them are already subscribed to.
+ *
+ * The values read are also the snapshot of the variables: once their
+ * monitored items have been created they are ingested, so that slowly
+ * changing values are reported without waiting for them to change and
+ * without reading them a second time.
+ *
+ * @param pending	The variables to subscribe to, cleared once sent
+ * @param sub		The subscription to add the monitored items to
+ * @return		The number of variables subscribed to
+ */
+int
+OPCUAServer::flushItems(vector<OpcUa::Node>& pending, OpcUa::Subscription::SharedPtr sub)
+{
+	int n_subscriptions = 0;
+	bool critical = sub == m_criticalSub;
+	bool snapshot = m_opcua->getInitialSnapshot();
+
+	size_t i = 0;
+	while (i < pending.size())
+	{
+		size_t chunk = min((size_t)m_maxMonitoredItemsPerCall, pending.size() - i);
+		vector<OpcUa::NodeId> ids;
+		for (size_t j = i; j < i + chunk; j++)
+		{
+			ids.push_back(pending[j].GetId());
+		}
+		vector<OpcUa::DataValue> status;
+		try {
+			status = readAttributes(ids, OpcUa::AttributeId::Value, OpcUa::TimestampsToReturn::Source);
+		} catch (exception& e) {
+			// Let the server report the items it can not create
+			Logger::getLogger()->debug("Unable to check %d variables before subscribing to them, %s",
+					(int)chunk, e.what());
+		}
+		bool checked = status.size() == chunk;
+		vector<OpcUa::Node> candidates;
+		vector<OpcUa::DataValue> values;
+		vector<OpcUa::ReadValueId> items;
+		for (size_t j = 0; j < chunk; j++)
+		{
+			if (checked && !canMonitor(status[j].Status))
+			{
+				Logger::getLogger()->warn("Subscription to variable (%s) failed, %s",
+						OpcUa::ToString(ids[j]).c_str(),
+						OpcUa::ToString(status[j].Status).c_str());
+				m_itemsFailed++;
+				continue;
+			}
+			OpcUa::ReadValueId rv;
+			rv.NodeId = ids[j];
+			rv.AttributeId = OpcUa::AttributeId::Value;
+			items.push_back(rv);
+			candidates.push_back(pending[i + j]);
+			if (checked)
+			{
+				values.push_back(status[j]);
+			}
+		}
+		if (items.empty())
+		{
+			i += chunk;
+			continue;
+		}
+		if (snapshot && checked)
+		{
+			// The initial notifications may arrive before the snapshot is ingested
+			expectInitialValues(items);
+		}
+		vector<OpcUa::Node> subscribed;
+		vector<OpcUa::DataValue> initial;
+		try {
+			vector<uint32_t> handles = sub->SubscribeDataChange(items);
+			for (size_t j = 0; j < handles.size() && j < candidates.size(); j++)
+			{
+				m_itemHandles[candidates[j].GetId()] = make_pair(critical, handles[j]);
+				subscribed.push_back(candidates[j]);
+				if (checked)
+				{
+					initial.push_back(values[j]);
+				}
+			}
+			n_subscriptions += subscribed.size();
+		} catch (exception& e) {
+			if (items.size() > 1 && tooManyOperations(e))
+			{
+				reduceLimit(m_maxMonitoredItemsPerCall, items.size(), "CreateMonitoredItems");
+				continue;
+			}
+			Logger::getLogger()->warn("Subscription to %d variables of OPCUA server %s failed, %s",
+					(int)items.size(), m_url.c_str(), e.what());
+			m_itemsFailed += items.size();
+		}
+		if (snapshot && !initial.empty())
+		{
+			this->snapshot(subscribed, initial, critical);
+		}
+		i += chunk;
+	}
+	pending.clear();
+	return n_subscriptions;
+}
+
+/**
+ * Recreate the monitored items for all the variables found by a
+ * previous discovery, without browsing the server again.
+ *
+ * @return	The number of monitored items created
+ */
+int
+OPCUAServer::resubscribe()
+{
+	lock_guard<mutex> guard(m_browseMutex);
+	m_itemHandles.clear();
+	m_pendingItems.clear();
+	m_pendingCritical.clear();
+	map<OpcUa::NodeId, string> items;
+	{
+		lock_guard<mutex> guard(m_itemMutex);
+		items = m_assetPathNames;
+		for (auto& item : items)
+		{
+			m_resubscribed.insert(item.first);
+		}
+	}
+	for (auto& item : items)
+	{
+		queueItem(m_client->GetNode(item.first), item.second);
+	}
+	return flushSubscribe();
+}
+
+/**
+ * Read an attribute of a set of nodes. The nodes are read in chunks of
+ * the server's MaxNodesPerRead, using a single Read request per chunk.
+ *
+ * @param nodes		The nodes to read
+ * @param attribute	The attribute to read from each node
+ * @param timestamps	The timestamps to return with the values
+ * @return		The values read, in the same order as the nodes
+ */
+vector<OpcUa::DataValue>
+OPCUAServer::readAttributes(const vector<OpcUa::NodeId>& nodes, OpcUa::AttributeId attribute,
+		OpcUa::TimestampsToReturn timestamps)
+{
+	vector<OpcUa::DataValue> values;
+	OpcUa::Services::SharedPtr services = m_client->GetRootNode().GetServices();
+	size_t i = 0;
+	while (i < nodes.size())
+	{
+		size_t chunk = min((size_t)m_maxNodesPerRead, nodes.size() - i);
+		OpcUa::ReadParameters params;
+		params.MaxAge = 0;
+		params.TimestampsToReturn = timestamps;
+		for (size_t j = i; j < i + chunk; j++)
+		{
+			OpcUa::ReadValueId rv;
+			rv.NodeId = nodes[j];
+			rv.AttributeId = attribute;
+			params.AttributesToRead.push_back(rv);
+		}
+		try {
+			vector<OpcUa::DataValue> result = services->Attributes()->Read(params);
+			values.insert(values.end(), result.begin(), result.end());
+		} catch (exception& e) {
+			if (chunk > 1 && tooManyOperations(e))
+			{
+				reduceLimit(m_maxNodesPerRead, chunk, "Read");
+				continue;
+			}
+			throw;
+		}
+		i += chunk;
+	}
+	return values;
+}
+
+/**
+ * Convert a value given as a string to a variant of the data type of
+ * the variable it is to be written to.
+ *
+ * @param value		The value to convert
+ * @param type		The data type of the variable
+ * @param variant	Populated with the converted value
+ * @return		True if the value could be converted
+ */
+static bool toVariant(const string& value, OpcUa::VariantType type, OpcUa::Variant& variant)
+{
+	const char *str = value.c_str();
+	char *end = NULL;
+	errno = 0;
+	switch (type)
+	{
+		case OpcUa::VariantType::BOOLEAN:
+			if (strcasecmp(str, "true") == 0 || value.compare("1") == 0)
+				variant = OpcUa::Variant(true);
+			else if (strcasecmp(str, "false") == 0 || value.compare("0") == 0)
+				variant = OpcUa::Variant(false);
+			else
+				return false;
+			return true;
+		case OpcUa::VariantType::SBYTE:
+		case OpcUa::VariantType::INT16:
+		case OpcUa::VariantType::INT32:
+		case OpcUa::VariantType::INT64:
+		{
+			long long v = strtoll(str, &end, 10);
+			if (end == str || *end || errno)
+				return false;
+			if (type == OpcUa::VariantType::SBYTE)
+				variant = OpcUa::Variant((int8_t)v);
+			else if (type == OpcUa::VariantType::INT16)
+				variant = OpcUa::Variant((int16_t)v);
+			else if (type == OpcUa::VariantType::INT32)
+				variant = OpcUa::Variant((int32_t)v);
+			else
+				variant = OpcUa::Variant((int64_t)v);
+			return true;
+		}
+		case OpcUa::VariantType::BYTE:
+		case OpcUa::VariantType::UINT16:
+		case OpcUa::VariantType::UINT32:
+		case OpcUa::VariantType::UINT64:
+		{
+			if (*str == '-')
+				return false;
+			unsigned long long v = strtoull(str, &end, 10);
+			if (end == str || *end || errno)
+				return false;
+			if (type == OpcUa::VariantType::BYTE)
+				variant = OpcUa::Variant((uint8_t)v);
+			else if (type == OpcUa::VariantType::UINT16)
+				variant = OpcUa::Variant((uint16_t)v);
+			else if (type == OpcUa::VariantType::UINT32)
+				variant = OpcUa::Variant((uint32_t)v);
+			else
+				variant = OpcUa::Variant((uint64_t)v);
+			return true;
+		}
+		case OpcUa::VariantType::FLOAT:
+		case OpcUa::VariantType::DOUBLE:
+		{
+			double v = strtod(str, &end);
+			if (end == str || *end || errno)
+				return false;
+			if (type == OpcUa::VariantType::FLOAT)
+				variant = OpcUa::Variant((float)v);
+			else
+				variant = OpcUa::Variant(v);
+			return true;
+		}
+		case OpcUa::VariantType::STRING:
+			variant = OpcUa::Variant(value);
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Write values to the variables of the server. The variables are found
+ * by the NodeId or asset name the plugin reports their values under,
+ * so only variables that are subscribed to can be written. The values
+ * are converted to the data type of the current value of the variable,
+ * which is read once and remembered, and written in chunks of the
+ * server's MaxNodesPerWrite using a single Write request per chunk.
+ *
+ * @param values	The names of the variables and the values to write
+ * @param asset		The prefix added to the asset paths to give asset names
+ * @param status	Populated with the status of the write of each value
+ * @param resolved	Marks the values whose variable has been found
+ * @return		The number of values whose variable was found on this server
+ */
+int
+OPCUAServer::writeValues(const vector<pair<string, string> >& values, const string& asset,
+		vector<OpcUa::StatusCode>& status, vector<bool>& resolved)
+{
+	map<string, vector<size_t> > names;
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		if (!resolved[i])
+		{
+			names[values[i].first].push_back(i);
+		}
+	}
+
+	// Match the names against the NodeIds and asset names of our variables
+	vector<pair<size_t, OpcUa::NodeId> > targets;
+	vector<OpcUa::NodeId> untyped;
+	{
+		lock_guard<mutex> guard(m_itemMutex);
+		for (auto& item : m_assetPathNames)
+		{
+			auto it = names.find(item.second);
+			if (it == names.end() && !asset.empty())
+				it = names.find(asset + item.second);
+			if (it == names.end())
+				continue;
+			for (size_t i : it->second)
+				targets.push_back(make_pair(i, item.first));
+			names.erase(it);
+		}
+		for (auto& name : names)
+		{
+			OpcUa::NodeId nodeId;
+			try {
+				nodeId = OpcUa::ToNodeId(name.first);
+			} catch (exception& e) {
+				continue;
+			}
+			if (m_assetPathNames.find(nodeId) == m_assetPathNames.end())
+				continue;
+			for (size_t i : name.second)
+				targets.push_back(make_pair(i, nodeId));
+		}
+		for (auto& target : targets)
+		{
+			resolved[target.first] = true;
+			if (m_writeTypes.find(target.second) == m_writeTypes.end())
+				untyped.push_back(target.second);
+		}
+	}
+	if (targets.empty())
+	{
+		return 0;
+	}
+
+	// The session must not be released by the recovery thread part way
+	// through the write, hold it for the whole of the write
+	lock_guard<mutex> clientGuard(m_clientMutex);
+	if (!m_connected || !m_client)
+	{
+		for (auto& target : targets)
+			status[target.first] = OpcUa::StatusCode::BadNotConnected;
+		return targets.size();
+	}
+
+	OpcUa::Services::SharedPtr services = m_client->GetRootNode().GetServices();
+	try {
+		if (!untyped.empty())
+		{
+			sort(untyped.begin(), untyped.end());
+			untyped.erase(unique(untyped.begin(), untyped.end()), untyped.end());
+			vector<OpcUa::DataValue> current = readAttributes(untyped, OpcUa::AttributeId::Value);
+			lock_guard<mutex> guard(m_itemMutex);
+			for (size_t i = 0; i < current.size() && i < untyped.size(); i++)
+			{
+				if (current[i].Status == OpcUa::StatusCode::Good && !current[i].Value.IsNul()
+						&& current[i].Value.IsScalar())
+				{
+					m_writeTypes[untyped[i]] = current[i].Value.Type();
+				}
+			}
+		}
+
+		vector<OpcUa::WriteValue> writes;
+		vector<size_t> indexes;
+		{
+			lock_guard<mutex> guard(m_itemMutex);
+			for (auto& target : targets)
+			{
+				auto type = m_writeTypes.find(target.second);
+				OpcUa::WriteValue write;
+				if (type == m_writeTypes.end()
+						|| !toVariant(values[target.first].second, type->second, write.Value.Value))
+				{
+					status[target.first] = OpcUa::StatusCode::BadTypeMismatch;
+					continue;
+				}
+				write.NodeId = target.second;
+				write.AttributeId = OpcUa::AttributeId::Value;
+				writes.push_back(write);
+				indexes.push_back(target.first);
+			}
+		}
+
+		size_t i = 0;
+		while (i < writes.size())
+		{
+			size_t chunk = min((size_t)m_maxNodesPerWrite, writes.size() - i);
+			vector<OpcUa::WriteValue> batch(writes.begin() + i, writes.begin() + i + chunk);
+			try {
+				vector<OpcUa::StatusCode> result = services->Attributes()->Write(batch);
+				for (size_t j = 0; j < chunk; j++)
+				{
+					status[indexes[i + j]] = j < result.size() ? result[j]
+							: OpcUa::StatusCode::BadNoCommunication;
+				}
+			} catch (exception& e) {
+				if (chunk > 1 && tooManyOperations(e))
+				{
+					reduceLimit(m_maxNodesPerWrite, chunk, "Write");
+					continue;
+				}
+				throw;
+			}
+			i += chunk;
+		}
+	} catch (exception& e) {
+		Logger::getLogger()->error("Write to OPCUA server %s failed: %s", m_url.c_str(), e.what());
+		for (auto& target : targets)
+		{
+			if (status[target.first] == OpcUa::StatusCode::BadNodeIdUnknown)
+				status[target.first] = OpcUa::StatusCode::BadNoCommunication;
+		}
+	}
+	return targets.size();
+}
+
+/**
+ * Ingest a snapshot of the values of a set of variables, as a single
+ * batch. The values no newer than the last value reported for their
+ * variable, or than the initial notification of their variable if that
+ * has already been reported, are dropped.
+ *
+ * @param nodes		The variables
+ * @param values	The values read from the variables, with their
+ *			source timestamps
+ * @param critical	The variables are critical tags
+ */
+void
+OPCUAServer::snapshot(const vector<OpcUa::Node>& nodes, const vector<OpcUa::DataValue>& values,
+		bool critical)
+{
+	OpcUaClient *client = critical ? m_criticalClient.get() : m_subClient.get();
+	if (!client || !m_active)
+	{
+		return;
+	}
+	vector<Reading *> readings;
+	for (size_t i = 0; i < values.size() && i < nodes.size(); i++)
+	{
+		const OpcUa::DataValue& value = values[i];
+		OpcUa::NodeId nodeId = nodes[i].GetId();
+		if (value.Status != OpcUa::StatusCode::Good || isReported(nodeId, value.SourceTimestamp)
+				|| isInitialValue(nodeId, value.SourceTimestamp))
+		{
+			continue;
+		}
+		vector<Datapoint *> points;
+		if (client->toDatapoints(nodes[i], value, points))
+		{
+			updateTimestamp(nodeId, value.SourceTimestamp);
+			readings.push_back(m_opcua->createReading(points, getAssetPath(nodeId), value.SourceTimestamp));
+		}
+	}
+	m_opcua->ingest(readings, critical);
+}
+
+/**
+ * Check if a value of a variable with a source timestamp at least as
+ * recent has already been reported
+ *
+ * @param nodeId	The NodeId of the variable
+ * @param timestamp	The source timestamp of the value
+ * @return		True if the value is not newer than the last reported
+ */
+bool
+OPCUAServer::isReported(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	auto it = m_lastTimestamps.find(nodeId);
+	return it != m_lastTimestamps.end() && (int64_t)timestamp <= it->second;
+}
+
+/**
+ * Note the variables about to be subscribed to whose initial value is
+ * to be read by the snapshot, so that whichever of the snapshot and the
+ * initial notification of each variable arrives second is recognised
+ * by isInitialValue() as a duplicate
+ *
+ * @param items	The Value attributes of the variables
+ */
+void
+OPCUAServer::expectInitialValues(const vector<OpcUa::ReadValueId>& items)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	for (auto& item : items)
+	{
+		m_initialValues[item.NodeId] = make_pair(false, (int64_t)0);
+	}
+}
+
+/**
+ * Check if a value of a variable duplicates its initial value. When a
+ * variable is subscribed to the server sends a notification of its
+ * current value, which is also read by the snapshot. Whichever of the
+ * two arrives second is a duplicate of the first unless the value has
+ * since changed.
+ *
+ * @param nodeId	The NodeId of the variable
+ * @param timestamp	The source timestamp of the value
+ * @return		True if the value has already been reported
+ */
+bool
+OPCUAServer::isInitialValue(const OpcUa::NodeId& nodeId, const OpcUa::DateTime& timestamp)
+{
+	lock_guard<mutex> guard(m_itemMutex);
+	if (m_initialValues.empty())
+	{
+		return false;
+	}
+	auto it = m_initialValues.find(nodeId);
+	if (it == m_initialValues.end())
+	{
+		return false;
+	}
+	if (!it->second.first)
+	{
+		it->second = make_pair(true, (int64_t)timestamp);
+		return false;
+	}
+	bool duplicate = (int64_t)timestamp <= it->second.second;
+	m_initialValues.erase(it);
+	return duplicate;
+}
+
+/**
+ * Start the thread that checks the session is still alive
+ */
+void
+OPCUAServer::startKeepAlive()
+{
+	m_running = true;
+	m_keepAliveThread = new thread(&OPCUAServer::keepAlive, this);
+	m_modelThread = new thread(&OPCUAServer::modelThread, this);
+}
+
+/**
+ * Stop all subscriptions and disconnect from the OPCUA server. Any
+ * recovery that is in progress is allowed to finish first.
+ */
+void
+OPCUAServer::stop()
+{
+	stopRecovery();
+	disconnect();
+}
+
+/**
+ * Stop the server connection as stop() does but, if the session with the
+ * server is healthy, keep the session open and return it so that the
+ * next connection to the same server can use it rather than connecting
+ * again. The subscriptions of the session are deleted.
+ *
+ * @return	The client holding the session, or an empty pointer if the
+ *		session was closed
+ */
+unique_ptr<OpcUa::UaClient>
+OPCUAServer::park()
+{
+	stopRecovery();
+	unique_ptr<OpcUa::UaClient> client;
+	if (m_connected && m_client && isAlive(m_opcua->getKeepAliveTimeout()))
+	{
+		// Stop the threads that use the session before taking it
+		{
+			lock_guard<mutex> guard(m_stateMutex);
+			m_running = false;
+		}
+		m_stateCV.notify_all();
+		joinThreads();
+		lock_guard<mutex> guard(m_clientMutex);
+		try {
+			if (m_sub)
+			{
+				m_sub->Delete();
+			}
+			if (m_criticalSub)
+			{
+				m_criticalSub->Delete();
+			}
+			client = std::move(m_client);
+			m_connected = false;
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Unable to delete the subscriptions of OPCUA server %s, "
+					"the session will not be reused: %s", m_url.c_str(), e.what());
+		}
+	}
+	disconnect();
+	return client;
+}
+
+/**
+ * Stop the thread that starts or recovers the connection to the server,
+ * allowing a recovery that is in progress to finish first
+ */
+void
+OPCUAServer::stopRecovery()
+{
+	{
+		lock_guard<mutex> guard(m_stateMutex);
+		m_stopping = true;
+	}
+	m_stateCV.notify_all();
+	if (m_recoverThread)
+	{
+		m_recoverThread->join();
+		delete m_recoverThread;
+		m_recoverThread = NULL;
+	}
+}
+
+/**
+ * Close the session with the OPCUA server and release the client
+ */
+void
+OPCUAServer::disconnect()
+{
+	{
+		lock_guard<mutex> guard(m_stateMutex);
+		m_running = false;
+	}
+	m_stateCV.notify_all();
+	if (m_connected)
+	{
+		lock_guard<mutex> guard(m_clientMutex);
+		try {
+			if (m_client)
+			{
+				m_client->Disconnect();
+			}
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Error disconnecting from OPCUA server %s: %s", m_url.c_str(), e.what());
+		}
+		m_connected = false;
+	}
+	joinThreads();
+	release();
+}
+
+/**
+ * Wait for the threads that use the session, the keep alive and model
+ * change threads, to exit once they have been told to stop
+ */
+void
+OPCUAServer::joinThreads()
+{
+	if (m_keepAliveThread)
+	{
+		m_keepAliveThread->join();
+		delete m_keepAliveThread;
+		m_keepAliveThread = NULL;
+	}
+	if (m_modelThread)
+	{
+		m_modelThread->join();
+		delete m_modelThread;
+		m_modelThread = NULL;
+	}
+}
+
+/**
+ * Release the subscriptions, their notification handlers and the client,
+ * in that order: a subscription calls its handler until it is destroyed
+ * and both use the services of the client. Notifications of the
+ * subscriptions still waiting in the conversion pool refer to the
+ * handlers, so are converted before the handlers are destroyed.
+ */
+void
+OPCUAServer::release()
+{
+	{
+		lock_guard<mutex> guard(m_clientMutex);
+		m_sub.reset();
+		m_criticalSub.reset();
+	}
+	m_opcua->drainConversions();
+	lock_guard<mutex> guard(m_clientMutex);
+	m_subClient.reset();
+	m_criticalClient.reset();
+	m_client.reset();
+}
+
+/**
+ * Periodically read the state of the server. This is a cheap request
+ * that tells us the session is still usable even when none of the
+ * subscribed variables are changing.
+ */
+void
+OPCUAServer::keepAlive()
+{
+	long interval = m_opcua->getKeepAliveTimeout() / 3;
+	OpcUa::Node state = m_client->GetNode(OpcUa::NodeId(OpcUa::ObjectId::Server_ServerStatus_State));
+	unique_lock<mutex> lck(m_stateMutex);
+	while (m_running)
+	{
+		lck.unlock();
+		try {
+			state.GetValue();
+			alive();
+		} catch (exception& e) {
+			Logger::getLogger()->debug("Keep alive for OPCUA server %s failed: %s", m_url.c_str(), e.what());
+		}
+		lck.lock();
+		if (m_running)
+		{
+			m_stateCV.wait_for(lck, chrono::milliseconds(interval));
+		}
+	}
+}
+
+/**
+ * Reconnect to the server in the background. If a recovery is already
+ * in progress, or the server is being stopped, the call is ignored.
+ */
+void
+OPCUAServer::recover()
+{
+	lock_guard<mutex> guard(m_stateMutex);
+	if (m_stopping || m_recovering)
+	{
+		return;
+	}
+	if (m_recoverThread)
+	{
+		// The previous recovery has completed
+		m_recoverThread->join();
+		delete m_recoverThread;
+	}
+	m_recovering = true;
+	m_recoverThread = new thread(&OPCUAServer::recoverThread, this);
+}
+
+/**
+ * Recover the connection to the server. This is done in stages, each
+ * more costly than the last:
+ *
+ *	- If the existing session responds again it is simply resumed. The
+ *	  subscription is intact and changes queued by the server during the
+ *	  interruption are delivered by the next publish.
+ *	- Otherwise a new session is created and the monitored items are
+ *	  recreated from the table of variables found by the last discovery.
+ *	- If that fails the server is browsed again, as at start up.
+ *
+ * The stages are retried until the server is reached or we are asked to stop.
+ */
+void
+OPCUAServer::recoverThread()
+{
+	Logger::getLogger()->warn("Reconnecting to OPCUA server %s", m_url.c_str());
+	int64_t started = monotonicTime();
+	{
+		lock_guard<mutex> guard(m_itemMutex);
+		m_gapStart = static_cast<int64_t>(OpcUa::DateTime::Current())
+				- m_opcua->getKeepAliveTimeout() * 10000LL;
+	}
+	string method;
+	unique_lock<mutex> lck(m_stateMutex);
+	while (!m_stopping)
+	{
+		lck.unlock();
+		if (m_connected && m_client)
+		{
+			try {
+				m_client->GetNode(OpcUa::NodeId(OpcUa::ObjectId::Server_ServerStatus_State)).GetValue();
+				alive();
+				method = "resuming the session";
+				if (!m_active)
+				{
+					// The server may have been made the standby while it was lost
+					lock_guard<mutex> guard(m_clientMutex);
+					setRates();
+				}
+			} catch (exception& e) {
+				Logger::getLogger()->debug("Unable to resume session with OPCUA server %s: %s", m_url.c_str(), e.what());
+			}
+		}
+		if (method.empty())
+		{
+			disconnect();
+			try {
+				connect();
+				int n_items = resubscribe();
+				if (n_items > 0)
+				{
+					startKeepAlive();
+					method = "recreating " + to_string(n_items) + " monitored items";
+				}
+			} catch (exception& e) {
+				Logger::getLogger()->warn("Unable to recreate monitored items for OPCUA server %s: %s", m_url.c_str(), e.what());
+			}
+		}
+		if (method.empty())
+		{
+			disconnect();
+			try {
+				start();
+				method = "rediscovering the server";
+			} catch (...) {
+				// Failure has already been logged
+			}
+		}
+		lck.lock();
+		if (!method.empty())
+		{
+			long latency = monotonicTime() - started;
+			m_reconnects++;
+			m_reconnectLatency += latency;
+			if (latency > m_maxReconnectLatency)
+			{
+				m_maxReconnectLatency = latency;
+			}
+			Logger::getLogger()->info("Reconnected to OPCUA server %s in %ld ms by %s",
+					m_url.c_str(), latency, method.c_str());
+			break;
+		}
+		m_stateCV.wait_for(lck, chrono::milliseconds(RECONNECT_DELAY));
+	}
+	m_recovering = false;
+}
+
+/**
+ * Called when the server publishes an event. Model change events are
+ * recorded against the node they were raised by and acted upon by the
+ * model thread, so that a burst of changes results in a single browse.
+ *
+ * @param event	The event
+ */
+void
+OPCUAServer::modelEvent(const OpcUa::Event& event)
+{
+	if (!(event.EventType == OpcUa::NodeId(BASE_MODEL_CHANGE_EVENT, 0)
+			|| event.EventType == OpcUa::NodeId(GENERAL_MODEL_CHANGE_EVENT, 0)
+			|| event.EventType == OpcUa::NodeId(SEMANTIC_CHANGE_EVENT, 0)))
+	{
+		return;
+	}
+	lock_guard<mutex> guard(m_stateMutex);
+	m_modelChanges.insert(event.SourceNode);
+}
+
+/**
+ * Keep the monitored items in line with the address space of the server.
+ * The objects that model change events were raised for are browsed again.
+ * A change raised for an object that was not browsed, such as the Server
+ * object, results in a check of every browsed object. Every browsed object
+ * is also checked once every model check interval or, if the server
+ * accepted the subscription to model change events, once every
+ * MODEL_EVENT_CHECK_FACTOR intervals. A server may accept the
+ * subscription and yet never raise the events, so the check is kept
+ * running at a low rate rather than relying on the events alone.
+ *
+ * The structured data types of values that could not be decoded are
+ * also looked up on this thread, as they cannot be looked up on the
+ * threads that deliver the values.
+ */
+void
+OPCUAServer::modelThread()
+{
+	int64_t lastCheck = monotonicTime();
+	unique_lock<mutex> lck(m_stateMutex);
+	while (m_running)
+	{
+		m_stateCV.wait_for(lck, chrono::milliseconds(MODEL_CHANGE_DELAY));
+		if (!m_running)
+		{
+			break;
+		}
+		lck.unlock();
+		try {
+			resolveTypes();
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Unable to look up the structured data types of OPCUA server %s: %s",
+					m_url.c_str(), e.what());
+		}
+		lck.lock();
+		if (!m_running)
+		{
+			break;
+		}
+		long interval = m_opcua->getModelCheckInterval();
+		if (m_modelEvents)
+		{
+			interval *= MODEL_EVENT_CHECK_FACTOR;
+		}
+		bool check = interval > 0 && monotonicTime() - lastCheck >= interval;
+		if (m_discovering || (m_modelChanges.empty() && !check))
+		{
+			continue;
+		}
+		set<OpcUa::NodeId> changes;
+		changes.swap(m_modelChanges);
+		lck.unlock();
+		try {
+			lock_guard<mutex> guard(m_browseMutex);
+			for (auto& source : changes)
+			{
+				if (m_browsedNodes.find(source) == m_browsedNodes.end())
+				{
+					check = true;
+				}
+				else
+				{
+					rescan(source);
+				}
+			}
+			if (check)
+			{
+				checkModel();
+				lastCheck = monotonicTime();
+			}
+		} catch (exception& e) {
+			Logger::getLogger()->warn("Unable to check OPCUA server %s for address space changes: %s",
+					m_url.c_str(), e.what());
+		}
+		lck.lock();
+	}
+}
+
+/**
+ * Check each browsed object for changes to the variables and objects
+ * below it. A fingerprint of the references of each object is compared
+ * with the one taken when it was last browsed; this costs two browse
+ * requests per object, but no reads and no changes to the subscriptions.
+ * Only the objects whose fingerprint differs are browsed again.
+ */
+void
+OPCUAServer::checkModel()
+{
+	vector<pair<OpcUa::NodeId, BrowsedNode> > nodes(m_browsedNodes.begin(), m_browsedNodes.end());
+	vector<OpcUa::NodeId> changed;
+	for (auto& node : nodes)
+	{
+		if (m_stopping || !m_connected)
+		{
+			return;
+		}
+		if (node.second.fingerprint == 0)
+		{
+			continue;
+		}
+		try {
+			OpcUa::Node object = m_client->GetNode(node.first);
+			if (fingerprint(object.GetVariables(), object.GetChildren()) != node.second.fingerprint)
+			{
+				changed.push_back(node.first);
+			}
+		} catch (exception& e) {
+			// Either the object has gone, in which case its parent has
+			// changed, or we have lost the server, in which case this throws
+			m_client->GetNode(OpcUa::NodeId(OpcUa::ObjectId::Server_ServerStatus_State)).GetValue();
+			if (node.second.hasParent)
+			{
+				changed.push_back(node.second.parent);
+			}
+		}
+	}
+	for (auto& nodeId : changed)
+	{
+		rescan(nodeId);
+	}
+}
+
+/**
+ * Browse the subtree below an object again and bring the monitored items
+ * in line with the variables now found there. New variables are
+ * subscribed to and the monitored items of variables that have gone are
+ * deleted; the variables that are unchanged are left alone.
+ *
+ * @param nodeId	The object to browse from
+ * @return		The number of monitored items created or deleted
+ */
+int
+OPCUAServer::rescan(const OpcUa::NodeId& nodeId)
+{
+	auto it = m_browsedNodes.find(nodeId);
+	if (it == m_browsedNodes.end() || m_stopping)
+	{
+		return 0;
+	}
+	BrowsedNode browsed = it->second;
+
+	// Find the objects and variables below the object when it was last browsed
+	map<OpcUa::NodeId, BrowsedNode> objects;
+	for (auto& node : m_browsedNodes)
+	{
+		OpcUa::NodeId id = node.first;
+		for (int depth = 0; depth < MAX_BROWSE_DEPTH; depth++)
+		{
+			if (id == nodeId)
+			{
+				objects.insert(node);
+				break;
+			}
+			auto parent = m_browsedNodes.find(id);
+			if (parent == m_browsedNodes.end() || !parent->second.hasParent)
+			{
+				break;
+			}
+			id = parent->second.parent;
+		}
+	}
+	map<OpcUa::NodeId, OpcUa::NodeId> previous;
+	for (auto& item : m_itemParents)
+	{
+		if (objects.find(item.second) != objects.end())
+		{
+			previous.insert(item);
+		}
+	}
+	for (auto& object : objects)
+	{
+		if (!(object.first == nodeId))
+		{
+			m_browsedNodes.erase(object.first);
+		}
+	}
+	for (auto& item : previous)
+	{
+		m_itemParents.erase(item.first);
+	}
+
+	// Browse the subtree, recording rather than subscribing to the variables
+	map<string, bool> subscriptionVariables;
+	subscriptionVariables.swap(m_subscriptionVariables);
+	m_scanned.clear();
+	m_scanning = true;
+	string parentPath = browsed.parentPath;
+	addSubscribe(m_client->GetNode(nodeId), parentPath, browsed.active);
+	m_scanning = false;
+	m_subscriptionVariables.insert(subscriptionVariables.begin(), subscriptionVariables.end());
+
+	// The browse reports errors rather than failing, make sure the
+	// variables were not missed because the server has been lost
+	try {
+		m_client->GetNode(OpcUa::NodeId(OpcUa::ObjectId::Server_ServerStatus_State)).GetValue();
+	} catch (exception& e) {
+		m_browsedNodes.insert(objects.begin(), objects.end());
+		m_itemParents.insert(previous.begin(), previous.end());
+		m_scanned.clear();
+		throw;
+	}
+
+	vector<pair<OpcUa::NodeId, string> > added;
+	{
+		lock_guard<mutex> guard(m_itemMutex);
+		for (auto& item : m_scanned)
+		{
+			if (m_assetPathNames.find(item.first) == m_assetPathNames.end())
+			{
+				m_assetPathNames[item.first] = item.second;
+				added.push_back(item);
+			}
+		}
+	}
+	for (auto& item : added)
+	{
+		queueItem(m_client->GetNode(item.first), item.second);
+	}
+	flushSubscribe();
+
+	vector<uint32_t> bulkHandles, criticalHandles;
+	int removed = 0;
+	for (auto& item : previous)
+	{
+		if (m_scanned.find(item.first) != m_scanned.end())
+		{
+			continue;
+		}
+		auto handle = m_itemHandles.find(item.first);
+		if (handle != m_itemHandles.end())
+		{
+			if (handle->second.first)
+				criticalHandles.push_back(handle->second.second);
+			else
+				bulkHandles.push_back(handle->second.second);
+			m_itemHandles.erase(handle);
+		}
+		lock_guard<mutex> guard(m_itemMutex);
+		m_assetPathNames.erase(item.first);
+		m_lastTimestamps.erase(item.first);
+		removed++;
+	}
+	m_scanned.clear();
+	try {
+		if (!bulkHandles.empty())
+			m_sub->UnSubscribe(bulkHandles);
+		if (!criticalHandles.empty() && m_criticalSub)
+			m_criticalSub->UnSubscribe(criticalHandles);
+	} catch (exception& e) {
+		Logger::getLogger()->warn("Unable to delete monitored items of removed variables on OPCUA server %s: %s",
+				m_url.c_str(), e.what());
+	}
+
+	if (added.size() || removed)
+	{
+		Logger::getLogger()->info("Address space of OPCUA server %s changed below %s, "
+				"%d variables added and %d removed",
+				m_url.c_str(), OpcUa::ToString(nodeId).c_str(), (int)added.size(), removed);
+	}
+	return added.size() + removed;
+}
+
+/**
+ * Look up the data types of the structured values received that could
+ * not be decoded. The data type of each encoding is found by browsing
+ * the inverse HasEncoding reference of the encoding, then the
+ * DataTypeDefinition attributes of the data types and of the data types
+ * of their fields are read. Values of the types are decoded from then on.
+ */
+void
+OPCUAServer::resolveTypes()
+{
+	vector<OpcUa::NodeId> encodings = m_types.getWanted();
+	if (encodings.empty())
+	{
+		return;
+	}
+	try {
+		OpcUa::Services::SharedPtr services = m_client->GetRootNode().GetServices();
+		size_t i = 0;
+		while (i < encodings.size())
+		{
+			size_t chunk = min((size_t)m_maxNodesPerBrowse, encodings.size() - i);
+			OpcUa::NodesQuery query;
+			query.MaxReferenciesPerNode = 0;
+			for (size_t j = i; j < i + chunk; j++)
+			{
+				OpcUa::BrowseDescription description;
+				description.NodeToBrowse = encodings[j];
+				description.Direction = OpcUa::BrowseDirection::Inverse;
+				description.ReferenceTypeId = OpcUa::NodeId(HAS_ENCODING, 0);
+				description.IncludeSubtypes = false;
+				description.NodeClasses = OpcUa::NodeClass::Unspecified;
+				description.ResultMask = OpcUa::BrowseResultMask::All;
+				query.NodesToBrowse.push_back(description);
+			}
+			vector<OpcUa::BrowseResult> results = services->Views()->Browse(query);
+			for (size_t j = 0; j < chunk; j++)
+			{
+				OpcUa::NodeId dataType;
+				if (j < results.size() && !results[j].Referencies.empty())
+				{
+					dataType = results[j].Referencies[0].TargetNodeId;
+				}
+				m_types.addEncoding(encodings[i + j], dataType);
+			}
+			i += chunk;
+		}
+
+		for (int round = 0; round < MAX_TYPE_LOOKUPS; round++)
+		{
+			vector<OpcUa::NodeId> undefined = m_types.getUndefined();
+			if (undefined.empty())
+			{
+				break;
+			}
+			vector<OpcUa::DataValue> definitions = readAttributes(undefined,
+					static_cast<OpcUa::AttributeId>(DATA_TYPE_DEFINITION));
+			for (size_t j = 0; j < undefined.size(); j++)
+			{
+				m_types.addDefinition(undefined[j], j < definitions.size() ? definitions[j] : OpcUa::DataValue());
+			}
+		}
+	} catch (exception& e) {
+		m_types.retry();
+		throw;
+	}
+	int compiled = m_types.compile();
+	Logger::getLogger()->info("Looked up %d structured data types of OPCUA server %s, %d can be decoded",
+			(int)encodings.size(), m_url.c_str(), compiled);
+}
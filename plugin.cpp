@@ -89,6 +89,187 @@ static const char *default_config = QUOTE({
 		"default" : "100",
 		"displayName" : "Min Reporting Interval",
 		"order" : "7"
+		},
+	"servers" : {
+		"description" : "Additional OPC UA servers to subscribe to, each with its own session",
+		"type" : "JSON",
+		"default" : "{ \"servers\" : [ ] }",
+		"displayName" : "Additional OPCUA Servers",
+		"order" : "8"
+		},
+	"backupUrl" : {
+		"description" : "URL of a redundant backup OPC UA Server, leave empty if there is no backup",
+		"type" : "string",
+		"default" : "",
+		"displayName" : "Backup OPCUA Server URL",
+		"order" : "9"
+		},
+	"keepAliveTimeout" : {
+		"description" : "Time in milliseconds without a response from a server after which the connection is considered lost",
+		"type" : "integer",
+		"default" : "3000",
+		"displayName" : "Keep Alive Timeout",
+		"order" : "10"
+		},
+	"publishRequests" : {
+		"description" : "The number of publish requests to keep outstanding with each server",
+		"type" : "integer",
+		"default" : "2",
+		"minimum" : "1",
+		"displayName" : "Outstanding Publish Requests",
+		"order" : "11"
+		},
+	"maxNotificationsPerPublish" : {
+		"description" : "The maximum number of notifications the server may return in a single publish response, 0 for no limit",
+		"type" : "integer",
+		"default" : "0",
+		"displayName" : "Max Notifications Per Publish",
+		"order" : "12"
+		},
+	"lifetimeCount" : {
+		"description" : "The number of publishing intervals without a publish request after which the server deletes the subscription",
+		"type" : "integer",
+		"default" : "2400",
+		"displayName" : "Subscription Lifetime Count",
+		"order" : "13"
+		},
+	"keepAliveCount" : {
+		"description" : "The number of publishing intervals without any notification after which the server sends a keep alive",
+		"type" : "integer",
+		"default" : "10",
+		"displayName" : "Subscription Keep Alive Count",
+		"order" : "14"
+		},
+	"adaptiveSampling" : {
+		"description" : "Increase the publishing interval when readings cannot be ingested as fast as they arrive",
+		"type" : "boolean",
+		"default" : "false",
+		"displayName" : "Adaptive Sampling",
+		"order" : "15"
+		},
+	"backlogHigh" : {
+		"description" : "The number of readings waiting to be ingested above which the publishing interval is increased",
+		"type" : "integer",
+		"default" : "10000",
+		"displayName" : "Backlog High Water Mark",
+		"order" : "16"
+		},
+	"backlogLow" : {
+		"description" : "The number of readings waiting to be ingested below which the publishing interval is restored",
+		"type" : "integer",
+		"default" : "1000",
+		"displayName" : "Backlog Low Water Mark",
+		"order" : "17"
+		},
+	"backlogLatency" : {
+		"description" : "The time in milliseconds readings may wait to be ingested before the publishing interval is increased",
+		"type" : "integer",
+		"default" : "5000",
+		"displayName" : "Backlog Latency",
+		"order" : "18"
+		},
+	"criticalTags" : {
+		"description" : "NodeIds or asset names, which may contain the wildcards * and ?, of tags that are delivered through a dedicated subscription and ingest queue",
+		"type" : "JSON",
+		"default" : "{ \"critical\" : [ ] }",
+		"displayName" : "Critical Tags",
+		"order" : "19"
+		},
+	"criticalReportingInterval" : {
+		"description" : "The minimum reporting interval for data change notifications of critical tags",
+		"type" : "integer",
+		"default" : "100",
+		"displayName" : "Critical Reporting Interval",
+		"order" : "20"
+		},
+	"modelCheckInterval" : {
+		"description" : "The interval in milliseconds at which servers are checked for added or removed nodes, ten times longer for servers that publish model change events, 0 to disable",
+		"type" : "integer",
+		"default" : "60000",
+		"displayName" : "Address Space Check Interval",
+		"order" : "21"
+		},
+	"tagFile" : {
+		"description" : "The path of a CSV or JSON Lines file listing further variables to subscribe to by NodeId, with optional name, group and deadband overrides and the server each is on",
+		"type" : "string",
+		"default" : "",
+		"displayName" : "Tag File",
+		"order" : "22"
+		},
+	"initialSnapshot" : {
+		"description" : "Read the current value of each variable when it is subscribed to, rather than waiting for the value to change",
+		"type" : "boolean",
+		"default" : "true",
+		"displayName" : "Initial Value Snapshot",
+		"order" : "23"
+		},
+	"statisticsInterval" : {
+		"description" : "The interval in milliseconds at which a reading of the plugin statistics is ingested, 0 for none",
+		"type" : "integer",
+		"default" : "0",
+		"displayName" : "Statistics Interval",
+		"order" : "24"
+		},
+	"captureFile" : {
+		"description" : "The path of a file to record the data change notifications received to, for replay without a server. Leave empty to not record",
+		"type" : "string",
+		"default" : "",
+		"displayName" : "Capture File",
+		"order" : "25"
+		},
+	"spillFile" : {
+		"description" : "The path of a file readings are spilled to when the south service can not keep up with them. Leave empty to hold all waiting readings in memory",
+		"type" : "string",
+		"default" : "",
+		"displayName" : "Spill File",
+		"order" : "26"
+		},
+	"spillSize" : {
+		"description" : "The size of the spill file in megabytes",
+		"type" : "integer",
+		"default" : "64",
+		"displayName" : "Spill File Size",
+		"order" : "27"
+		},
+	"spillThreshold" : {
+		"description" : "The number of readings waiting in memory above which readings are spilled to the spill file",
+		"type" : "integer",
+		"default" : "10000",
+		"displayName" : "Spill Threshold",
+		"order" : "28"
+		},
+	"spillPolicy" : {
+		"description" : "The readings to discard when the spill file is full",
+		"type" : "enumeration",
+		"options" : [ "Discard Oldest", "Discard Newest" ],
+		"default" : "Discard Oldest",
+		"displayName" : "Spill Full Policy",
+		"order" : "29"
+		},
+	"conversionThreads" : {
+		"description" : "The number of threads that convert the values received to readings. With 0 the values are converted on the thread that receives them",
+		"type" : "integer",
+		"default" : "0",
+		"minimum" : "0",
+		"maximum" : "64",
+		"displayName" : "Conversion Threads",
+		"order" : "30"
+		},
+	"objectLevel" : {
+		"description" : "The number of segments of the asset path that name an object. The values of all the variables of an object are reported as one reading, with the rest of the path as nested datapoints. With 0 each variable is reported as a reading of its own",
+		"type" : "integer",
+		"default" : "0",
+		"minimum" : "0",
+		"displayName" : "Object Level",
+		"order" : "31"
+		},
+	"objectReport" : {
+		"description" : "The values held by each reading of an object",
+		"type" : "enumeration",
+		"options" : [ "Changed Values", "Full Object" ],
+		"default" : "Changed Values",
+		"displayName" : "Object Reading Contents",
+		"order" : "32"
 		}
 	});
 
@@ -103,7 +284,7 @@ extern "C" {
 static PLUGIN_INFORMATION info = {
 	PLUGIN_NAME,              // Name
 	VERSION,                  // Version
-	SP_ASYNC, 		  // Flags
+	SP_ASYNC | SP_CONTROL,	  // Flags
 	PLUGIN_TYPE_SOUTH,        // Type
 	"1.0.0",                  // Interface version
 	default_config		  // Default configuration
@@ -119,48 +300,142 @@ PLUGIN_INFORMATION *plugin_info()
 }
 
 /**
- * Initialise the plugin, called to get the plugin handle
+ * Apply the configuration to the plugin instance, called both when the
+ * plugin is initialised and when it is reconfigured
+ *
+ * @param opcua	The plugin instance
+ * @param config	The configuration category
  */
-PLUGIN_HANDLE plugin_init(ConfigCategory *config)
+static void configure(OPCUA *opcua, ConfigCategory& config)
 {
-OPCUA	*opcua;
-string	url;
+	if (config.itemExists("reportingInterval"))
+	{
+		long val = strtol(config.getValue("reportingInterval").c_str(), NULL, 10);
+		opcua->setReportingInterval(val);
+	}
+	else
+	{
+		opcua->setReportingInterval(100);
+	}
+
+	if (config.itemExists("backupUrl"))
+	{
+		opcua->setBackupURL(config.getValue("backupUrl"));
+	}
 
+	if (config.itemExists("keepAliveTimeout"))
+	{
+		long val = strtol(config.getValue("keepAliveTimeout").c_str(), NULL, 10);
+		opcua->setKeepAliveTimeout(val);
+	}
 
-	if (config->itemExists("url"))
+	if (config.itemExists("publishRequests"))
 	{
-		url = config->getValue("url");
-		opcua = new OPCUA(url);
+		opcua->setPublishRequests(strtol(config.getValue("publishRequests").c_str(), NULL, 10));
 	}
-	else
+
+	if (config.itemExists("maxNotificationsPerPublish"))
 	{
-		Logger::getLogger()->fatal("UPC UA plugin is missing a URL");
-		throw exception();
+		opcua->setMaxNotificationsPerPublish(strtoul(config.getValue("maxNotificationsPerPublish").c_str(), NULL, 10));
 	}
 
+	if (config.itemExists("lifetimeCount"))
+	{
+		opcua->setLifetimeCount(strtoul(config.getValue("lifetimeCount").c_str(), NULL, 10));
+	}
 
-	if (config->itemExists("asset"))
+	if (config.itemExists("keepAliveCount"))
 	{
-		opcua->setAssetName(config->getValue("asset"));
+		opcua->setKeepAliveCount(strtoul(config.getValue("keepAliveCount").c_str(), NULL, 10));
 	}
-	else
+
+	if (config.itemExists("adaptiveSampling"))
 	{
-		opcua->setAssetName("opcua");
+		opcua->setAdaptiveSampling(config.getValue("adaptiveSampling").compare("true") == 0);
 	}
 
-	if (config->itemExists("reportingInterval"))
+	if (config.itemExists("backlogHigh") && config.itemExists("backlogLow") && config.itemExists("backlogLatency"))
 	{
-		long val = strtol(config->getValue("reportingInterval").c_str(), NULL, 10);
-		opcua->setReportingInterval(val);
+		opcua->setBacklogLimits(strtol(config.getValue("backlogHigh").c_str(), NULL, 10),
+				strtol(config.getValue("backlogLow").c_str(), NULL, 10),
+				strtol(config.getValue("backlogLatency").c_str(), NULL, 10));
 	}
-	else
+
+	if (config.itemExists("modelCheckInterval"))
 	{
-		opcua->setReportingInterval(100);
+		opcua->setModelCheckInterval(strtol(config.getValue("modelCheckInterval").c_str(), NULL, 10));
+	}
+
+	if (config.itemExists("tagFile"))
+	{
+		opcua->setTagFile(config.getValue("tagFile"));
+	}
+
+	if (config.itemExists("initialSnapshot"))
+	{
+		opcua->setInitialSnapshot(config.getValue("initialSnapshot").compare("true") == 0);
+	}
+
+	if (config.itemExists("statisticsInterval"))
+	{
+		opcua->setStatisticsInterval(strtol(config.getValue("statisticsInterval").c_str(), NULL, 10));
+	}
+
+	if (config.itemExists("captureFile"))
+	{
+		opcua->setCaptureFile(config.getValue("captureFile"));
+	}
+
+	if (config.itemExists("spillFile"))
+	{
+		opcua->setSpill(config.getValue("spillFile"),
+				strtol(config.getValue("spillSize").c_str(), NULL, 10),
+				strtol(config.getValue("spillThreshold").c_str(), NULL, 10),
+				config.getValue("spillPolicy").compare("Discard Newest") != 0);
+	}
+
+	if (config.itemExists("conversionThreads"))
+	{
+		opcua->setConversionThreads(strtol(config.getValue("conversionThreads").c_str(), NULL, 10));
+	}
+
+	if (config.itemExists("objectLevel"))
+	{
+		opcua->setObjectReadings(strtol(config.getValue("objectLevel").c_str(), NULL, 10),
+				config.getValue("objectReport").compare("Full Object") == 0);
+	}
+
+	if (config.itemExists("criticalReportingInterval"))
+	{
+		opcua->setCriticalInterval(strtol(config.getValue("criticalReportingInterval").c_str(), NULL, 10));
+	}
+
+	if (config.itemExists("criticalTags"))
+	{
+		string critical = config.getValue("criticalTags");
+		rapidjson::Document doc;
+		doc.Parse(critical.c_str());
+		opcua->clearCriticalTags();
+		if (!doc.HasParseError() && doc.HasMember("critical") && doc["critical"].IsArray())
+		{
+			const rapidjson::Value& tags = doc["critical"];
+			for (rapidjson::SizeType i = 0; i < tags.Size(); i++)
+			{
+				if (tags[i].IsString())
+				{
+					opcua->addCriticalTag(tags[i].GetString());
+				}
+			}
+		}
+		else
+		{
+			Logger::getLogger()->error("UPC UA plugin critical tags must be a critical array");
+		}
 	}
 
-	if (config->itemExists("subscribeById"))
+	if (config.itemExists("subscribeById"))
 	{
-		string byId = config->getValue("subscribeById");
+		string byId = config.getValue("subscribeById");
 		if (byId.compare("true") == 0)
 		{
 			opcua->subscribeById(true);
@@ -171,9 +446,9 @@ string	url;
 		}
 	}
 
-	if (config->itemExists("assetNameType"))
+	if (config.itemExists("assetNameType"))
 	{
-		string assetNameType = config->getValue("assetNameType");
+		string assetNameType = config.getValue("assetNameType");
 		opcua->setAssetNameSource(assetNameType);
 	}
 	else
@@ -181,9 +456,9 @@ string	url;
 		opcua->setAssetNameSource("");
 	}
 
-	if (config->itemExists("pathDelimiter"))
+	if (config.itemExists("pathDelimiter"))
 	{
-		string pathDelimiter = config->getValue("pathDelimiter");
+		string pathDelimiter = config.getValue("pathDelimiter");
 		opcua->setPathDelimiter(pathDelimiter);
 	}
 	else
@@ -191,26 +466,113 @@ string	url;
 		opcua->setPathDelimiter("");
 	}
 
-	// Now add the subscription data
-	string map = config->getValue("subscription");
-	rapidjson::Document doc;
-	doc.Parse(map.c_str());
-	if (!doc.HasParseError())
+	if (config.itemExists("subscription"))
+	{
+		// Now add the subscription data
+		string map = config.getValue("subscription");
+		rapidjson::Document doc;
+		doc.Parse(map.c_str());
+		if (!doc.HasParseError())
+		{
+			opcua->clearSubscription();
+			if (doc.HasMember("subscriptions") && doc["subscriptions"].IsArray())
+			{
+				const rapidjson::Value& subs = doc["subscriptions"];
+				for (rapidjson::SizeType i = 0; i < subs.Size(); i++)
+				{
+					if (subs[i].IsString())
+					{
+						opcua->addSubscription(subs[i].GetString());
+					}
+					else
+					{
+						Logger::getLogger()->error("UPC UA plugin subscription %d is not a string, it is ignored", i);
+					}
+				}
+			}
+			else
+			{
+				Logger::getLogger()->fatal("UPC UA plugin is missing a subscriptions array");
+				throw exception();
+			}
+		}
+	}
+
+	if (config.itemExists("servers"))
 	{
-		if (doc.HasMember("subscriptions") && doc["subscriptions"].IsArray())
+		string servers = config.getValue("servers");
+		rapidjson::Document doc;
+		doc.Parse(servers.c_str());
+		opcua->clearServers();
+		if (!doc.HasParseError() && doc.HasMember("servers") && doc["servers"].IsArray())
 		{
-			const rapidjson::Value& subs = doc["subscriptions"];
-			for (rapidjson::SizeType i = 0; i < subs.Size(); i++)
-                        {
-                                opcua->addSubscription(subs[i].GetString());
-                        }
+			const rapidjson::Value& urls = doc["servers"];
+			for (rapidjson::SizeType i = 0; i < urls.Size(); i++)
+			{
+				if (urls[i].IsString())
+				{
+					opcua->addServer(urls[i].GetString());
+				}
+				else if (urls[i].IsObject() && urls[i].HasMember("url") && urls[i]["url"].IsString())
+				{
+					if (!urls[i].HasMember("backup"))
+					{
+						opcua->addServer(urls[i]["url"].GetString());
+					}
+					else if (urls[i]["backup"].IsString())
+					{
+						opcua->addServer(urls[i]["url"].GetString(), urls[i]["backup"].GetString());
+					}
+					else
+					{
+						Logger::getLogger()->error("UPC UA plugin backup of additional server %s must be a string, the server is ignored",
+								urls[i]["url"].GetString());
+					}
+				}
+				else
+				{
+					Logger::getLogger()->error("UPC UA plugin additional server %d must be a URL or an object with a url string, it is ignored", i);
+				}
+			}
 		}
 		else
 		{
-			Logger::getLogger()->fatal("UPC UA plugin is missing a subscriptions array");
-			throw exception();
+			Logger::getLogger()->error("UPC UA plugin additional servers must be a servers array");
 		}
 	}
+}
+
+/**
+ * Initialise the plugin, called to get the plugin handle
+ */
+PLUGIN_HANDLE plugin_init(ConfigCategory *config)
+{
+OPCUA	*opcua;
+string	url;
+
+
+	if (config->itemExists("url"))
+	{
+		url = config->getValue("url");
+		opcua = new OPCUA(url);
+	}
+	else
+	{
+		Logger::getLogger()->fatal("UPC UA plugin is missing a URL");
+		throw exception();
+	}
+
+
+	if (config->itemExists("asset"))
+	{
+		opcua->setAssetName(config->getValue("asset"));
+	}
+	else
+	{
+		opcua->setAssetName("opcua");
+	}
+
+	configure(opcua, *config);
 
 	return (PLUGIN_HANDLE)opcua;
 }
@@ -259,7 +621,9 @@ void plugin_reconfigure(PLUGIN_HANDLE *handle, string& newConfig)
 ConfigCategory	config("new", newConfig);
 OPCUA		*opcua = (OPCUA *)*handle;
 
-	opcua->stop();
+	// Keep the sessions with the servers, which are used again if the
+	// URLs of the servers are unchanged
+	opcua->stop(true);
 	if (config.itemExists("url"))
 	{
 		string url = config.getValue("url");
@@ -271,75 +635,67 @@ OPCUA		*opcua = (OPCUA *)*handle;
 		opcua->setAssetName(config.getValue("asset"));
 	}
 
-	if (config.itemExists("reportingInterval"))
-	{
-		long val = strtol(config.getValue("reportingInterval").c_str(), NULL, 10);
-		opcua->setReportingInterval(val);
-	}
-	else
-	{
-		opcua->setReportingInterval(100);
-	}
+	configure(opcua, config);
+	opcua->start();
+	Logger::getLogger()->info("UPC UA plugin restart after reconfigure");
+}
 
-	if (config.itemExists("subscribeById"))
-	{
-		string byId = config.getValue("subscribeById");
-		if (byId.compare("true") == 0)
-		{
-			opcua->subscribeById(true);
-		}
-		else
-		{
-			opcua->subscribeById(false);
-		}
-	}
+/**
+ * Write a value to a variable of the OPC UA server
+ *
+ * @param handle	The plugin handle
+ * @param name		The NodeId or asset name of the variable
+ * @param value		The value to write
+ * @return		True if the value was written
+ */
+bool plugin_write(PLUGIN_HANDLE *handle, string& name, string& value)
+{
+OPCUA *opcua = (OPCUA *)handle;
 
-	if (config.itemExists("assetNameType"))
-	{
-		string assetNameType = config.getValue("assetNameType");
-		opcua->setAssetNameSource(assetNameType);
-	}
-	else
-	{
-		opcua->setAssetNameSource("");
-	}
+	vector<pair<string, string> > values;
+	values.push_back(make_pair(name, value));
+	return opcua->write(values)[0] == OpcUa::StatusCode::Good;
+}
 
-	if (config.itemExists("pathDelimiter"))
+/**
+ * Perform a control operation. The "write" operation writes the value
+ * of each parameter to the variable named by the parameter, the values
+ * are sent to the server in as few Write requests as its limits allow.
+ *
+ * @param handle	The plugin handle
+ * @param operation	The name of the operation
+ * @param count		The number of parameters
+ * @param params	The parameters of the operation
+ * @return		True if the operation succeeded for every parameter
+ */
+bool plugin_operation(PLUGIN_HANDLE *handle, string& operation, int count, PLUGIN_PARAMETER **params)
+{
+OPCUA *opcua = (OPCUA *)handle;
+
+	if (operation.compare("write") != 0)
 	{
-		string pathDelimiter = config.getValue("pathDelimiter");
-		opcua->setPathDelimiter(pathDelimiter);
+		Logger::getLogger()->error("OPC UA plugin does not support the operation %s", operation.c_str());
+		return false;
 	}
-	else
+	vector<pair<string, string> > values;
+	for (int i = 0; i < count; i++)
 	{
-		opcua->setPathDelimiter("");
+		values.push_back(make_pair(params[i]->name, params[i]->value));
 	}
-
-	if (config.itemExists("subscription"))
+	vector<OpcUa::StatusCode> status = opcua->write(values);
+	int n_failed = 0;
+	for (auto& code : status)
 	{
-		// Now add the subscription data
-		string map = config.getValue("subscription");
-		rapidjson::Document doc;
-		doc.Parse(map.c_str());
-		if (!doc.HasParseError())
+		if (code != OpcUa::StatusCode::Good)
 		{
-			opcua->clearSubscription();
-			if (doc.HasMember("subscriptions") && doc["subscriptions"].IsArray())
-			{
-				const rapidjson::Value& subs = doc["subscriptions"];
-				for (rapidjson::SizeType i = 0; i < subs.Size(); i++)
-				{
-					opcua->addSubscription(subs[i].GetString());
-				}
-			}
-			else
-			{
-				Logger::getLogger()->fatal("UPC UA plugin is missing a subscriptions array");
-				throw exception();
-			}
+			n_failed++;
 		}
 	}
-	opcua->start();
-	Logger::getLogger()->info("UPC UA plugin restart after reconfigure");
+	if (n_failed)
+	{
+		Logger::getLogger()->error("OPC UA plugin failed to write %d of %d values", n_failed, count);
+	}
+	return n_failed == 0;
 }
 
 /**
@@ -0,0 +1,499 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <spill_buffer.h>
+#include <logger.h>
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The length written in place of a record that is written at the start
+// of the data area because it did not fit before the end
+#define WRAP_MARKER	0xFFFFFFFF
+
+// The types of the serialized datapoint values
+#define VALUE_INTEGER	'i'
+#define VALUE_FLOAT	'f'
+#define VALUE_STRING	's'
+#define VALUE_ARRAY	'a'
+#define VALUE_DICT	'd'
+#define VALUE_LIST	'l'
+
+using namespace std;
+
+/**
+ * Appends the fields of a reading to a record
+ */
+class RecordWriter
+{
+	public:
+		RecordWriter(vector<uint8_t>& record) : m_record(record) {};
+		void	put(const void *data, size_t length)
+			{
+				const uint8_t *p = (const uint8_t *)data;
+				m_record.insert(m_record.end(), p, p + length);
+			};
+		void	putByte(uint8_t value) { m_record.push_back(value); };
+		void	putInt(uint32_t value) { put(&value, sizeof(value)); };
+		void	putLong(int64_t value) { put(&value, sizeof(value)); };
+		void	putDouble(double value) { put(&value, sizeof(value)); };
+		void	putString(const string& value)
+			{
+				putInt(value.length());
+				put(value.data(), value.length());
+			};
+	private:
+		vector<uint8_t>&	m_record;
+};
+
+/**
+ * Reads the fields of a reading back from a record
+ */
+class RecordReader
+{
+	public:
+		RecordReader(const uint8_t *data, size_t size) : m_data(data), m_size(size), m_pos(0) {};
+		void	get(void *data, size_t length)
+			{
+				if (length > m_size - m_pos)
+				{
+					throw runtime_error("Truncated record in spill file");
+				}
+				memcpy(data, m_data + m_pos, length);
+				m_pos += length;
+			};
+		uint8_t	getByte() { uint8_t value; get(&value, sizeof(value)); return value; };
+		uint32_t getInt() { uint32_t value; get(&value, sizeof(value)); return value; };
+		int64_t	getLong() { int64_t value; get(&value, sizeof(value)); return value; };
+		double	getDouble() { double value; get(&value, sizeof(value)); return value; };
+		string	getString()
+			{
+				uint32_t length = getInt();
+				if (length > m_size - m_pos)
+				{
+					throw runtime_error("Truncated record in spill file");
+				}
+				string value((const char *)m_data + m_pos, length);
+				m_pos += length;
+				return value;
+			};
+	private:
+		const uint8_t	*m_data;
+		size_t		m_size;
+		size_t		m_pos;
+};
+
+static void writePoints(RecordWriter& writer, const vector<Datapoint *>& points);
+static vector<Datapoint *> *readPoints(RecordReader& reader);
+
+/**
+ * Serialize a datapoint value. The plugin only creates integer, float,
+ * string, float array and nested values; any other type is written as
+ * its string representation.
+ */
+static void writeValue(RecordWriter& writer, DatapointValue& value)
+{
+	switch (value.getType())
+	{
+		case DatapointValue::T_INTEGER:
+			writer.putByte(VALUE_INTEGER);
+			writer.putLong(value.toInt());
+			break;
+		case DatapointValue::T_FLOAT:
+			writer.putByte(VALUE_FLOAT);
+			writer.putDouble(value.toDouble());
+			break;
+		case DatapointValue::T_STRING:
+			writer.putByte(VALUE_STRING);
+			writer.putString(value.toStringValue());
+			break;
+		case DatapointValue::T_FLOAT_ARRAY:
+		{
+			vector<double> *array = value.getDpArr();
+			writer.putByte(VALUE_ARRAY);
+			writer.putInt(array->size());
+			for (double d : *array)
+			{
+				writer.putDouble(d);
+			}
+			break;
+		}
+		case DatapointValue::T_DP_DICT:
+		case DatapointValue::T_DP_LIST:
+			writer.putByte(value.getType() == DatapointValue::T_DP_DICT ? VALUE_DICT : VALUE_LIST);
+			writePoints(writer, *value.getDpVec());
+			break;
+		default:
+			writer.putByte(VALUE_STRING);
+			writer.putString(value.toString());
+			break;
+	}
+}
+
+/**
+ * Deserialize a datapoint value
+ */
+static DatapointValue readValue(RecordReader& reader)
+{
+	uint8_t type = reader.getByte();
+	switch (type)
+	{
+		case VALUE_INTEGER:
+			return DatapointValue((long)reader.getLong());
+		case VALUE_FLOAT:
+			return DatapointValue(reader.getDouble());
+		case VALUE_STRING:
+			return DatapointValue(reader.getString());
+		case VALUE_ARRAY:
+		{
+			uint32_t n = reader.getInt();
+			vector<double> array;
+			for (uint32_t i = 0; i < n; i++)
+			{
+				array.push_back(reader.getDouble());
+			}
+			return DatapointValue(array);
+		}
+		case VALUE_DICT:
+		case VALUE_LIST:
+		{
+			vector<Datapoint *> *points = readPoints(reader);
+			return DatapointValue(points, type == VALUE_DICT);
+		}
+		default:
+			throw runtime_error("Unknown value type in spill file");
+	}
+}
+
+/**
+ * Serialize a set of datapoints
+ */
+static void writePoints(RecordWriter& writer, const vector<Datapoint *>& points)
+{
+	writer.putInt(points.size());
+	for (auto point : points)
+	{
+		writer.putString(point->getName());
+		writeValue(writer, point->getData());
+	}
+}
+
+/**
+ * Deserialize a set of datapoints
+ */
+static vector<Datapoint *> *readPoints(RecordReader& reader)
+{
+	vector<Datapoint *> *points = new vector<Datapoint *>;
+	try {
+		uint32_t n = reader.getInt();
+		for (uint32_t i = 0; i < n; i++)
+		{
+			string name = reader.getString();
+			DatapointValue value = readValue(reader);
+			points->push_back(new Datapoint(name, value));
+		}
+	} catch (...) {
+		for (auto point : *points)
+		{
+			delete point;
+		}
+		delete points;
+		throw;
+	}
+	return points;
+}
+
+/**
+ * Constructor for a spill buffer that is not yet open
+ */
+SpillBuffer::SpillBuffer() : m_header(NULL), m_data(NULL), m_mapped(0), m_overwrite(true),
+	m_dropped(0)
+{
+}
+
+/**
+ * Destructor, unmaps the spill file
+ */
+SpillBuffer::~SpillBuffer()
+{
+	close();
+}
+
+/**
+ * Open the spill file, creating it if need be. If the file exists with
+ * the same capacity the readings it holds are kept, to be ingested
+ * before any new readings.
+ *
+ * @param path		The path of the spill file
+ * @param capacity	The size of the data area of the file in bytes
+ * @param overwrite	Overwrite the oldest readings when full, rather
+ *			than discarding the new reading
+ * @throws runtime_error if the file can not be created or mapped
+ */
+void
+SpillBuffer::open(const string& path, size_t capacity, bool overwrite)
+{
+	close();
+	lock_guard<mutex> guard(m_mutex);
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		throw runtime_error("Unable to open spill file " + path + ": " + strerror(errno));
+	}
+	size_t total = sizeof(SpillHeader) + capacity;
+	struct stat st;
+	bool existing = fstat(fd, &st) == 0 && st.st_size == (off_t)total;
+	if (!existing && ftruncate(fd, total) < 0)
+	{
+		int error = errno;
+		::close(fd);
+		throw runtime_error("Unable to size spill file " + path + ": " + strerror(error));
+	}
+	void *p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		throw runtime_error("Unable to map spill file " + path + ": " + strerror(error));
+	}
+	m_header = (SpillHeader *)p;
+	m_data = (uint8_t *)p + sizeof(SpillHeader);
+	m_mapped = total;
+	m_path = path;
+	m_overwrite = overwrite;
+	if (!existing || memcmp(m_header->magic, SPILL_MAGIC, sizeof(m_header->magic)) != 0
+			|| m_header->version != SPILL_VERSION || m_header->capacity != capacity
+			|| m_header->head > capacity || m_header->tail > capacity
+			|| m_header->used > capacity)
+	{
+		reset(capacity);
+	}
+	else if (m_header->count)
+	{
+		Logger::getLogger()->info("%lu readings recovered from spill file %s",
+				(unsigned long)m_header->count, path.c_str());
+	}
+}
+
+/**
+ * Unmap the spill file. Readings it holds remain in the file.
+ */
+void
+SpillBuffer::close()
+{
+	lock_guard<mutex> guard(m_mutex);
+	if (m_header)
+	{
+		munmap(m_header, m_mapped);
+		m_header = NULL;
+		m_data = NULL;
+		m_mapped = 0;
+	}
+	m_path.clear();
+}
+
+/**
+ * Empty the spill buffer
+ *
+ * @param capacity	The size of the data area
+ */
+void
+SpillBuffer::reset(size_t capacity)
+{
+	memcpy(m_header->magic, SPILL_MAGIC, sizeof(m_header->magic));
+	m_header->version = SPILL_VERSION;
+	m_header->reserved = 0;
+	m_header->capacity = capacity;
+	m_header->head = 0;
+	m_header->tail = 0;
+	m_header->used = 0;
+	m_header->count = 0;
+}
+
+/**
+ * Append a reading to the spill buffer. If the buffer is full the oldest
+ * readings are overwritten or, if overwriting is disabled, the reading
+ * is discarded. The caller keeps ownership of the reading.
+ *
+ * @param reading	The reading to spill
+ * @return		False if the reading was discarded
+ */
+bool
+SpillBuffer::write(Reading *reading)
+{
+	lock_guard<mutex> guard(m_mutex);
+	if (!m_header)
+	{
+		return false;
+	}
+	m_record.clear();
+	RecordWriter writer(m_record);
+	struct timeval tm;
+	reading->getUserTimestamp(&tm);
+	writer.putString(reading->getAssetName());
+	writer.putLong(tm.tv_sec);
+	writer.putLong(tm.tv_usec);
+	writePoints(writer, reading->getReadingData());
+
+	uint64_t capacity = m_header->capacity;
+	uint64_t length = sizeof(uint32_t) + m_record.size();
+	if (length > capacity)
+	{
+		m_dropped++;
+		return false;
+	}
+	bool wrap;
+	uint64_t skip;
+	while (true)
+	{
+		wrap = m_header->head + length > capacity;
+		skip = wrap ? capacity - m_header->head : 0;
+		if (m_header->used + skip + length <= capacity)
+		{
+			break;
+		}
+		if (!m_overwrite || m_header->count == 0)
+		{
+			m_dropped++;
+			return false;
+		}
+		uint32_t oldestLength;
+		oldest(oldestLength);
+		pop(oldestLength);
+		m_dropped++;
+	}
+	if (wrap)
+	{
+		if (skip >= sizeof(uint32_t))
+		{
+			uint32_t marker = WRAP_MARKER;
+			memcpy(m_data + m_header->head, &marker, sizeof(marker));
+		}
+		m_header->used += skip;
+		m_header->head = 0;
+	}
+	uint32_t size = m_record.size();
+	memcpy(m_data + m_header->head, &size, sizeof(size));
+	memcpy(m_data + m_header->head + sizeof(size), m_record.data(), size);
+	m_header->head += length;
+	m_header->used += length;
+	m_header->count++;
+	return true;
+}
+
+/**
+ * Remove the oldest reading from the spill buffer
+ *
+ * @return	The reading, which the caller takes ownership of, or NULL if
+ *		the buffer is empty
+ */
+Reading *
+SpillBuffer::read()
+{
+	lock_guard<mutex> guard(m_mutex);
+	if (!m_header || m_header->count == 0)
+	{
+		return NULL;
+	}
+	uint32_t length;
+	const uint8_t *data = oldest(length);
+	Reading *reading = NULL;
+	try {
+		if ((uint64_t)(data - m_data) + length > m_header->capacity)
+		{
+			throw runtime_error("Corrupt record length");
+		}
+		RecordReader reader(data, length);
+		string asset = reader.getString();
+		struct timeval tm;
+		tm.tv_sec = reader.getLong();
+		tm.tv_usec = reader.getLong();
+		vector<Datapoint *> *points = readPoints(reader);
+		reading = new Reading(asset, *points);
+		delete points;
+		reading->setUserTimestamp(tm);
+	} catch (exception& e) {
+		Logger::getLogger()->error("Discarding the %lu readings in spill file %s: %s",
+				(unsigned long)m_header->count, m_path.c_str(), e.what());
+		m_dropped += m_header->count;
+		reset(m_header->capacity);
+		return NULL;
+	}
+	pop(length);
+	return reading;
+}
+
+/**
+ * Return the oldest record, moving the tail to the start of the data
+ * area if the record was written there. Called with the mutex held and
+ * the buffer not empty.
+ *
+ * @param length	Set to the length of the record
+ * @return		The record
+ */
+const uint8_t *
+SpillBuffer::oldest(uint32_t& length)
+{
+	uint64_t capacity = m_header->capacity;
+	if (capacity - m_header->tail < sizeof(uint32_t))
+	{
+		m_header->used -= capacity - m_header->tail;
+		m_header->tail = 0;
+	}
+	memcpy(&length, m_data + m_header->tail, sizeof(length));
+	if (length == WRAP_MARKER)
+	{
+		m_header->used -= capacity - m_header->tail;
+		m_header->tail = 0;
+		memcpy(&length, m_data, sizeof(length));
+	}
+	return m_data + m_header->tail + sizeof(length);
+}
+
+/**
+ * Remove the oldest record, returned by oldest()
+ *
+ * @param length	The length of the record
+ */
+void
+SpillBuffer::pop(uint32_t length)
+{
+	m_header->tail += sizeof(length) + length;
+	m_header->used -= sizeof(length) + length;
+	if (--m_header->count == 0)
+	{
+		m_header->head = 0;
+		m_header->tail = 0;
+		m_header->used = 0;
+	}
+}
+
+/**
+ * Return true if the spill buffer holds no readings
+ */
+bool
+SpillBuffer::isEmpty()
+{
+	lock_guard<mutex> guard(m_mutex);
+	return !m_header || m_header->count == 0;
+}
+
+/**
+ * Return the number of readings held in the spill buffer
+ */
+uint64_t
+SpillBuffer::getCount()
+{
+	lock_guard<mutex> guard(m_mutex);
+	return m_header ? m_header->count : 0;
+}
@@ -0,0 +1,306 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <tag_file.h>
+#include <logger.h>
+#include <rapidjson/document.h>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <strings.h>
+#include <stdlib.h>
+
+using namespace std;
+
+/**
+ * Return the FNV-1a hash of a row of the tag file
+ */
+static uint64_t rowHash(const string& row)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : row)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Split a CSV row into its fields. A field may be enclosed in double
+ * quotes, in which case it may contain commas and "" stands for a
+ * double quote.
+ *
+ * @param line		The row
+ * @param fields	Populated with the fields of the row
+ */
+static void splitCSV(const string& line, vector<string>& fields)
+{
+	string field;
+	bool quoted = false;
+	for (size_t i = 0; i < line.size(); i++)
+	{
+		char c = line[i];
+		if (quoted)
+		{
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+			{
+				field += '"';
+				i++;
+			}
+			else if (c == '"')
+				quoted = false;
+			else
+				field += c;
+		}
+		else if (c == '"')
+			quoted = true;
+		else if (c == ',')
+		{
+			fields.push_back(field);
+			field.clear();
+		}
+		else if (c != '\r')
+			field += c;
+	}
+	fields.push_back(field);
+}
+
+/**
+ * Remove the leading and trailing white space from a string
+ */
+static string trim(const string& str)
+{
+	size_t start = str.find_first_not_of(" \t");
+	if (start == string::npos)
+		return "";
+	size_t end = str.find_last_not_of(" \t");
+	return str.substr(start, end - start + 1);
+}
+
+/**
+ * Load the tag file. If the file is the one already loaded and has not
+ * been modified since it is not read again. Otherwise the file is read
+ * a row at a time; a row that is unchanged from the previous load is
+ * taken from the existing table rather than parsed again.
+ *
+ * Rows that cannot be parsed are logged and skipped. If a variable is
+ * listed more than once the last row for it is used.
+ *
+ * @param path	The path of the tag file
+ * @return	True if the file was read
+ */
+bool
+TagFile::load(const string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{
+		throw runtime_error("Unable to access tag file " + path);
+	}
+	if (path.compare(m_path) == 0 && st.st_mtime == m_mtime && st.st_size == m_size)
+	{
+		return false;
+	}
+
+	ifstream file(path);
+	if (!file)
+	{
+		throw runtime_error("Unable to open tag file " + path);
+	}
+
+	// The rows of the current table by their hash, so that rows which have
+	// not changed are not parsed again
+	unordered_map<uint64_t, size_t> previous;
+	if (path.compare(m_path) == 0)
+	{
+		for (size_t i = 0; i < m_tags.size(); i++)
+		{
+			previous[m_tags[i].hash] = i;
+		}
+	}
+
+	vector<Tag> tags;
+	size_t parsed = 0;
+	int lineNo = 0;
+	string line;
+	while (getline(file, line))
+	{
+		lineNo++;
+		string row = trim(line);
+		if (row.empty() || row[0] == '#')
+		{
+			continue;
+		}
+		uint64_t hash = rowHash(row);
+		auto it = previous.find(hash);
+		if (it != previous.end())
+		{
+			tags.push_back(m_tags[it->second]);
+			continue;
+		}
+		Tag tag;
+		bool ok;
+		if (row[0] == '{')
+		{
+			ok = parseJSON(row, tag);
+		}
+		else
+		{
+			// Skip a CSV header row
+			if (strncasecmp(row.c_str(), "nodeid", 6) == 0)
+			{
+				continue;
+			}
+			ok = parseCSV(row, tag);
+		}
+		if (!ok)
+		{
+			Logger::getLogger()->error("Ignoring invalid row %d of tag file %s", lineNo, path.c_str());
+			continue;
+		}
+		tag.hash = hash;
+		tags.push_back(tag);
+		parsed++;
+	}
+
+	// Sort by NodeId, keeping the last row for any NodeId listed twice
+	stable_sort(tags.begin(), tags.end(),
+			[](const Tag& a, const Tag& b) { return a.nodeId < b.nodeId; });
+	vector<Tag> unique;
+	unique.reserve(tags.size());
+	for (size_t i = 0; i < tags.size(); i++)
+	{
+		if (i + 1 < tags.size() && tags[i + 1].nodeId == tags[i].nodeId)
+		{
+			continue;
+		}
+		unique.push_back(tags[i]);
+	}
+
+	m_tags.swap(unique);
+	m_path = path;
+	m_mtime = st.st_mtime;
+	m_size = st.st_size;
+	m_parsed = parsed;
+	Logger::getLogger()->info("Loaded %d tags from %s, %d rows changed",
+			(int)m_tags.size(), path.c_str(), (int)parsed);
+	return true;
+}
+
+/**
+ * Empty the table of tags
+ */
+void
+TagFile::clear()
+{
+	m_tags.clear();
+	m_path.clear();
+	m_mtime = 0;
+	m_size = 0;
+	m_parsed = 0;
+}
+
+/**
+ * Find the tag of a variable
+ *
+ * @param nodeId	The NodeId of the variable
+ * @return		The tag, NULL if the variable is not in the table
+ */
+const Tag *
+TagFile::find(const OpcUa::NodeId& nodeId) const
+{
+	auto it = lower_bound(m_tags.begin(), m_tags.end(), nodeId,
+			[](const Tag& tag, const OpcUa::NodeId& id) { return tag.nodeId < id; });
+	if (it == m_tags.end() || it->nodeId != nodeId)
+	{
+		return NULL;
+	}
+	return &(*it);
+}
+
+/**
+ * Parse a CSV row of the tag file
+ *
+ * @param line	The row
+ * @param tag	Populated from the row
+ * @return	True if the row is valid
+ */
+bool
+TagFile::parseCSV(const string& line, Tag& tag)
+{
+	vector<string> fields;
+	splitCSV(line, fields);
+	try {
+		tag.nodeId = OpcUa::ToNodeId(trim(fields[0]));
+	} catch (exception& e) {
+		return false;
+	}
+	if (fields.size() > 1)
+		tag.name = trim(fields[1]);
+	if (fields.size() > 2)
+		tag.group = trim(fields[2]);
+	if (fields.size() > 3 && !trim(fields[3]).empty())
+	{
+		string deadband = trim(fields[3]);
+		char *end;
+		tag.deadband = strtod(deadband.c_str(), &end);
+		if (*end || tag.deadband < 0)
+			return false;
+	}
+	if (fields.size() > 4)
+		tag.server = trim(fields[4]);
+	return true;
+}
+
+/**
+ * Parse a JSON Lines row of the tag file
+ *
+ * @param line	The row
+ * @param tag	Populated from the row
+ * @return	True if the row is valid
+ */
+bool
+TagFile::parseJSON(const string& line, Tag& tag)
+{
+	rapidjson::Document doc;
+	doc.Parse(line.c_str());
+	if (doc.HasParseError() || !doc.IsObject()
+			|| !doc.HasMember("nodeid") || !doc["nodeid"].IsString())
+	{
+		return false;
+	}
+	try {
+		tag.nodeId = OpcUa::ToNodeId(doc["nodeid"].GetString());
+	} catch (exception& e) {
+		return false;
+	}
+	if (doc.HasMember("name") && doc["name"].IsString())
+		tag.name = doc["name"].GetString();
+	if (doc.HasMember("group") && doc["group"].IsString())
+		tag.group = doc["group"].GetString();
+	if (doc.HasMember("deadband"))
+	{
+		if (!doc["deadband"].IsNumber() || doc["deadband"].GetDouble() < 0)
+			return false;
+		tag.deadband = doc["deadband"].GetDouble();
+	}
+	if (doc.HasMember("server"))
+	{
+		if (doc["server"].IsString())
+			tag.server = doc["server"].GetString();
+		else if (doc["server"].IsUint())
+			tag.server = to_string(doc["server"].GetUint());
+		else
+			return false;
+	}
+	return true;
+}
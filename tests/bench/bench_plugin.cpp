@@ -0,0 +1,175 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <bench_plugin.h>
+#include <config_category.h>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <stdexcept>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace rapidjson;
+
+typedef void (*INGEST_CB)(void *, Reading);
+
+extern "C" {
+	PLUGIN_INFORMATION *plugin_info();
+	PLUGIN_HANDLE plugin_init(ConfigCategory *config);
+	void plugin_start(PLUGIN_HANDLE *handle);
+	void plugin_register_ingest(PLUGIN_HANDLE *handle, INGEST_CB cb, void *data);
+	void plugin_reconfigure(PLUGIN_HANDLE *handle, string& newConfig);
+	void plugin_shutdown(PLUGIN_HANDLE *handle);
+};
+
+/**
+ * Create an instance of the plugin. The configuration is the default
+ * configuration of the plugin with the given items overridden.
+ *
+ * @param config	The values of the configuration items to override
+ */
+BenchPlugin::BenchPlugin(const map<string, string>& config) : m_handle(NULL),
+	m_readings(0), m_firstReading(0)
+{
+	ConfigCategory category("bench", buildConfig(config));
+	m_handle = plugin_init(&category);
+	plugin_register_ingest((PLUGIN_HANDLE *)m_handle, ingest, this);
+}
+
+/**
+ * Build the configuration category of the plugin: the default
+ * configuration with the given items overridden.
+ *
+ * @param config	The values of the configuration items to override
+ * @return		The configuration category as JSON
+ */
+string
+BenchPlugin::buildConfig(const map<string, string>& config)
+{
+	Document doc;
+	doc.Parse(plugin_info()->config);
+	if (doc.HasParseError())
+	{
+		throw runtime_error("Unable to parse the default configuration of the plugin");
+	}
+	for (Value::MemberIterator item = doc.MemberBegin(); item != doc.MemberEnd(); ++item)
+	{
+		if (!item->value.IsObject() || !item->value.HasMember("default"))
+		{
+			continue;
+		}
+		string name = item->name.GetString();
+		auto it = config.find(name);
+		string value = it == config.end() ? item->value["default"].GetString() : it->second;
+		Value v;
+		v.SetString(value.c_str(), value.length(), doc.GetAllocator());
+		if (item->value.HasMember("value"))
+		{
+			item->value["value"] = v;
+		}
+		else
+		{
+			item->value.AddMember("value", v, doc.GetAllocator());
+		}
+	}
+	StringBuffer buffer;
+	Writer<StringBuffer> writer(buffer);
+	doc.Accept(writer);
+	return buffer.GetString();
+}
+
+/**
+ * Destructor, shuts the plugin down if it has not already been
+ */
+BenchPlugin::~BenchPlugin()
+{
+	shutdown();
+}
+
+/**
+ * Start the plugin, connecting to the servers
+ */
+void
+BenchPlugin::start()
+{
+	plugin_start((PLUGIN_HANDLE *)m_handle);
+}
+
+/**
+ * Reconfigure the plugin, as the south service does when the
+ * configuration category changes
+ *
+ * @param config	The values of the configuration items to override
+ */
+void
+BenchPlugin::reconfigure(const map<string, string>& config)
+{
+	string category = buildConfig(config);
+	plugin_reconfigure(&m_handle, category);
+}
+
+/**
+ * Shut the plugin down
+ */
+void
+BenchPlugin::shutdown()
+{
+	if (m_handle)
+	{
+		plugin_shutdown((PLUGIN_HANDLE *)m_handle);
+		m_handle = NULL;
+	}
+}
+
+/**
+ * The ingest callback of the plugin
+ *
+ * @param data		The benchmark plugin instance
+ * @param reading	The reading ingested by the plugin
+ */
+void
+BenchPlugin::ingest(void *data, Reading reading)
+{
+	BenchPlugin *plugin = (BenchPlugin *)data;
+	const string& asset = reading.getAssetName();
+	if (asset.length() >= 10 && asset.compare(asset.length() - 10, 10, "Statistics") == 0)
+	{
+		return;
+	}
+	struct timeval tm;
+	reading.getUserTimestamp(&tm);
+	plugin->m_latency.record(wallTimeMicros() - ((int64_t)tm.tv_sec * 1000000 + tm.tv_usec));
+	if (plugin->m_readings++ == 0)
+	{
+		plugin->m_firstReading = monotonicTime();
+	}
+}
+
+/**
+ * Return the time in microseconds since the epoch
+ */
+int64_t wallTimeMicros()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Return the CPU time, user and system, used by the process in microseconds
+ */
+int64_t cpuTimeMicros()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
@@ -0,0 +1,57 @@
+#ifndef _BENCH_PLUGIN_H
+#define _BENCH_PLUGIN_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <map>
+#include <atomic>
+#include <plugin_api.h>
+#include <reading.h>
+#include <latency_histogram.h>
+
+/**
+ * An instance of the plugin driven through its plugin API, as the south
+ * service would, with an ingest callback that counts the readings and
+ * records the time from the source timestamp of each reading to its
+ * ingest. The statistics readings of the plugin are not counted.
+ */
+class BenchPlugin
+{
+	public:
+		BenchPlugin(const std::map<std::string, std::string>& config);
+		~BenchPlugin();
+		void		start();
+		void		reconfigure(const std::map<std::string, std::string>& config);
+		void		shutdown();
+		uint64_t	getReadings() const { return m_readings; };
+		LatencyHistogram&
+				getLatency() { return m_latency; };
+		int64_t		getFirstReading() const { return m_firstReading; };
+
+	private:
+		static void		ingest(void *data, Reading reading);
+		static std::string	buildConfig(const std::map<std::string, std::string>& config);
+		PLUGIN_HANDLE		m_handle;
+		std::atomic<uint64_t>	m_readings;
+		std::atomic<int64_t>	m_firstReading;
+		LatencyHistogram	m_latency;
+};
+
+/**
+ * Return the time in microseconds since the epoch
+ */
+int64_t wallTimeMicros();
+
+/**
+ * Return the CPU time, user and system, used by the process in microseconds
+ */
+int64_t cpuTimeMicros();
+
+#endif
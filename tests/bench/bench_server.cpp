@@ -0,0 +1,244 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <bench_server.h>
+#include <logger.h>
+#include <chrono>
+
+// The interval at which values are changed, in milliseconds
+#define CHANGE_TICK	10
+
+using namespace std;
+
+/**
+ * Create the server, listening on a port of the loopback interface
+ *
+ * @param port	The port to listen on
+ */
+BenchServer::BenchServer(int port) : m_server(NULL), m_namespace(0),
+	m_changeThread(NULL), m_changing(false), m_changes(0)
+{
+	m_url = "opc.tcp://127.0.0.1:" + to_string(port);
+}
+
+/**
+ * Destructor, stops the server if it is running
+ */
+BenchServer::~BenchServer()
+{
+	stop();
+}
+
+/**
+ * Start the server and create the folder the address space is built in
+ */
+void
+BenchServer::start()
+{
+	m_server = new OpcUa::UaServer(Logger::getLogger());
+	m_server->SetEndpoint(m_url);
+	m_server->SetServerURI(BENCH_NAMESPACE);
+	m_server->SetServerName("Fledge OPC UA benchmark");
+	m_server->Start();
+	m_namespace = m_server->RegisterNamespace(BENCH_NAMESPACE);
+	m_root = m_server->GetObjectsNode().AddFolder(OpcUa::NodeId(BENCH_ROOT, m_namespace),
+			OpcUa::QualifiedName(m_namespace, BENCH_ROOT));
+}
+
+/**
+ * Stop changing values and stop the server
+ */
+void
+BenchServer::stop()
+{
+	stopChanges();
+	if (m_server)
+	{
+		m_server->Stop();
+		delete m_server;
+		m_server = NULL;
+	}
+	m_variables.clear();
+	m_arrays.clear();
+}
+
+/**
+ * Add objects, each with a number of variables, to the address space.
+ * The variables are of type Double; if arrays are requested every other
+ * variable is an array of BENCH_ARRAY_SIZE Doubles.
+ *
+ * The NodeIds are Bench.Object<n> and Bench.Object<n>.Variable<m>.
+ *
+ * @param objects	The number of objects
+ * @param variables	The number of variables of each object
+ * @param arrays	Create array variables as well as scalars
+ */
+void
+BenchServer::addObjects(int objects, int variables, bool arrays)
+{
+	for (int i = 0; i < objects; i++)
+	{
+		string objectName = "Object" + to_string(i);
+		string objectId = string(BENCH_ROOT) + "." + objectName;
+		OpcUa::Node object = m_root.AddObject(OpcUa::NodeId(objectId, m_namespace),
+				OpcUa::QualifiedName(m_namespace, objectName));
+		for (int j = 0; j < variables; j++)
+		{
+			string name = "Variable" + to_string(j);
+			bool array = arrays && (j % 2) == 1;
+			OpcUa::Variant value = array ? OpcUa::Variant(vector<double>(BENCH_ARRAY_SIZE, 0.0))
+						: OpcUa::Variant(0.0);
+			m_variables.push_back(object.AddVariable(OpcUa::NodeId(objectId + "." + name, m_namespace),
+					OpcUa::QualifiedName(m_namespace, name), value));
+			m_arrays.push_back(array);
+		}
+	}
+}
+
+/**
+ * Add a tree of objects to the address space, to give the shapes of
+ * address space discovery has to cope with: a deep hierarchy with a
+ * small breadth or a wide, flat one with a depth of 1. Every object in
+ * the tree has a number of Double variables.
+ *
+ * The NodeIds are the path of the node from BENCH_ROOT, for example
+ * Bench.Node1.Node0.Variable2.
+ *
+ * @param depth		The number of levels of objects
+ * @param breadth	The number of child objects of each object
+ * @param variables	The number of variables of each object
+ * @return		The number of objects added
+ */
+size_t
+BenchServer::addTree(int depth, int breadth, int variables)
+{
+	return addBranch(m_root, BENCH_ROOT, depth, breadth, variables);
+}
+
+/**
+ * Add a level of the tree of objects and the levels below it
+ *
+ * @param parent	The node to add the objects to
+ * @param parentId	The NodeId of the parent node
+ * @param depth		The number of levels still to add
+ * @param breadth	The number of child objects of each object
+ * @param variables	The number of variables of each object
+ * @return		The number of objects added
+ */
+size_t
+BenchServer::addBranch(OpcUa::Node& parent, const string& parentId, int depth, int breadth, int variables)
+{
+	size_t added = 0;
+	for (int i = 0; depth > 0 && i < breadth; i++)
+	{
+		string objectName = "Node" + to_string(i);
+		string objectId = parentId + "." + objectName;
+		OpcUa::Node object = parent.AddObject(OpcUa::NodeId(objectId, m_namespace),
+				OpcUa::QualifiedName(m_namespace, objectName));
+		for (int j = 0; j < variables; j++)
+		{
+			string name = "Variable" + to_string(j);
+			m_variables.push_back(object.AddVariable(OpcUa::NodeId(objectId + "." + name, m_namespace),
+					OpcUa::QualifiedName(m_namespace, name), OpcUa::Variant(0.0)));
+			m_arrays.push_back(false);
+		}
+		added += 1 + addBranch(object, objectId, depth - 1, breadth, variables);
+	}
+	return added;
+}
+
+/**
+ * Start changing the values of the variables, in turn
+ *
+ * @param rate	The number of values to change per second
+ */
+void
+BenchServer::startChanges(long rate)
+{
+	stopChanges();
+	m_changing = true;
+	m_changeThread = new thread(&BenchServer::changeThread, this, rate);
+}
+
+/**
+ * Stop changing the values of the variables
+ */
+void
+BenchServer::stopChanges()
+{
+	if (m_changeThread)
+	{
+		{
+			lock_guard<mutex> guard(m_mutex);
+			m_changing = false;
+		}
+		m_cv.notify_all();
+		m_changeThread->join();
+		delete m_changeThread;
+		m_changeThread = NULL;
+	}
+}
+
+/**
+ * Thread that changes the values of the variables. Every CHANGE_TICK
+ * milliseconds the number of changes due since the thread started, less
+ * those already made, are made.
+ *
+ * @param rate	The number of values to change per second
+ */
+void
+BenchServer::changeThread(long rate)
+{
+	auto started = chrono::steady_clock::now();
+	uint64_t made = 0;
+	size_t next = 0;
+	unique_lock<mutex> lck(m_mutex);
+	while (m_changing && !m_variables.empty())
+	{
+		m_cv.wait_for(lck, chrono::milliseconds(CHANGE_TICK));
+		if (!m_changing)
+		{
+			break;
+		}
+		lck.unlock();
+		int64_t elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+		uint64_t due = (uint64_t)elapsed * rate / 1000;
+		while (made < due)
+		{
+			change(next);
+			next = (next + 1) % m_variables.size();
+			made++;
+		}
+		lck.lock();
+	}
+}
+
+/**
+ * Change the value of a variable, with a source timestamp of now
+ *
+ * @param index	The index of the variable
+ */
+void
+BenchServer::change(size_t index)
+{
+	uint64_t count = ++m_changes;
+	OpcUa::DataValue value;
+	if (m_arrays[index])
+	{
+		value = OpcUa::DataValue(OpcUa::Variant(vector<double>(BENCH_ARRAY_SIZE, (double)count)));
+	}
+	else
+	{
+		value = OpcUa::DataValue(OpcUa::Variant((double)count));
+	}
+	OpcUa::DateTime now = OpcUa::DateTime::Current();
+	value.SetSourceTimestamp(now);
+	value.SetServerTimestamp(now);
+	m_variables[index].SetValue(value);
+}
@@ -0,0 +1,72 @@
+#ifndef _BENCH_SERVER_H
+#define _BENCH_SERVER_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <opc/ua/server/server.h>
+
+#define BENCH_NAMESPACE	"urn:fledge:opcua:bench"
+
+// The NodeId, in the bench namespace, of the folder holding the address space
+#define BENCH_ROOT	"Bench"
+
+// The length of the array variables
+#define BENCH_ARRAY_SIZE	10
+
+/**
+ * An OPC UA server run in the process of a benchmark, with a synthetic
+ * address space. All the nodes of the address space are created under
+ * the folder BENCH_ROOT with string NodeIds that are derived from their
+ * position, so the benchmark can name them without browsing.
+ *
+ * The server can change the values of its variables at a given rate,
+ * stamping each value with the time it was changed.
+ */
+class BenchServer
+{
+	public:
+		BenchServer(int port);
+		~BenchServer();
+		const std::string&
+				getURL() const { return m_url; };
+		uint16_t	getNamespace() const { return m_namespace; };
+		void		start();
+		void		stop();
+		void		addObjects(int objects, int variables, bool arrays);
+		size_t		addTree(int depth, int breadth, int variables);
+		size_t		getVariableCount() const { return m_variables.size(); };
+		void		startChanges(long rate);
+		void		stopChanges();
+		uint64_t	getChanges() const { return m_changes; };
+
+	private:
+		void			changeThread(long rate);
+		void			change(size_t index);
+		size_t			addBranch(OpcUa::Node& parent, const std::string& parentId,
+						int depth, int breadth, int variables);
+		std::string		m_url;
+		OpcUa::UaServer		*m_server;
+		uint16_t		m_namespace;
+		OpcUa::Node		m_root;
+		std::vector<OpcUa::Node>
+					m_variables;
+		std::vector<bool>	m_arrays;
+		std::thread		*m_changeThread;
+		bool			m_changing;
+		std::mutex		m_mutex;
+		std::condition_variable	m_cv;
+		std::atomic<uint64_t>	m_changes;
+};
+#endif
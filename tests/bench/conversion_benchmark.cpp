@@ -0,0 +1,193 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <opcua.h>
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+using namespace std;
+
+/**
+ * Microbenchmarks of the stages of turning a data change notification
+ * into a reading: the conversion of the value to a datapoint, for every
+ * data type the plugin converts and for a range of array sizes, the
+ * naming of the datapoint and the creation of the reading with its
+ * timestamp.
+ *
+ * The time of each benchmark is the time per value. The allocs/value
+ * counter is the number of allocations made through operator new per
+ * value; allocations the Fledge libraries make with malloc directly are
+ * not counted.
+ */
+
+static atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	void *p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// The array sizes the array conversions are measured with
+static const vector<int64_t> arraySizes = { 1, 10, 100, 1000 };
+
+/**
+ * The state shared by the benchmarks: a plugin instance with a server
+ * connection that is never started, and a variable to convert values of.
+ * It holds counters so is allocated aligned to a cache line.
+ */
+class Fixture : public CacheAligned
+{
+	public:
+		Fixture() : opcua(""), server(&opcua, "bench"), client(&opcua, &server, false),
+			node(OpcUa::Services::SharedPtr(), OpcUa::NodeId("Bench.Variable", 2))
+		{
+			opcua.setAssetName("bench");
+		};
+		OPCUA		opcua;
+		OPCUAServer	server;
+		OpcUaClient	client;
+		OpcUa::Node	node;
+};
+
+static Fixture *fixture;
+
+/**
+ * Create a value of a scalar or, if size is non-zero, an array
+ */
+template<typename T> static OpcUa::DataValue makeValue(T value, int64_t size)
+{
+	OpcUa::DataValue dval = size ? OpcUa::DataValue(OpcUa::Variant(vector<T>(size, value)))
+					: OpcUa::DataValue(OpcUa::Variant(value));
+	dval.SetSourceTimestamp(OpcUa::DateTime::Current());
+	return dval;
+}
+
+/**
+ * Set the counters common to all the benchmarks
+ */
+static void setCounters(benchmark::State& state, uint64_t allocs)
+{
+	state.counters["allocs/value"] = benchmark::Counter(allocs, benchmark::Counter::kAvgIterations);
+	state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * Benchmark the conversion of a value to a datapoint
+ *
+ * @param dval	The value to convert
+ */
+static void convert(benchmark::State& state, OpcUa::DataValue dval)
+{
+	uint64_t start = allocations;
+	while (state.KeepRunning())
+	{
+		vector<Datapoint *> points;
+		if (!fixture->client.toDatapoints(fixture->node, dval, points))
+		{
+			state.SkipWithError("The value was not converted");
+			break;
+		}
+		for (auto point : points)
+		{
+			delete point;
+		}
+	}
+	setCounters(state, allocations - start);
+}
+
+/**
+ * Benchmark the naming of a datapoint from its variable
+ */
+static void nodeName(benchmark::State& state)
+{
+	uint64_t start = allocations;
+	while (state.KeepRunning())
+	{
+		benchmark::DoNotOptimize(fixture->opcua.getNodeName(fixture->node));
+	}
+	setCounters(state, allocations - start);
+}
+
+/**
+ * Benchmark the creation of a reading, with its asset name and timestamp,
+ * from a datapoint
+ */
+static void createReading(benchmark::State& state)
+{
+	OpcUa::DateTime timestamp = OpcUa::DateTime::Current();
+	string assetPath = "/Line1/Bench.Variable";
+	uint64_t start = allocations;
+	while (state.KeepRunning())
+	{
+		vector<Datapoint *> points;
+		DatapointValue value(1.5);
+		points.push_back(new Datapoint("Bench.Variable", value));
+		Reading *reading = fixture->opcua.createReading(points, assetPath, timestamp);
+		delete reading;
+	}
+	setCounters(state, allocations - start);
+}
+
+/**
+ * Register the conversion benchmarks of a numeric type, as a scalar and
+ * as arrays of each size
+ */
+template<typename T> static void registerNumeric(const string& name, T value)
+{
+	benchmark::RegisterBenchmark(("convert/" + name).c_str(), convert, makeValue(value, 0));
+	for (auto size : arraySizes)
+	{
+		benchmark::RegisterBenchmark(("convert/" + name + "[" + to_string(size) + "]").c_str(),
+				convert, makeValue(value, size));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	benchmark::Initialize(&argc, argv);
+	fixture = new Fixture();
+
+	registerNumeric<int8_t>("SByte", -42);
+	registerNumeric<uint8_t>("Byte", 42);
+	registerNumeric<int16_t>("Int16", -4242);
+	registerNumeric<uint16_t>("UInt16", 4242);
+	registerNumeric<int32_t>("Int32", -424242);
+	registerNumeric<uint32_t>("UInt32", 424242);
+	registerNumeric<int64_t>("Int64", -42424242424LL);
+	registerNumeric<uint64_t>("UInt64", 42424242424ULL);
+	registerNumeric<float>("Float", 42.5f);
+	registerNumeric<double>("Double", 42.5);
+	benchmark::RegisterBenchmark("convert/Boolean", convert, makeValue(true, 0));
+	benchmark::RegisterBenchmark("convert/String", convert, makeValue(string("running"), 0));
+	benchmark::RegisterBenchmark("convert/DateTime", convert, makeValue(OpcUa::DateTime::Current(), 0));
+	benchmark::RegisterBenchmark("nodeName", nodeName);
+	benchmark::RegisterBenchmark("createReading", createReading);
+
+	benchmark::RunSpecifiedBenchmarks();
+	delete fixture;
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <bench_server.h>
+#include <bench_plugin.h>
+#include <latency_proxy.h>
+#include <latency_histogram.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+/**
+ * Discovery benchmark for the plugin. An OPC UA server is started in
+ * process with a synthetic address space of a given shape and size: a
+ * deep hierarchy of objects with a small breadth or a wide, flat folder
+ * of objects. The plugin connects to it through a proxy that adds a
+ * latency to every request, to give the round trip time of a remote
+ * server, and counts the requests by service.
+ *
+ * For each asset naming mode, subscribing both by NodeId and by browsing,
+ * the plugin is started with the initial snapshot enabled and the time
+ * to the first reading and the time until every variable has a reading
+ * are measured, along with the requests the plugin made to the server.
+ *
+ * The results are written to stdout, a JSON object per line for each mode.
+ */
+
+// The asset naming modes of the plugin
+static const vector<string> assetNameTypes = {
+	"NodeId",
+	"BrowseName",
+	"Subscription Path with NodeId",
+	"Subscription Path with BrowseName",
+	"Full Path with NodeId",
+	"Full Path with BrowseName"
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--shape=deep|wide] [--nodes=N] [--variables=M] [--depth=D] [--breadth=B]\n"
+			"\t[--latency=ms] [--subscribe=id|browse|both] [--timeout=seconds] [--port=port]\n", name);
+	exit(1);
+}
+
+/**
+ * Return the number of objects in a tree of a given depth and breadth
+ */
+static size_t treeObjects(int depth, int breadth)
+{
+	size_t objects = 0, level = 1;
+	for (int i = 0; i < depth; i++)
+	{
+		level *= breadth;
+		objects += level;
+	}
+	return objects;
+}
+
+int main(int argc, char **argv)
+{
+	string shape = "wide";
+	long nodes = 10000;
+	int variables = 10;
+	int depth = 0;
+	int breadth = 0;
+	long latency = 0;
+	string subscribe = "both";
+	int timeout = 600;
+	int port = 48400;
+
+	static struct option options[] = {
+		{ "shape", required_argument, NULL, 's' },
+		{ "nodes", required_argument, NULL, 'n' },
+		{ "variables", required_argument, NULL, 'v' },
+		{ "depth", required_argument, NULL, 'D' },
+		{ "breadth", required_argument, NULL, 'b' },
+		{ "latency", required_argument, NULL, 'l' },
+		{ "subscribe", required_argument, NULL, 'S' },
+		{ "timeout", required_argument, NULL, 't' },
+		{ "port", required_argument, NULL, 'p' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 's': shape = optarg; break;
+			case 'n': nodes = atol(optarg); break;
+			case 'v': variables = atoi(optarg); break;
+			case 'D': depth = atoi(optarg); break;
+			case 'b': breadth = atoi(optarg); break;
+			case 'l': latency = atol(optarg); break;
+			case 'S': subscribe = optarg; break;
+			case 't': timeout = atoi(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if ((shape != "deep" && shape != "wide") || nodes <= 0 || variables <= 0 || latency < 0
+			|| (subscribe != "id" && subscribe != "browse" && subscribe != "both"))
+	{
+		usage(argv[0]);
+	}
+
+	// Size the tree so it has at least the number of nodes requested
+	size_t objects = (nodes + variables) / (variables + 1);
+	if (shape == "wide")
+	{
+		depth = depth > 0 ? depth : 1;
+		if (breadth <= 0)
+		{
+			breadth = 1;
+			while (treeObjects(depth, breadth) < objects)
+			{
+				breadth++;
+			}
+		}
+	}
+	else
+	{
+		breadth = breadth > 0 ? breadth : 2;
+		if (depth <= 0)
+		{
+			depth = 1;
+			while (treeObjects(depth, breadth) < objects)
+			{
+				depth++;
+			}
+		}
+	}
+
+	BenchServer server(port);
+	server.start();
+	int64_t built = monotonicTime();
+	objects = server.addTree(depth, breadth, variables);
+	size_t count = server.getVariableCount();
+	fprintf(stderr, "Server %s started with %lu objects and %lu variables in a tree of depth %d, "
+			"breadth %d, built in %ld ms\n", server.getURL().c_str(), (unsigned long)objects,
+			(unsigned long)count, depth, breadth, (long)(monotonicTime() - built));
+
+	LatencyProxy proxy(port + 1, port, latency);
+	proxy.start();
+
+	vector<bool> modes;
+	if (subscribe != "browse")
+	{
+		modes.push_back(true);
+	}
+	if (subscribe != "id")
+	{
+		modes.push_back(false);
+	}
+	for (bool byId : modes)
+	{
+		for (auto& assetNameType : assetNameTypes)
+		{
+			map<string, string> config;
+			config["url"] = proxy.getURL();
+			config["subscribeById"] = byId ? "true" : "false";
+			if (byId)
+			{
+				config["subscription"] = "{ \"subscriptions\" : [ \"ns=" + to_string(server.getNamespace())
+						+ ";s=" + BENCH_ROOT + "\" ] }";
+			}
+			else
+			{
+				config["subscription"] = string("{ \"subscriptions\" : [ \"") + BENCH_ROOT + "\" ] }";
+			}
+			config["assetNameType"] = assetNameType;
+			config["initialSnapshot"] = "true";
+
+			proxy.resetRequests();
+			BenchPlugin plugin(config);
+			int64_t started = monotonicTime();
+			plugin.start();
+			int64_t deadline = started + timeout * 1000;
+			while (plugin.getReadings() < count && monotonicTime() < deadline)
+			{
+				usleep(10000);
+			}
+			int64_t complete = monotonicTime();
+			uint64_t readings = plugin.getReadings();
+			map<string, uint64_t> requests = proxy.getRequests();
+			uint64_t requestCount = proxy.getRequestCount();
+			plugin.shutdown();
+
+			string services;
+			for (auto& request : requests)
+			{
+				if (!services.empty())
+				{
+					services += ", ";
+				}
+				services += "\"" + request.first + "\" : " + to_string(request.second);
+			}
+			printf("{ \"benchmark\" : \"discovery\", \"shape\" : \"%s\", \"depth\" : %d, \"breadth\" : %d, "
+					"\"objects\" : %lu, \"variables\" : %lu, \"latency\" : %ld, "
+					"\"assetNameType\" : \"%s\", \"subscribeById\" : %s, \"complete\" : %s, "
+					"\"readings\" : %lu, \"firstReading\" : %ld, \"allReadings\" : %ld, "
+					"\"requests\" : %lu, \"services\" : { %s } }\n",
+					shape.c_str(), depth, breadth, (unsigned long)objects, (unsigned long)count,
+					latency, assetNameType.c_str(), byId ? "true" : "false",
+					readings >= count ? "true" : "false", (unsigned long)readings,
+					plugin.getFirstReading() ? (long)(plugin.getFirstReading() - started) : -1L,
+					(long)(complete - started), (unsigned long)requestCount, services.c_str());
+			fflush(stdout);
+		}
+	}
+
+	proxy.stop();
+	server.stop();
+	return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <latency_proxy.h>
+#include <latency_histogram.h>
+#include <logger.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+#include <chrono>
+
+// The size of the header of an OPC UA binary message chunk
+#define CHUNK_HEADER	8
+
+// The offset of the request type in a MSG chunk without security
+#define MSG_BODY	24
+
+using namespace std;
+
+/**
+ * The services counted by the proxy, by the numeric NodeId of the
+ * binary encoding of their request
+ */
+static const map<uint32_t, string> services = {
+	{ 428, "GetEndpoints" },
+	{ 461, "CreateSession" },
+	{ 467, "ActivateSession" },
+	{ 473, "CloseSession" },
+	{ 527, "Browse" },
+	{ 533, "BrowseNext" },
+	{ 554, "TranslateBrowsePaths" },
+	{ 631, "Read" },
+	{ 673, "Write" },
+	{ 751, "CreateMonitoredItems" },
+	{ 781, "DeleteMonitoredItems" },
+	{ 787, "CreateSubscription" },
+	{ 793, "ModifySubscription" },
+	{ 826, "Publish" },
+	{ 832, "Republish" },
+	{ 847, "DeleteSubscriptions" }
+};
+
+/**
+ * Write all of a buffer to a socket
+ *
+ * @param fd	The socket
+ * @param data	The data to write
+ * @param len	The length of the data
+ * @return	False if the socket was closed
+ */
+static bool writeAll(int fd, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0)
+		{
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Create a proxy
+ *
+ * @param port		The port of the loopback interface to listen on
+ * @param serverPort	The port of the server on the loopback interface
+ * @param latency	The latency to add to each message, in milliseconds
+ */
+LatencyProxy::LatencyProxy(int port, int serverPort, long latency) : m_port(port),
+	m_serverPort(serverPort), m_latency(latency), m_listener(-1), m_running(false),
+	m_acceptThread(NULL)
+{
+}
+
+/**
+ * Destructor, stops the proxy if it is running
+ */
+LatencyProxy::~LatencyProxy()
+{
+	stop();
+}
+
+/**
+ * Return the URL the plugin should connect to
+ */
+string
+LatencyProxy::getURL() const
+{
+	return "opc.tcp://127.0.0.1:" + to_string(m_port);
+}
+
+/**
+ * Start listening for connections
+ */
+void
+LatencyProxy::start()
+{
+	m_listener = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(m_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::bind(m_listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_listener, 16) < 0)
+	{
+		::close(m_listener);
+		m_listener = -1;
+		throw runtime_error("Unable to listen on port " + to_string(m_port) + ": " + strerror(errno));
+	}
+	m_running = true;
+	m_acceptThread = new thread(&LatencyProxy::acceptThread, this);
+}
+
+/**
+ * Stop listening and close every connection through the proxy
+ */
+void
+LatencyProxy::stop()
+{
+	if (!m_acceptThread)
+	{
+		return;
+	}
+	m_running = false;
+	shutdown(m_listener, SHUT_RDWR);
+	::close(m_listener);
+	m_acceptThread->join();
+	delete m_acceptThread;
+	m_acceptThread = NULL;
+	m_listener = -1;
+	for (auto& connection : m_connections)
+	{
+		delete connection;
+	}
+	m_connections.clear();
+}
+
+/**
+ * Thread that accepts connections and connects each to the server
+ */
+void
+LatencyProxy::acceptThread()
+{
+	while (m_running)
+	{
+		int client = accept(m_listener, NULL, NULL);
+		if (client < 0)
+		{
+			continue;
+		}
+		int server = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(m_serverPort);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(server, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			Logger::getLogger()->error("Proxy unable to connect to port %d: %s",
+					m_serverPort, strerror(errno));
+			::close(server);
+			::close(client);
+			continue;
+		}
+		int on = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		m_connections.push_back(new ProxyConnection(this, client, server));
+	}
+}
+
+/**
+ * Count a request sent to the server
+ *
+ * @param typeId	The numeric NodeId of the encoding of the request
+ */
+void
+LatencyProxy::countRequest(uint32_t typeId)
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_requests[typeId]++;
+}
+
+/**
+ * Return the number of requests sent to the server since the counts were
+ * last reset, by service. Requests of services the proxy does not know
+ * are counted as Other.
+ */
+map<string, uint64_t>
+LatencyProxy::getRequests()
+{
+	lock_guard<mutex> guard(m_mutex);
+	map<string, uint64_t> requests;
+	for (auto& request : m_requests)
+	{
+		auto it = services.find(request.first);
+		requests[it == services.end() ? "Other" : it->second] += request.second;
+	}
+	return requests;
+}
+
+/**
+ * Return the total number of requests sent to the server since the counts
+ * were last reset, other than Publish requests that are made for as long
+ * as the subscription exists.
+ */
+uint64_t
+LatencyProxy::getRequestCount()
+{
+	lock_guard<mutex> guard(m_mutex);
+	uint64_t count = 0;
+	for (auto& request : m_requests)
+	{
+		if (request.first != 826)
+		{
+			count += request.second;
+		}
+	}
+	return count;
+}
+
+/**
+ * Reset the counts of requests
+ */
+void
+LatencyProxy::resetRequests()
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_requests.clear();
+}
+
+/**
+ * Start the threads of a connection through the proxy
+ *
+ * @param proxy		The proxy
+ * @param client	The socket connected to the client
+ * @param server	The socket connected to the server
+ */
+ProxyConnection::ProxyConnection(LatencyProxy *proxy, int client, int server) : m_proxy(proxy),
+	m_client(client), m_server(server), m_closed(false), m_continued(false)
+{
+	m_readThread = new thread(&ProxyConnection::readThread, this);
+	m_sendThread = new thread(&ProxyConnection::sendThread, this);
+	m_replyThread = new thread(&ProxyConnection::replyThread, this);
+}
+
+/**
+ * Destructor, closes the connection and waits for its threads
+ */
+ProxyConnection::~ProxyConnection()
+{
+	close();
+	m_readThread->join();
+	m_sendThread->join();
+	m_replyThread->join();
+	delete m_readThread;
+	delete m_sendThread;
+	delete m_replyThread;
+	::close(m_client);
+	::close(m_server);
+}
+
+/**
+ * Close both sides of the connection, unblocking the threads
+ */
+void
+ProxyConnection::close()
+{
+	{
+		lock_guard<mutex> guard(m_mutex);
+		m_closed = true;
+	}
+	m_cv.notify_all();
+	shutdown(m_client, SHUT_RDWR);
+	shutdown(m_server, SHUT_RDWR);
+}
+
+/**
+ * Thread that reads the message chunks of the client and queues each
+ * with the time it is due to be sent to the server
+ */
+void
+ProxyConnection::readThread()
+{
+	string buffer;
+	char data[65536];
+	ssize_t n;
+	while ((n = recv(m_client, data, sizeof(data), 0)) > 0)
+	{
+		buffer.append(data, n);
+		int64_t due = monotonicTimeMicros() + m_proxy->getLatency() * 1000;
+		while (buffer.length() >= CHUNK_HEADER)
+		{
+			uint32_t size;
+			memcpy(&size, buffer.data() + 4, sizeof(size));	// Little endian, as is the encoding
+			if (size < CHUNK_HEADER || buffer.length() < size)
+			{
+				break;
+			}
+			string chunk = buffer.substr(0, size);
+			buffer.erase(0, size);
+			countMessage(chunk);
+			lock_guard<mutex> guard(m_mutex);
+			m_queue.push_back(make_pair(due, chunk));
+			m_cv.notify_all();
+		}
+	}
+	close();
+}
+
+/**
+ * Thread that sends the queued chunks to the server when they are due
+ */
+void
+ProxyConnection::sendThread()
+{
+	unique_lock<mutex> lck(m_mutex);
+	while (!m_closed)
+	{
+		if (m_queue.empty())
+		{
+			m_cv.wait(lck);
+			continue;
+		}
+		int64_t wait = m_queue.front().first - monotonicTimeMicros();
+		if (wait > 0)
+		{
+			m_cv.wait_for(lck, chrono::microseconds(wait));
+			continue;
+		}
+		string chunk = m_queue.front().second;
+		m_queue.pop_front();
+		lck.unlock();
+		bool sent = writeAll(m_server, chunk.data(), chunk.length());
+		lck.lock();
+		if (!sent)
+		{
+			break;
+		}
+	}
+	lck.unlock();
+	close();
+}
+
+/**
+ * Thread that returns the responses of the server to the client
+ */
+void
+ProxyConnection::replyThread()
+{
+	char data[65536];
+	ssize_t n;
+	while ((n = recv(m_server, data, sizeof(data), 0)) > 0)
+	{
+		if (!writeAll(m_client, data, n))
+		{
+			break;
+		}
+	}
+	close();
+}
+
+/**
+ * Count the request a message chunk carries. Only the first chunk of a
+ * message has the request type, which is encoded as a NodeId at the start
+ * of the body of the message.
+ *
+ * @param chunk	The message chunk
+ */
+void
+ProxyConnection::countMessage(const string& chunk)
+{
+	if (chunk.compare(0, 3, "MSG") != 0)
+	{
+		return;
+	}
+	bool first = !m_continued;
+	m_continued = chunk[3] == 'C';
+	if (!first || chunk.length() < MSG_BODY + 4)
+	{
+		return;
+	}
+	const unsigned char *body = (const unsigned char *)chunk.data() + MSG_BODY;
+	uint32_t typeId;
+	switch (body[0])
+	{
+		case 0x00:	// Two byte NodeId
+			typeId = body[1];
+			break;
+		case 0x01:	// Four byte NodeId
+			typeId = body[2] | (body[3] << 8);
+			break;
+		case 0x02:	// Numeric NodeId
+			if (chunk.length() < MSG_BODY + 7)
+			{
+				return;
+			}
+			typeId = body[3] | (body[4] << 8) | (body[5] << 16) | ((uint32_t)body[6] << 24);
+			break;
+		default:
+			typeId = 0;
+			break;
+	}
+	m_proxy->countRequest(typeId);
+}
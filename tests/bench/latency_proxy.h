@@ -0,0 +1,92 @@
+#ifndef _LATENCY_PROXY_H
+#define _LATENCY_PROXY_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class ProxyConnection;
+
+/**
+ * A TCP proxy placed between the plugin and the benchmark server that
+ * delays every message from the client by a fixed latency, to give the
+ * round trip time of a remote server. Messages are delayed independently
+ * of each other, so requests the client pipelines stay pipelined.
+ *
+ * The proxy decodes the header of each OPC UA binary message it passes
+ * to the server and counts the requests by service. Only messages of a
+ * secure channel without security can be decoded.
+ */
+class LatencyProxy
+{
+	public:
+		LatencyProxy(int port, int serverPort, long latency);
+		~LatencyProxy();
+		std::string	getURL() const;
+		void		start();
+		void		stop();
+		std::map<std::string, uint64_t>
+				getRequests();
+		uint64_t	getRequestCount();
+		void		resetRequests();
+		void		countRequest(uint32_t typeId);
+		long		getLatency() const { return m_latency; };
+
+	private:
+		void				acceptThread();
+		int				m_port;
+		int				m_serverPort;
+		long				m_latency;
+		int				m_listener;
+		std::atomic<bool>		m_running;
+		std::thread			*m_acceptThread;
+		std::vector<ProxyConnection *>	m_connections;
+		std::mutex			m_mutex;
+		std::map<uint32_t, uint64_t>	m_requests;
+};
+
+/**
+ * A connection through the proxy. One thread reads the messages of the
+ * client and queues them with the time they are due to be sent, another
+ * sends them to the server when they are due and a third returns the
+ * responses of the server to the client undelayed.
+ */
+class ProxyConnection
+{
+	public:
+		ProxyConnection(LatencyProxy *proxy, int client, int server);
+		~ProxyConnection();
+		void		close();
+
+	private:
+		void				readThread();
+		void				sendThread();
+		void				replyThread();
+		void				countMessage(const std::string& chunk);
+		LatencyProxy			*m_proxy;
+		int				m_client;
+		int				m_server;
+		bool				m_closed;
+		bool				m_continued;
+		std::deque<std::pair<int64_t, std::string> >
+						m_queue;
+		std::mutex			m_mutex;
+		std::condition_variable		m_cv;
+		std::thread			*m_readThread;
+		std::thread			*m_sendThread;
+		std::thread			*m_replyThread;
+};
+#endif
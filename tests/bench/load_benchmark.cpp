@@ -0,0 +1,142 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <bench_server.h>
+#include <bench_plugin.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <map>
+
+using namespace std;
+
+/**
+ * Load benchmark for the plugin. An OPC UA server is started in process
+ * with an address space of a number of objects each with a number of
+ * variables, whose values it changes at a given rate. The plugin is
+ * subscribed to every variable and the readings it ingests are counted.
+ *
+ * The benchmark reports the sustained rate of readings ingested, the CPU
+ * time used by the plugin per reading and the percentiles of the time
+ * from a value being changed to its reading being ingested. The CPU time
+ * of the server changing the values is measured before the plugin is
+ * started and deducted.
+ *
+ * The results are written to stdout as a single JSON object.
+ */
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--objects=N] [--variables=M] [--rate=changes/s] [--arrays]\n"
+			"\t[--duration=seconds] [--warmup=seconds] [--port=port] [--interval=ms]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int objects = 100;
+	int variables = 10;
+	long rate = 10000;
+	bool arrays = false;
+	int duration = 30;
+	int warmup = 5;
+	int port = 48400;
+	string interval = "100";
+
+	static struct option options[] = {
+		{ "objects", required_argument, NULL, 'o' },
+		{ "variables", required_argument, NULL, 'v' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "arrays", no_argument, NULL, 'a' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "warmup", required_argument, NULL, 'w' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'o': objects = atoi(optarg); break;
+			case 'v': variables = atoi(optarg); break;
+			case 'r': rate = atol(optarg); break;
+			case 'a': arrays = true; break;
+			case 'd': duration = atoi(optarg); break;
+			case 'w': warmup = atoi(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			case 'i': interval = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (objects <= 0 || variables <= 0 || rate <= 0 || duration <= 0)
+	{
+		usage(argv[0]);
+	}
+
+	BenchServer server(port);
+	server.start();
+	server.addObjects(objects, variables, arrays);
+	fprintf(stderr, "Server %s started with %d variables\n", server.getURL().c_str(),
+			(int)server.getVariableCount());
+
+	// Measure the CPU time used by the server alone to change the values
+	server.startChanges(rate);
+	sleep(warmup);
+	int64_t cpuStart = cpuTimeMicros();
+	uint64_t changesStart = server.getChanges();
+	sleep(duration);
+	double serverCpuPerChange = (double)(cpuTimeMicros() - cpuStart) / (server.getChanges() - changesStart);
+	server.stopChanges();
+	fprintf(stderr, "Server uses %.2f us CPU per change\n", serverCpuPerChange);
+
+	map<string, string> config;
+	config["url"] = server.getURL();
+	config["subscribeById"] = "true";
+	config["subscription"] = "{ \"subscriptions\" : [ \"ns=" + to_string(server.getNamespace())
+			+ ";s=" + BENCH_ROOT + "\" ] }";
+	config["reportingInterval"] = interval;
+	config["initialSnapshot"] = "false";
+	BenchPlugin plugin(config);
+	plugin.start();
+
+	// Wait for the readings to start flowing, then measure the steady state
+	server.startChanges(rate);
+	sleep(warmup);
+	plugin.getLatency().reset();
+	uint64_t readingsStart = plugin.getReadings();
+	changesStart = server.getChanges();
+	cpuStart = cpuTimeMicros();
+	int64_t wallStart = wallTimeMicros();
+	sleep(duration);
+	uint64_t readings = plugin.getReadings() - readingsStart;
+	uint64_t changes = server.getChanges() - changesStart;
+	double elapsed = (wallTimeMicros() - wallStart) / 1000000.0;
+	double cpu = cpuTimeMicros() - cpuStart - serverCpuPerChange * changes;
+	LatencyHistogram& latency = plugin.getLatency();
+
+	server.stopChanges();
+	plugin.shutdown();
+	server.stop();
+
+	printf("{ \"benchmark\" : \"load\", \"objects\" : %d, \"variables\" : %d, \"arrays\" : %s, "
+			"\"rate\" : %ld, \"interval\" : %s, \"duration\" : %.1f, "
+			"\"changes\" : %lu, \"readings\" : %lu, \"readingsPerSecond\" : %.1f, "
+			"\"cpuPerReading\" : %.2f, \"latencyP50\" : %.3f, \"latencyP99\" : %.3f, "
+			"\"latencyP999\" : %.3f, \"latencyMax\" : %.3f }\n",
+			objects, variables, arrays ? "true" : "false", rate, interval.c_str(), elapsed,
+			(unsigned long)changes, (unsigned long)readings, readings / elapsed,
+			readings ? cpu / readings : 0.0,
+			latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0,
+			latency.percentile(99.9) / 1000.0, latency.max() / 1000.0);
+	return 0;
+}
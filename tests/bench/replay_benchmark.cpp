@@ -0,0 +1,112 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <opcua.h>
+#include <capture.h>
+#include <bench_plugin.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <atomic>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * Replay benchmark for the plugin. The data change notifications recorded
+ * by the plugin to a capture file are fed through the data change
+ * handling of the plugin, with no server or network, and the readings
+ * ingested are counted. The notifications are replayed as fast as
+ * possible or with the timing they were received with, so the conversion
+ * and ingest of real traffic can be profiled on any machine.
+ *
+ * The results are written to stdout as a single JSON object.
+ */
+
+static atomic<uint64_t> readings(0);
+
+/**
+ * The ingest callback, counts the readings
+ */
+static void ingest(void *data, Reading reading)
+{
+	readings++;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s --capture=file [--realtime] [--repeat=N] [--asset=prefix] [--threads=N]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	string capture;
+	bool realTime = false;
+	int repeat = 1;
+	string asset = "opcua";
+	int threads = 0;
+
+	static struct option options[] = {
+		{ "capture", required_argument, NULL, 'c' },
+		{ "realtime", no_argument, NULL, 'r' },
+		{ "repeat", required_argument, NULL, 'n' },
+		{ "asset", required_argument, NULL, 'a' },
+		{ "threads", required_argument, NULL, 't' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': capture = optarg; break;
+			case 'r': realTime = true; break;
+			case 'n': repeat = atoi(optarg); break;
+			case 'a': asset = optarg; break;
+			case 't': threads = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (capture.empty() || repeat <= 0 || threads < 0)
+	{
+		usage(argv[0]);
+	}
+
+	try {
+		CaptureReader reader(capture);
+		OPCUA opcua("");
+		opcua.setAssetName(asset);
+		opcua.registerIngest(NULL, ingest);
+		opcua.setConversionThreads(threads);
+
+		uint64_t notifications = 0;
+		int64_t wallStart = wallTimeMicros();
+		int64_t cpuStart = cpuTimeMicros();
+		for (int i = 0; i < repeat; i++)
+		{
+			reader.rewind();
+			notifications += opcua.replay(reader, realTime);
+		}
+		double elapsed = (wallTimeMicros() - wallStart) / 1000000.0;
+		double cpu = cpuTimeMicros() - cpuStart;
+
+		printf("{ \"benchmark\" : \"replay\", \"capture\" : \"%s\", \"realtime\" : %s, \"repeat\" : %d, \"threads\" : %d, "
+				"\"duration\" : %.3f, \"notifications\" : %lu, \"readings\" : %lu, "
+				"\"notificationsPerSecond\" : %.1f, \"cpuPerNotification\" : %.2f }\n",
+				capture.c_str(), realTime ? "true" : "false", repeat, threads, elapsed,
+				(unsigned long)notifications, (unsigned long)readings.load(),
+				notifications / elapsed, notifications ? cpu / notifications : 0.0);
+	} catch (exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <bench_server.h>
+#include <bench_plugin.h>
+#include <latency_histogram.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <map>
+#include <memory>
+
+using namespace std;
+
+/**
+ * Soak test of the plugin being reconfigured and restarted. An OPC UA
+ * server is started in process and the plugin is alternately
+ * reconfigured and shut down and started again, thousands of times,
+ * waiting each time for readings to flow again. The resident set size
+ * of the process is measured once the allocators have warmed up and
+ * again at the end; the test fails if it has grown by more than a limit.
+ *
+ * The results are written to stdout as a single JSON object and the exit
+ * status is 0 if the test passed.
+ */
+
+/**
+ * Return the resident set size of the process in bytes
+ */
+static long residentSetSize()
+{
+	long pages = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp)
+	{
+		if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+		{
+			resident = 0;
+		}
+		fclose(fp);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--cycles=N] [--warmup=N] [--objects=N] [--variables=M]\n"
+			"\t[--max-growth=MB] [--timeout=ms] [--port=port]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int cycles = 2000;
+	int warmup = 100;
+	int objects = 10;
+	int variables = 10;
+	long maxGrowth = 16;
+	long timeout = 10000;
+	int port = 48400;
+
+	static struct option options[] = {
+		{ "cycles", required_argument, NULL, 'c' },
+		{ "warmup", required_argument, NULL, 'w' },
+		{ "objects", required_argument, NULL, 'o' },
+		{ "variables", required_argument, NULL, 'v' },
+		{ "max-growth", required_argument, NULL, 'g' },
+		{ "timeout", required_argument, NULL, 't' },
+		{ "port", required_argument, NULL, 'p' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': cycles = atoi(optarg); break;
+			case 'w': warmup = atoi(optarg); break;
+			case 'o': objects = atoi(optarg); break;
+			case 'v': variables = atoi(optarg); break;
+			case 'g': maxGrowth = atol(optarg); break;
+			case 't': timeout = atol(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (cycles <= 0 || warmup < 0 || warmup >= cycles || objects <= 0 || variables <= 0)
+	{
+		usage(argv[0]);
+	}
+
+	BenchServer server(port);
+	server.start();
+	server.addObjects(objects, variables, false);
+
+	map<string, string> config;
+	config["url"] = server.getURL();
+	config["subscribeById"] = "true";
+	config["subscription"] = "{ \"subscriptions\" : [ \"ns=" + to_string(server.getNamespace())
+			+ ";s=" + BENCH_ROOT + "\" ] }";
+	config["initialSnapshot"] = "true";
+	config["reportingInterval"] = "100";
+
+	unique_ptr<BenchPlugin> plugin(new BenchPlugin(config));
+	plugin->start();
+
+	long baseline = 0, peak = 0;
+	int timeouts = 0;
+	int64_t started = monotonicTime();
+	for (int cycle = 0; cycle < cycles; cycle++)
+	{
+		// The count of readings is taken before the plugin subscribes
+		// again, as the initial values may arrive straight away
+		uint64_t readings = 0;
+		if (cycle % 2 == 0)
+		{
+			// Change the reporting interval so the reconfiguration is real
+			config["reportingInterval"] = (cycle % 4 == 0) ? "200" : "100";
+			readings = plugin->getReadings();
+			plugin->reconfigure(config);
+		}
+		else
+		{
+			plugin.reset();
+			plugin.reset(new BenchPlugin(config));
+			plugin->start();
+		}
+		int64_t deadline = monotonicTime() + timeout;
+		while (plugin->getReadings() == readings && monotonicTime() < deadline)
+		{
+			usleep(1000);
+		}
+		if (plugin->getReadings() == readings)
+		{
+			timeouts++;
+		}
+
+		long rss = residentSetSize();
+		if (cycle == warmup)
+		{
+			baseline = rss;
+		}
+		if (cycle >= warmup && rss > peak)
+		{
+			peak = rss;
+		}
+		if ((cycle + 1) % 100 == 0)
+		{
+			fprintf(stderr, "%d cycles, RSS %ld kB\n", cycle + 1, rss / 1024);
+		}
+	}
+	double elapsed = (monotonicTime() - started) / 1000.0;
+	plugin.reset();
+	long remaining = residentSetSize();
+	server.stop();
+
+	long growth = peak - baseline;
+	bool passed = growth <= maxGrowth * 1024 * 1024 && timeouts == 0;
+	printf("{ \"benchmark\" : \"soak\", \"cycles\" : %d, \"warmup\" : %d, \"duration\" : %.1f, "
+			"\"baselineRSS\" : %ld, \"peakRSS\" : %ld, \"finalRSS\" : %ld, \"growth\" : %ld, "
+			"\"maxGrowth\" : %ld, \"timeouts\" : %d, \"passed\" : %s }\n",
+			cycles, warmup, elapsed, baseline, peak, remaining, growth,
+			maxGrowth * 1024 * 1024, timeouts, passed ? "true" : "false");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <capture.h>
+#include <opcua.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <atomic>
+
+using namespace std;
+
+TEST(Capture, RoundTrip)
+{
+	char path[] = "/tmp/captureXXXXXX";
+	close(mkstemp(path));
+	OpcUa::DateTime ts = OpcUa::DateTime::Current();
+	OpcUa::DataValue first(OpcUa::Variant(1.5));
+	first.SetSourceTimestamp(ts);
+	OpcUa::DataValue second(OpcUa::Variant(string("running")));
+	second.SetSourceTimestamp(ts);
+
+	NotificationCapture capture;
+	capture.open(path);
+	ASSERT_TRUE(capture.isOpen());
+	capture.record(1, OpcUa::NodeId("Temperature", 2), "line1/Temperature", first, false);
+	capture.record(2, OpcUa::NodeId(1042, 2), "line1/State", second, true);
+	capture.record(1, OpcUa::NodeId("Temperature", 2), "line1/Temperature", first, false);
+	ASSERT_EQ(capture.getRecorded(), 3);
+	capture.close();
+	ASSERT_FALSE(capture.isOpen());
+
+	CaptureReader reader(path);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		CapturedNotification notification;
+		ASSERT_TRUE(reader.next(notification));
+		ASSERT_EQ(notification.handle, 1);
+		ASSERT_TRUE(notification.nodeId == OpcUa::NodeId("Temperature", 2));
+		ASSERT_EQ(notification.assetPath, "line1/Temperature");
+		ASSERT_FALSE(notification.critical);
+		ASSERT_EQ(static_cast<double>(notification.value.Value), 1.5);
+		ASSERT_EQ(static_cast<int64_t>(notification.value.SourceTimestamp), static_cast<int64_t>(ts));
+
+		ASSERT_TRUE(reader.next(notification));
+		ASSERT_EQ(notification.handle, 2);
+		ASSERT_TRUE(notification.nodeId == OpcUa::NodeId(1042, 2));
+		ASSERT_EQ(notification.assetPath, "line1/State");
+		ASSERT_TRUE(notification.critical);
+		ASSERT_EQ(static_cast<string>(notification.value.Value), "running");
+
+		ASSERT_TRUE(reader.next(notification));
+		ASSERT_EQ(notification.assetPath, "line1/Temperature");
+		ASSERT_FALSE(reader.next(notification));
+		reader.rewind();
+	}
+	unlink(path);
+}
+
+TEST(Capture, NotACapture)
+{
+	char path[] = "/tmp/captureXXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_EQ(write(fd, "nodeid,name\n", 12), 12);
+	close(fd);
+	ASSERT_THROW(CaptureReader reader(path), runtime_error);
+	unlink(path);
+}
+
+static atomic<int> replayedReadings(0);
+
+static void countReading(void *data, Reading reading)
+{
+	replayedReadings++;
+}
+
+TEST(Capture, ReplayBrowseName)
+{
+	char path[] = "/tmp/captureXXXXXX";
+	close(mkstemp(path));
+	NotificationCapture capture;
+	capture.open(path);
+	OpcUa::DataValue value(OpcUa::Variant(1.5));
+	value.SetSourceTimestamp(OpcUa::DateTime::Current());
+	capture.record(1, OpcUa::NodeId("Temperature", 2), "line1/Temperature", value, false);
+	capture.record(1, OpcUa::NodeId("Temperature", 2), "line1/Temperature", value, false);
+	capture.close();
+
+	// The variables have no session, so their browse names can not be read
+	CaptureReader reader(path);
+	OPCUA opcua("");
+	opcua.setAssetNameSource("Full Path with BrowseName");
+	opcua.registerIngest(NULL, countReading);
+	replayedReadings = 0;
+	ASSERT_EQ(opcua.replay(reader, false), 2);
+	ASSERT_EQ(replayedReadings, 2);
+	unlink(path);
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <opcua.h>
+#include <capture.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+#define VARIABLES	16
+#define VALUES		500
+
+static map<string, vector<double> > received;
+static mutex receivedMutex;
+
+// Called by the threads of both ingest queues
+static void ingest(void *data, Reading reading)
+{
+	vector<Datapoint *> points = reading.getReadingData();
+	lock_guard<mutex> guard(receivedMutex);
+	received[reading.getAssetName()].push_back(points[0]->getData().toDouble());
+}
+
+/**
+ * Replay the values of a set of variables through the conversion threads
+ * and check each variable's readings are ingested in order
+ */
+TEST(ConversionPool, Ordered)
+{
+	char path[] = "/tmp/captureXXXXXX";
+	close(mkstemp(path));
+	NotificationCapture capture;
+	capture.open(path);
+	for (int value = 0; value < VALUES; value++)
+	{
+		for (uint32_t i = 0; i < VARIABLES; i++)
+		{
+			OpcUa::DataValue dval(OpcUa::Variant((double)value));
+			dval.SetSourceTimestamp(OpcUa::DateTime::Current());
+			capture.record(i + 1, OpcUa::NodeId("Variable" + to_string(i), 2),
+					"Variable" + to_string(i), dval, i % 4 == 0);
+		}
+	}
+	capture.close();
+
+	received.clear();
+	CaptureReader reader(path);
+	OPCUA opcua("");
+	opcua.setAssetName("pool");
+	opcua.registerIngest(NULL, ingest);
+	opcua.setConversionThreads(4);
+	ASSERT_EQ(opcua.replay(reader, false), VARIABLES * VALUES);
+	ASSERT_FALSE(opcua.isConverting());
+
+	ASSERT_EQ(received.size(), VARIABLES);
+	for (auto& variable : received)
+	{
+		ASSERT_EQ(variable.second.size(), VALUES);
+		for (int value = 0; value < VALUES; value++)
+		{
+			ASSERT_EQ(variable.second[value], value);
+		}
+	}
+	unlink(path);
+}
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <latency_histogram.h>
+
+using namespace std;
+
+TEST(LatencyHistogram, Empty)
+{
+	LatencyHistogram histogram;
+	ASSERT_EQ(histogram.count(), 0);
+	ASSERT_EQ(histogram.percentile(99), 0);
+	ASSERT_EQ(histogram.max(), 0);
+}
+
+TEST(LatencyHistogram, Percentiles)
+{
+	LatencyHistogram histogram;
+	for (int i = 1; i <= 1000; i++)
+	{
+		histogram.record(i * 100);
+	}
+	ASSERT_EQ(histogram.count(), 1000);
+	ASSERT_EQ(histogram.max(), 100000);
+	// Buckets are within 1/16 of the value they hold
+	ASSERT_NEAR(histogram.percentile(50), 50000, 50000 / 16);
+	ASSERT_NEAR(histogram.percentile(99), 99000, 99000 / 16);
+	ASSERT_EQ(histogram.percentile(100), 100000);
+}
+
+TEST(LatencyHistogram, Reset)
+{
+	LatencyHistogram histogram;
+	histogram.record(5);
+	histogram.record(12345678);
+	ASSERT_EQ(histogram.count(), 2);
+	ASSERT_EQ(histogram.percentile(50), 5);
+	histogram.reset();
+	ASSERT_EQ(histogram.count(), 0);
+	ASSERT_EQ(histogram.max(), 0);
+}
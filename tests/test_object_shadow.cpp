@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <object_shadow.h>
+#include <map>
+
+using namespace std;
+
+static Reading *makeReading(const string& asset, const string& name, long value, long seconds)
+{
+	DatapointValue dpv(value);
+	Reading *reading = new Reading(asset, new Datapoint(name, dpv));
+	struct timeval tm = { seconds, 0 };
+	reading->setUserTimestamp(tm);
+	return reading;
+}
+
+static Datapoint *find(vector<Datapoint *>& points, const string& name)
+{
+	for (auto point : points)
+	{
+		if (point->getName() == name)
+			return point;
+	}
+	return NULL;
+}
+
+static void freeReadings(vector<Reading *>& readings)
+{
+	for (auto reading : readings)
+		delete reading;
+	readings.clear();
+}
+
+TEST(ObjectShadow, Nested)
+{
+	ObjectShadow shadow;
+	ASSERT_FALSE(shadow.isEnabled());
+	shadow.configure(2, "/", false);
+	ASSERT_TRUE(shadow.isEnabled());
+	shadow.update(makeReading("Line1/Press1/Hydraulics/Pressure", "Pressure", 182, 100));
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1200, 101));
+	shadow.update(makeReading("Line1/Press2/Speed", "Speed", 900, 100));
+	ASSERT_EQ(shadow.getObjects(), 2);
+
+	vector<Reading *> readings;
+	shadow.flush(readings);
+	ASSERT_EQ(readings.size(), 2);
+	ASSERT_EQ(readings[0]->getAssetName(), "Line1/Press1");
+	struct timeval tm;
+	readings[0]->getUserTimestamp(&tm);
+	ASSERT_EQ(tm.tv_sec, 101);
+	vector<Datapoint *> points = readings[0]->getReadingData();
+	ASSERT_EQ(points.size(), 2);
+	Datapoint *speed = find(points, "Speed");
+	ASSERT_TRUE(speed != NULL);
+	ASSERT_EQ(speed->getData().toInt(), 1200);
+	Datapoint *hydraulics = find(points, "Hydraulics");
+	ASSERT_TRUE(hydraulics != NULL);
+	ASSERT_EQ(hydraulics->getData().getType(), DatapointValue::T_DP_DICT);
+	vector<Datapoint *> *children = hydraulics->getData().getDpVec();
+	ASSERT_EQ(children->size(), 1);
+	ASSERT_EQ((*children)[0]->getName(), "Pressure");
+	ASSERT_EQ((*children)[0]->getData().toInt(), 182);
+	freeReadings(readings);
+
+	// Nothing has changed
+	shadow.flush(readings);
+	ASSERT_EQ(readings.size(), 0);
+}
+
+TEST(ObjectShadow, ChangedValues)
+{
+	ObjectShadow shadow;
+	shadow.configure(1, "/", false);
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1200, 100));
+	shadow.update(makeReading("Line1/Press1/Temperature", "Temperature", 40, 100));
+	vector<Reading *> readings;
+	shadow.flush(readings);
+	freeReadings(readings);
+
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1100, 102));
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1000, 103));
+	shadow.flush(readings);
+	ASSERT_EQ(readings.size(), 1);
+	vector<Datapoint *> points = readings[0]->getReadingData();
+	ASSERT_EQ(points.size(), 1);
+	ASSERT_EQ(points[0]->getName(), "Press1");
+	vector<Datapoint *> *children = points[0]->getData().getDpVec();
+	ASSERT_EQ(children->size(), 1);
+	ASSERT_EQ((*children)[0]->getName(), "Speed");
+	ASSERT_EQ((*children)[0]->getData().toInt(), 1000);
+	freeReadings(readings);
+}
+
+TEST(ObjectShadow, FullObject)
+{
+	ObjectShadow shadow;
+	shadow.configure(2, "/", true);
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1200, 100));
+	shadow.update(makeReading("Line1/Press1/Temperature", "Temperature", 40, 100));
+	vector<Reading *> readings;
+	shadow.flush(readings);
+	freeReadings(readings);
+
+	shadow.update(makeReading("Line1/Press1/Speed", "Speed", 1100, 102));
+	shadow.flush(readings);
+	ASSERT_EQ(readings.size(), 1);
+	vector<Datapoint *> points = readings[0]->getReadingData();
+	ASSERT_EQ(points.size(), 2);
+	ASSERT_EQ(find(points, "Speed")->getData().toInt(), 1100);
+	ASSERT_EQ(find(points, "Temperature")->getData().toInt(), 40);
+	freeReadings(readings);
+
+	// Changing the level discards the values held
+	shadow.configure(1, "/", true);
+	ASSERT_EQ(shadow.getObjects(), 0);
+}
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <opcua.h>
+#include <capture.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+
+using namespace std;
+
+/**
+ * Return the Value attribute of a variable
+ */
+static OpcUa::ReadValueId valueOf(const OpcUa::NodeId& nodeId)
+{
+	OpcUa::ReadValueId item;
+	item.NodeId = nodeId;
+	item.AttributeId = OpcUa::AttributeId::Value;
+	return item;
+}
+
+/**
+ * The initial value of a variable is received twice, by the snapshot
+ * and by the first notification of its monitored item, and only the
+ * first to arrive is reported unless the value changed in between
+ */
+TEST(Server, InitialValues)
+{
+	OPCUA opcua("");
+	OPCUAServer server(&opcua, "initial");
+	OpcUa::NodeId temperature("Temperature", 2), pressure("Pressure", 2), level("Level", 2);
+	OpcUa::DateTime first(130000000000000000LL), later(130000000010000000LL);
+
+	// Nothing is filtered until a snapshot is expected
+	ASSERT_FALSE(server.isInitialValue(temperature, first));
+	ASSERT_FALSE(server.isInitialValue(temperature, first));
+
+	server.expectInitialValues({ valueOf(temperature), valueOf(pressure) });
+
+	// The second arrival of the same value is a duplicate
+	ASSERT_FALSE(server.isInitialValue(temperature, first));
+	ASSERT_TRUE(server.isInitialValue(temperature, first));
+
+	// A value that changed between the two is reported
+	ASSERT_FALSE(server.isInitialValue(pressure, first));
+	ASSERT_FALSE(server.isInitialValue(pressure, later));
+
+	// Once both have arrived the values that follow are reported
+	ASSERT_FALSE(server.isInitialValue(temperature, first));
+	ASSERT_FALSE(server.isInitialValue(pressure, later));
+
+	// Variables that were not expected are not filtered
+	server.expectInitialValues({ valueOf(level) });
+	ASSERT_FALSE(server.isInitialValue(temperature, first));
+	ASSERT_FALSE(server.isInitialValue(level, first));
+	ASSERT_TRUE(server.isInitialValue(level, first));
+}
+
+/**
+ * Values to write are matched to the variables of a server by NodeId,
+ * asset path or asset name; without a session the matched values fail
+ * with BadNotConnected and the others are left for the other servers
+ */
+TEST(Server, WriteNotConnected)
+{
+	OPCUA opcua("");
+	OPCUAServer server(&opcua, "write");
+	server.setAssetPath(OpcUa::NodeId("Temperature", 2), "line1/Temperature");
+	server.setAssetPath(OpcUa::NodeId(1042, 2), "line1/State");
+
+	vector<pair<string, string> > values = {
+		{ "opcualine1/Temperature", "21.5" },
+		{ "line1/State", "1" },
+		{ "ns=2;s=Temperature", "22.0" },
+		{ "line2/Temperature", "19.0" },
+		{ "ns=2;i=1043", "0" }
+	};
+	vector<OpcUa::StatusCode> status(values.size(), OpcUa::StatusCode::BadNodeIdUnknown);
+	vector<bool> resolved(values.size(), false);
+	ASSERT_EQ(server.writeValues(values, "opcua", status, resolved), 3);
+	for (size_t i = 0; i < 3; i++)
+	{
+		ASSERT_TRUE(resolved[i]);
+		ASSERT_TRUE(status[i] == OpcUa::StatusCode::BadNotConnected);
+	}
+	for (size_t i = 3; i < values.size(); i++)
+	{
+		ASSERT_FALSE(resolved[i]);
+		ASSERT_TRUE(status[i] == OpcUa::StatusCode::BadNodeIdUnknown);
+	}
+
+	// Values already resolved by another server are not matched again
+	ASSERT_EQ(server.writeValues(values, "opcua", status, resolved), 0);
+}
+
+static atomic<int> ingestedReadings(0);
+
+static void countReading(void *data, Reading reading)
+{
+	ingestedReadings++;
+}
+
+/**
+ * The notifications received from a standby server keep it known to be
+ * alive but are neither recorded nor ingested
+ */
+TEST(Server, StandbyNotIngested)
+{
+	char path[] = "/tmp/captureXXXXXX";
+	close(mkstemp(path));
+	OPCUA opcua("");
+	opcua.setCaptureFile(path);
+	OPCUAServer server(&opcua, "standby");
+	OpcUa::NodeId temperature("Temperature", 2);
+	server.setAssetPath(temperature, "line1/Temperature");
+	OpcUaClient client(&opcua, &server, false);
+	OpcUa::Node node(OpcUa::Services::SharedPtr(), temperature);
+
+	OpcUa::DataValue value(OpcUa::Variant(1.5));
+	value.SetSourceTimestamp(OpcUa::DateTime::Current());
+	server.setActive(false);
+	client.DataValueChange(1, node, value, OpcUa::AttributeId::Value);
+	client.DataValueChange(1, node, value, OpcUa::AttributeId::Value);
+	server.setActive(true);
+	client.DataValueChange(1, node, value, OpcUa::AttributeId::Value);
+	opcua.setCaptureFile("");
+
+	CaptureReader reader(path);
+	OPCUA replay("");
+	replay.registerIngest(NULL, countReading);
+	ingestedReadings = 0;
+	ASSERT_EQ(replay.replay(reader, false), 1);
+	ASSERT_EQ(ingestedReadings, 1);
+	unlink(path);
+}
+
+/**
+ * Values read when a standby server is made active are only reported
+ * if they are newer than the last value reported for their variable
+ */
+TEST(Server, ReportedValues)
+{
+	OPCUA opcua("");
+	OPCUAServer server(&opcua, "reported");
+	OpcUa::NodeId temperature("Temperature", 2), pressure("Pressure", 2);
+	OpcUa::DateTime first(130000000000000000LL), later(130000000010000000LL);
+
+	ASSERT_FALSE(server.isReported(temperature, first));
+	server.updateTimestamp(temperature, first);
+	ASSERT_TRUE(server.isReported(temperature, first));
+	ASSERT_FALSE(server.isReported(temperature, later));
+	ASSERT_FALSE(server.isReported(pressure, first));
+
+	// Changing role without a session only changes the role
+	server.setActive(false);
+	ASSERT_FALSE(server.isActive());
+	server.setActive(true);
+	ASSERT_TRUE(server.isActive());
+}
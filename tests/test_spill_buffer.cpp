@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <spill_buffer.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace std;
+
+// The readings all serialize to the same size
+static string label(long value)
+{
+	char buf[20];
+	snprintf(buf, sizeof(buf), "value%06ld", value);
+	return string(buf);
+}
+
+static Reading *makeReading(long value)
+{
+	vector<Datapoint *> points;
+	DatapointValue vInt(value), vFloat(value + 0.5), vString(label(value));
+	points.push_back(new Datapoint("int", vInt));
+	points.push_back(new Datapoint("float", vFloat));
+	points.push_back(new Datapoint("string", vString));
+	Reading *reading = new Reading("spill", points);
+	struct timeval tm = { 1600000000 + value, 250 };
+	reading->setUserTimestamp(tm);
+	return reading;
+}
+
+static void checkReading(Reading *reading, long value)
+{
+	ASSERT_TRUE(reading != NULL);
+	ASSERT_EQ(reading->getAssetName(), "spill");
+	struct timeval tm;
+	reading->getUserTimestamp(&tm);
+	ASSERT_EQ(tm.tv_sec, 1600000000 + value);
+	ASSERT_EQ(tm.tv_usec, 250);
+	vector<Datapoint *> points = reading->getReadingData();
+	ASSERT_EQ(points.size(), 3);
+	ASSERT_EQ(points[0]->getName(), "int");
+	ASSERT_EQ(points[0]->getData().toInt(), value);
+	ASSERT_EQ(points[1]->getData().toDouble(), value + 0.5);
+	ASSERT_EQ(points[2]->getData().toStringValue(), label(value));
+}
+
+static bool spill(SpillBuffer& buffer, long value)
+{
+	Reading *reading = makeReading(value);
+	bool written = buffer.write(reading);
+	delete reading;
+	return written;
+}
+
+static void unspill(SpillBuffer& buffer, long value)
+{
+	Reading *reading = buffer.read();
+	checkReading(reading, value);
+	delete reading;
+}
+
+TEST(SpillBuffer, RoundTrip)
+{
+	char path[] = "/tmp/spillXXXXXX";
+	close(mkstemp(path));
+	SpillBuffer buffer;
+	buffer.open(path, 4096, true);
+	ASSERT_TRUE(buffer.isEmpty());
+	for (long i = 0; i < 10; i++)
+	{
+		ASSERT_TRUE(spill(buffer, i));
+	}
+	ASSERT_EQ(buffer.getCount(), 10);
+	for (long i = 0; i < 10; i++)
+	{
+		unspill(buffer, i);
+	}
+	ASSERT_TRUE(buffer.isEmpty());
+	ASSERT_TRUE(buffer.read() == NULL);
+	buffer.close();
+	unlink(path);
+}
+
+TEST(SpillBuffer, Wrap)
+{
+	char path[] = "/tmp/spillXXXXXX";
+	close(mkstemp(path));
+	SpillBuffer buffer;
+	buffer.open(path, 2000, false);
+	long written = 0, read = 0;
+	for (int pass = 0; pass < 100; pass++)
+	{
+		for (int i = 0; i < 5; i++)
+		{
+			ASSERT_TRUE(spill(buffer, written++));
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			unspill(buffer, read++);
+		}
+		while (buffer.getCount() > 8)
+		{
+			unspill(buffer, read++);
+		}
+	}
+	while (!buffer.isEmpty())
+	{
+		unspill(buffer, read++);
+	}
+	ASSERT_EQ(read, written);
+	ASSERT_EQ(buffer.getDropped(), 0);
+	buffer.close();
+	unlink(path);
+}
+
+TEST(SpillBuffer, Full)
+{
+	char path[] = "/tmp/spillXXXXXX";
+	close(mkstemp(path));
+	SpillBuffer buffer;
+	buffer.open(path, 1000, false);
+	long written = 0;
+	while (spill(buffer, written))
+	{
+		written++;
+	}
+	ASSERT_EQ(buffer.getCount(), written);
+	ASSERT_EQ(buffer.getDropped(), 1);
+
+	// Discarding the newest keeps the first readings
+	unspill(buffer, 0);
+	ASSERT_TRUE(spill(buffer, written));
+
+	// Overwriting discards the oldest readings
+	buffer.setOverwrite(true);
+	ASSERT_TRUE(spill(buffer, written + 1));
+	ASSERT_EQ(buffer.getDropped(), 2);
+	unspill(buffer, 2);
+	buffer.close();
+	unlink(path);
+}
+
+TEST(SpillBuffer, Recover)
+{
+	char path[] = "/tmp/spillXXXXXX";
+	close(mkstemp(path));
+	{
+		SpillBuffer buffer;
+		buffer.open(path, 4096, true);
+		for (long i = 0; i < 5; i++)
+		{
+			ASSERT_TRUE(spill(buffer, i));
+		}
+		unspill(buffer, 0);
+	}
+	SpillBuffer buffer;
+	buffer.open(path, 4096, true);
+	ASSERT_EQ(buffer.getCount(), 4);
+	for (long i = 1; i < 5; i++)
+	{
+		unspill(buffer, i);
+	}
+
+	// A different size discards the readings held
+	ASSERT_TRUE(spill(buffer, 5));
+	buffer.open(path, 8192, true);
+	ASSERT_TRUE(buffer.isEmpty());
+	buffer.close();
+	unlink(path);
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <tag_file.h>
+#include <fstream>
+#include <unistd.h>
+#include <sys/time.h>
+#include <stdlib.h>
+
+using namespace std;
+
+/**
+ * Write a tag file with a modification time that differs from that
+ * of any previous version of the file
+ */
+static void writeFile(const string& path, const string& content, time_t mtime)
+{
+	ofstream file(path, ios::trunc);
+	file << content;
+	file.close();
+	struct timeval times[2];
+	times[0].tv_sec = times[1].tv_sec = mtime;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	utimes(path.c_str(), times);
+}
+
+TEST(TagFile, CSV)
+{
+	char path[] = "/tmp/tagfileXXXXXX";
+	close(mkstemp(path));
+	writeFile(path, "nodeid,name,group,deadband\n"
+			"ns=2;s=Temperature,temperature,line1,0.5\n"
+			"\"ns=2;s=Pressure,A\",pressure,line1,\n"
+			"# A comment\n"
+			"\n"
+			"ns=2;i=1042\n"
+			"ns=2;i=1043,,,bad\n", 1000);
+	TagFile tags;
+	ASSERT_TRUE(tags.load(path));
+	ASSERT_EQ(tags.getTags().size(), 3);
+	ASSERT_EQ(tags.getParsed(), 3);
+
+	const Tag *tag = tags.find(OpcUa::NodeId("Temperature", 2));
+	ASSERT_TRUE(tag != NULL);
+	ASSERT_EQ(tag->name, "temperature");
+	ASSERT_EQ(tag->group, "line1");
+	ASSERT_EQ(tag->deadband, 0.5);
+
+	tag = tags.find(OpcUa::NodeId("Pressure,A", 2));
+	ASSERT_TRUE(tag != NULL);
+	ASSERT_EQ(tag->name, "pressure");
+	ASSERT_EQ(tag->deadband, 0.0);
+
+	tag = tags.find(OpcUa::NodeId(1042, 2));
+	ASSERT_TRUE(tag != NULL);
+	ASSERT_TRUE(tag->name.empty());
+	ASSERT_TRUE(tags.find(OpcUa::NodeId(1043, 2)) == NULL);
+	unlink(path);
+}
+
+TEST(TagFile, JSONLines)
+{
+	char path[] = "/tmp/tagfileXXXXXX";
+	close(mkstemp(path));
+	writeFile(path, "{\"nodeid\":\"ns=2;s=Temperature\",\"name\":\"temperature\",\"deadband\":2}\n"
+			"{\"nodeid\":\"ns=2;i=1042\",\"group\":\"line2\"}\n"
+			"{\"name\":\"missing\"}\n", 1000);
+	TagFile tags;
+	ASSERT_TRUE(tags.load(path));
+	ASSERT_EQ(tags.getTags().size(), 2);
+
+	const Tag *tag = tags.find(OpcUa::NodeId("Temperature", 2));
+	ASSERT_TRUE(tag != NULL);
+	ASSERT_EQ(tag->name, "temperature");
+	ASSERT_EQ(tag->deadband, 2.0);
+
+	tag = tags.find(OpcUa::NodeId(1042, 2));
+	ASSERT_TRUE(tag != NULL);
+	ASSERT_EQ(tag->group, "line2");
+	unlink(path);
+}
+
+TEST(TagFile, Reload)
+{
+	char path[] = "/tmp/tagfileXXXXXX";
+	close(mkstemp(path));
+	writeFile(path, "ns=2;i=1,one\nns=2;i=2,two\nns=2;i=3,three\n", 1000);
+	TagFile tags;
+	ASSERT_TRUE(tags.load(path));
+	ASSERT_EQ(tags.getParsed(), 3);
+
+	// An unmodified file is not read again
+	ASSERT_FALSE(tags.load(path));
+
+	// Only the changed and added rows are parsed
+	writeFile(path, "ns=2;i=1,one\nns=2;i=2,second\nns=2;i=4,four\n", 2000);
+	ASSERT_TRUE(tags.load(path));
+	ASSERT_EQ(tags.getParsed(), 2);
+	ASSERT_EQ(tags.getTags().size(), 3);
+	ASSERT_EQ(tags.find(OpcUa::NodeId(2, 2))->name, "second");
+	ASSERT_TRUE(tags.find(OpcUa::NodeId(3, 2)) == NULL);
+	ASSERT_TRUE(tags.find(OpcUa::NodeId(4, 2)) != NULL);
+	unlink(path);
+}
+
+TEST(TagFile, Server)
+{
+	char path[] = "/tmp/tagfileXXXXXX";
+	close(mkstemp(path));
+	writeFile(path, "ns=2;i=1,one,,,opc.tcp://line2:4840/\n"
+			"ns=2;i=2,two,,, 1 \n"
+			"ns=2;i=3,three\n"
+			"{\"nodeid\":\"ns=2;i=4\",\"server\":2}\n"
+			"{\"nodeid\":\"ns=2;i=5\",\"server\":\"opc.tcp://line3:4840/\"}\n"
+			"{\"nodeid\":\"ns=2;i=6\",\"server\":true}\n", 1000);
+	TagFile tags;
+	ASSERT_TRUE(tags.load(path));
+	ASSERT_EQ(tags.getTags().size(), 5);
+	ASSERT_EQ(tags.find(OpcUa::NodeId(1, 2))->server, "opc.tcp://line2:4840/");
+	ASSERT_EQ(tags.find(OpcUa::NodeId(2, 2))->server, "1");
+	ASSERT_TRUE(tags.find(OpcUa::NodeId(3, 2))->server.empty());
+	ASSERT_EQ(tags.find(OpcUa::NodeId(4, 2))->server, "2");
+	ASSERT_EQ(tags.find(OpcUa::NodeId(5, 2))->server, "opc.tcp://line3:4840/");
+	ASSERT_TRUE(tags.find(OpcUa::NodeId(6, 2)) == NULL);
+	unlink(path);
+}
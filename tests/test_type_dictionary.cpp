@@ -0,0 +1,335 @@
+#include <gtest/gtest.h>
+#include <type_dictionary.h>
+#include <string.h>
+
+using namespace std;
+
+// The encoding of a StructureDefinition and the StructureType values
+#define STRUCTURE_DEFINITION_ENCODING	122
+#define STRUCTURE			0
+#define STRUCTURE_WITH_OPTIONAL_FIELDS	1
+#define UNION				2
+
+/**
+ * A buffer of values in the OPC UA binary encoding
+ */
+class Encoder
+{
+	public:
+		template <typename T> Encoder&
+				put(T value)
+				{
+					const uint8_t *p = (const uint8_t *)&value;
+					bytes.insert(bytes.end(), p, p + sizeof(T));
+					return *this;
+				};
+		Encoder&	putString(const string& value)
+				{
+					put<int32_t>(value.size());
+					bytes.insert(bytes.end(), value.begin(), value.end());
+					return *this;
+				};
+		Encoder&	putBytes(const vector<uint8_t>& value)
+				{
+					bytes.insert(bytes.end(), value.begin(), value.end());
+					return *this;
+				};
+		vector<uint8_t>	bytes;
+};
+
+/**
+ * Encode a numeric NodeId
+ */
+static vector<uint8_t> numericId(uint32_t id, uint16_t ns = 0)
+{
+	Encoder encoder;
+	encoder.put<uint8_t>(2).put<uint16_t>(ns).put<uint32_t>(id);
+	return encoder.bytes;
+}
+
+/**
+ * Encode the NodeId of a built in data type, which is the number of
+ * the built in type
+ */
+static vector<uint8_t> builtinId(OpcUa::VariantType type)
+{
+	return numericId((uint32_t)type);
+}
+
+/**
+ * Encode a Guid NodeId
+ */
+static vector<uint8_t> guidId(const OpcUa::Guid& guid, uint16_t ns)
+{
+	Encoder encoder;
+	encoder.put<uint8_t>(4).put<uint16_t>(ns);
+	encoder.put<uint32_t>(guid.Data1).put<uint16_t>(guid.Data2).put<uint16_t>(guid.Data3);
+	for (int i = 0; i < 8; i++)
+	{
+		encoder.put<uint8_t>(guid.Data4[i]);
+	}
+	return encoder.bytes;
+}
+
+/**
+ * A field of a structure definition
+ */
+struct FieldSpec
+{
+	string		name;
+	vector<uint8_t>	dataType;
+	int32_t		valueRank;
+	bool		optional;
+};
+
+/**
+ * Build the DataTypeDefinition attribute value of a structure
+ */
+static OpcUa::DataValue definition(int32_t structureType, const vector<FieldSpec>& fields)
+{
+	Encoder encoder;
+	encoder.putBytes(numericId(0)).putBytes(numericId(22));
+	encoder.put<int32_t>(structureType).put<int32_t>(fields.size());
+	for (auto& field : fields)
+	{
+		encoder.putString(field.name);
+		encoder.put<uint8_t>(0);		// Description
+		encoder.putBytes(field.dataType);
+		encoder.put<int32_t>(field.valueRank);
+		encoder.put<int32_t>(-1);		// ArrayDimensions
+		encoder.put<uint32_t>(0);		// MaxStringLength
+		encoder.put<uint8_t>(field.optional ? 1 : 0);
+	}
+	OpcUa::ExtensionObject object;
+	object.TypeId = OpcUa::NodeId(STRUCTURE_DEFINITION_ENCODING, 0);
+	object.Encoding = OpcUa::HAS_BINARY_BODY;
+	object.Body.Data = encoder.bytes;
+	OpcUa::DataValue value = OpcUa::DataValue(OpcUa::Variant(object));
+	value.Status = OpcUa::StatusCode::Good;
+	return value;
+}
+
+/**
+ * Build a structured value with a binary body
+ */
+static OpcUa::ExtensionObject structure(const OpcUa::NodeId& encoding, const vector<uint8_t>& body)
+{
+	OpcUa::ExtensionObject object;
+	object.TypeId = encoding;
+	object.Encoding = OpcUa::HAS_BINARY_BODY;
+	object.Body.Data = body;
+	return object;
+}
+
+/**
+ * Teach a dictionary a structured type, as the server connection does
+ * once a value of the type has been received
+ *
+ * @param types		The dictionary
+ * @param encoding	The NodeId of the encoding of the type
+ * @param dataType	The NodeId of the type
+ * @param definitions	The definitions of the type and of its nested types
+ */
+static void define(TypeDictionary& types, const OpcUa::NodeId& encoding, const OpcUa::NodeId& dataType,
+		const vector<pair<OpcUa::NodeId, OpcUa::DataValue> >& definitions)
+{
+	DatapointValue value(0L);
+	ASSERT_FALSE(types.decode(structure(encoding, vector<uint8_t>()), value));
+	ASSERT_EQ(types.getWanted().size(), 1);
+	types.addEncoding(encoding, dataType);
+	for (auto& item : definitions)
+	{
+		types.addDefinition(item.first, item.second);
+	}
+	ASSERT_TRUE(types.getUndefined().empty());
+	ASSERT_EQ(types.compile(), 1);
+}
+
+/**
+ * Return the datapoints of a decoded structure
+ */
+static vector<Datapoint *>& fields(DatapointValue& value)
+{
+	EXPECT_EQ(value.getType(), DatapointValue::T_DP_DICT);
+	return *value.getDpVec();
+}
+
+TEST(TypeDictionary, FixedOffsets)
+{
+	OpcUa::NodeId point(1001, 2), sample(1002, 2), encoding(1003, 2);
+	TypeDictionary types;
+	define(types, encoding, sample, {
+		{ point, definition(STRUCTURE, {
+			{ "x", builtinId(OpcUa::VariantType::DOUBLE), -1, false },
+			{ "y", builtinId(OpcUa::VariantType::DOUBLE), -1, false },
+			{ "flag", builtinId(OpcUa::VariantType::BYTE), -1, false },
+			{ "count", builtinId(OpcUa::VariantType::INT32), -1, false } }) },
+		{ sample, definition(STRUCTURE, {
+			{ "position", numericId(1001, 2), -1, false },
+			{ "scale", builtinId(OpcUa::VariantType::FLOAT), -1, false } }) } });
+
+	// The position is 21 bytes, so the scale is at offset 21
+	Encoder body;
+	body.put<double>(1.5).put<double>(-2.25).put<uint8_t>(7).put<int32_t>(-42).put<float>(0.5f);
+	DatapointValue value(0L);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+	vector<Datapoint *>& points = fields(value);
+	ASSERT_EQ(points.size(), 2);
+	ASSERT_EQ(points[0]->getName(), "position");
+	vector<Datapoint *>& position = fields(points[0]->getData());
+	ASSERT_EQ(position.size(), 4);
+	ASSERT_EQ(position[0]->getData().toDouble(), 1.5);
+	ASSERT_EQ(position[1]->getData().toDouble(), -2.25);
+	ASSERT_EQ(position[2]->getData().toInt(), 7);
+	ASSERT_EQ(position[3]->getName(), "count");
+	ASSERT_EQ(position[3]->getData().toInt(), -42);
+	ASSERT_EQ(points[1]->getName(), "scale");
+	ASSERT_EQ(points[1]->getData().toDouble(), 0.5);
+
+	// One byte short of the fixed size
+	body.bytes.pop_back();
+	ASSERT_FALSE(types.decode(structure(encoding, body.bytes), value));
+}
+
+TEST(TypeDictionary, OptionalFields)
+{
+	OpcUa::NodeId type(2001, 2), encoding(2002, 2);
+	TypeDictionary types;
+	define(types, encoding, type, {
+		{ type, definition(STRUCTURE_WITH_OPTIONAL_FIELDS, {
+			{ "id", builtinId(OpcUa::VariantType::INT32), -1, false },
+			{ "limit", builtinId(OpcUa::VariantType::INT32), -1, true },
+			{ "label", builtinId(OpcUa::VariantType::STRING), -1, true },
+			{ "mode", builtinId(OpcUa::VariantType::UINT16), -1, true } }) } });
+
+	// Only the first and third optional fields are present
+	Encoder body;
+	body.put<uint32_t>(0x5).put<int32_t>(12).put<int32_t>(100).put<uint16_t>(3);
+	DatapointValue value(0L);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+	vector<Datapoint *>& points = fields(value);
+	ASSERT_EQ(points.size(), 3);
+	ASSERT_EQ(points[0]->getName(), "id");
+	ASSERT_EQ(points[0]->getData().toInt(), 12);
+	ASSERT_EQ(points[1]->getName(), "limit");
+	ASSERT_EQ(points[1]->getData().toInt(), 100);
+	ASSERT_EQ(points[2]->getName(), "mode");
+	ASSERT_EQ(points[2]->getData().toInt(), 3);
+
+	// No optional fields
+	Encoder none;
+	none.put<uint32_t>(0).put<int32_t>(13);
+	ASSERT_TRUE(types.decode(structure(encoding, none.bytes), value));
+	ASSERT_EQ(fields(value).size(), 1);
+}
+
+TEST(TypeDictionary, Union)
+{
+	OpcUa::NodeId type(3001, 2), encoding(3002, 2);
+	TypeDictionary types;
+	define(types, encoding, type, {
+		{ type, definition(UNION, {
+			{ "number", builtinId(OpcUa::VariantType::INT32), -1, false },
+			{ "text", builtinId(OpcUa::VariantType::STRING), -1, false } }) } });
+
+	Encoder body;
+	body.put<uint32_t>(2).putString("on");
+	DatapointValue value(0L);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+	vector<Datapoint *>& points = fields(value);
+	ASSERT_EQ(points.size(), 1);
+	ASSERT_EQ(points[0]->getName(), "text");
+	ASSERT_EQ(points[0]->getData().toStringValue(), "on");
+
+	// A switch field of 0 selects no field
+	Encoder empty;
+	empty.put<uint32_t>(0);
+	ASSERT_TRUE(types.decode(structure(encoding, empty.bytes), value));
+	ASSERT_EQ(fields(value).size(), 0);
+}
+
+TEST(TypeDictionary, Arrays)
+{
+	OpcUa::NodeId type(4001, 2), encoding(4002, 2);
+	TypeDictionary types;
+	define(types, encoding, type, {
+		{ type, definition(STRUCTURE, {
+			{ "samples", builtinId(OpcUa::VariantType::DOUBLE), 1, false },
+			{ "names", builtinId(OpcUa::VariantType::STRING), 1, false } }) } });
+
+	Encoder body;
+	body.put<int32_t>(3).put<double>(1.0).put<double>(2.5).put<double>(-4.0);
+	body.put<int32_t>(2).putString("left").putString("right");
+	DatapointValue value(0L);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+	vector<Datapoint *>& points = fields(value);
+	ASSERT_EQ(points.size(), 2);
+	ASSERT_EQ(points[0]->getData().getType(), DatapointValue::T_FLOAT_ARRAY);
+	vector<double> samples = *points[0]->getData().getDpArr();
+	ASSERT_EQ(samples.size(), 3);
+	ASSERT_EQ(samples[1], 2.5);
+	ASSERT_EQ(samples[2], -4.0);
+	ASSERT_EQ(points[1]->getData().getType(), DatapointValue::T_DP_LIST);
+	vector<Datapoint *> names = *points[1]->getData().getDpVec();
+	ASSERT_EQ(names.size(), 2);
+	ASSERT_EQ(names[0]->getName(), "0");
+	ASSERT_EQ(names[1]->getData().toStringValue(), "right");
+}
+
+TEST(TypeDictionary, Truncated)
+{
+	OpcUa::NodeId type(5001, 2), encoding(5002, 2);
+	TypeDictionary types;
+	define(types, encoding, type, {
+		{ type, definition(STRUCTURE, {
+			{ "count", builtinId(OpcUa::VariantType::INT32), -1, false },
+			{ "label", builtinId(OpcUa::VariantType::STRING), -1, false },
+			{ "samples", builtinId(OpcUa::VariantType::DOUBLE), 1, false } }) } });
+
+	DatapointValue value(0L);
+	Encoder body;
+	body.put<int32_t>(1).putString("gauge").put<int32_t>(2).put<double>(1.0).put<double>(2.0);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+
+	// The string runs past the end of the body
+	Encoder text;
+	text.put<int32_t>(1).put<int32_t>(20).put<uint8_t>('g');
+	ASSERT_FALSE(types.decode(structure(encoding, text.bytes), value));
+
+	// The array holds more elements than the body
+	Encoder array;
+	array.put<int32_t>(1).putString("gauge").put<int32_t>(1000).put<double>(1.0);
+	ASSERT_FALSE(types.decode(structure(encoding, array.bytes), value));
+
+	// The body ends part way through the last element
+	body.bytes.resize(body.bytes.size() - 4);
+	ASSERT_FALSE(types.decode(structure(encoding, body.bytes), value));
+}
+
+TEST(TypeDictionary, GuidDataType)
+{
+	OpcUa::Guid guid;
+	guid.Data1 = 0x12345678;
+	guid.Data2 = 0x9abc;
+	guid.Data3 = 0xdef0;
+	for (int i = 0; i < 8; i++)
+	{
+		guid.Data4[i] = i;
+	}
+	OpcUa::NodeId nested = OpcUa::GuidNodeId(guid, 3);
+	OpcUa::NodeId type(6001, 3), encoding(6002, 3);
+	TypeDictionary types;
+	define(types, encoding, type, {
+		{ nested, definition(STRUCTURE, {
+			{ "value", builtinId(OpcUa::VariantType::INT32), -1, false } }) },
+		{ type, definition(STRUCTURE, {
+			{ "inner", guidId(guid, 3), -1, false } }) } });
+
+	Encoder body;
+	body.put<int32_t>(99);
+	DatapointValue value(0L);
+	ASSERT_TRUE(types.decode(structure(encoding, body.bytes), value));
+	vector<Datapoint *>& points = fields(value);
+	ASSERT_EQ(points.size(), 1);
+	ASSERT_EQ(fields(points[0]->getData())[0]->getData().toInt(), 99);
+}
@@ -0,0 +1,889 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2018 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch, Massimiliano Pinto
+ */
+#include <type_dictionary.h>
+#include <logger.h>
+#include <stdexcept>
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+
+// NodeIds of the encodings of the DataTypeDefinition attribute values
+#define STRUCTURE_DEFINITION_ENCODING	122
+#define ENUM_DEFINITION_ENCODING	123
+
+// The StructureType values of a StructureDefinition
+#define STRUCTURE			0
+#define STRUCTURE_WITH_OPTIONAL_FIELDS	1
+#define UNION				2
+
+// ExtensionObject encoding with a binary body
+#define BINARY_BODY	1
+
+// Maximum nesting of structured types
+#define MAX_TYPE_DEPTH	16
+
+/**
+ * A reader of values in the OPC UA binary encoding. The encoding is
+ * little endian, as are the hosts the plugin runs on, so values are
+ * copied without conversion.
+ */
+class BinaryReader
+{
+	public:
+		BinaryReader(const uint8_t *data, size_t size) : m_data(data), m_size(size), m_pos(0) {};
+		size_t		remaining() const { return m_size - m_pos; };
+		const uint8_t	*take(size_t length)
+				{
+					if (m_size - m_pos < length)
+					{
+						throw runtime_error("Encoded value is truncated");
+					}
+					const uint8_t *data = m_data + m_pos;
+					m_pos += length;
+					return data;
+				};
+		template <typename T> T
+				read()
+				{
+					T value;
+					memcpy(&value, take(sizeof(T)), sizeof(T));
+					return value;
+				};
+		string		readString();
+		OpcUa::NodeId	readNodeId();
+		string		readLocalizedText();
+
+	private:
+		const uint8_t	*m_data;
+		size_t		m_size;
+		size_t		m_pos;
+};
+
+/**
+ * Read a String or ByteString
+ */
+string
+BinaryReader::readString()
+{
+	int32_t length = read<int32_t>();
+	if (length <= 0)
+	{
+		return "";
+	}
+	const uint8_t *data = take(length);
+	return string((const char *)data, length);
+}
+
+/**
+ * Return the bytes of a ByteString as hexadecimal
+ */
+static string hexString(const string& bytes)
+{
+	static const char digits[] = "0123456789abcdef";
+	string hex;
+	hex.reserve(bytes.size() * 2);
+	for (auto c : bytes)
+	{
+		hex += digits[((uint8_t)c) >> 4];
+		hex += digits[((uint8_t)c) & 0x0f];
+	}
+	return hex;
+}
+
+/**
+ * Return an encoded Guid in its string form
+ */
+static string guidString(const uint8_t *data)
+{
+	uint32_t data1;
+	uint16_t data2, data3;
+	memcpy(&data1, data, 4);
+	memcpy(&data2, data + 4, 2);
+	memcpy(&data3, data + 6, 2);
+	char guid[40];
+	snprintf(guid, sizeof(guid), "%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+			data1, data2, data3, data[8], data[9],
+			data[10], data[11], data[12], data[13], data[14], data[15]);
+	return string(guid);
+}
+
+/**
+ * Return an encoded DateTime, a count of 100 nanosecond intervals
+ * since 1601, in the format YYYY-MM-DD HH24:MM:SS.US+00:00
+ */
+static string dateTimeString(int64_t raw)
+{
+	const int64_t secsFrom1601To1970 = 134774 * 24 * 3600LL;
+	time_t seconds = raw / 10000000LL - secsFrom1601To1970;
+	long usec = (raw % 10000000LL) / 10;
+
+	struct tm timeinfo;
+	gmtime_r(&seconds, &timeinfo);
+	char date_time[80], micro[10];
+	strftime(date_time, sizeof(date_time), "%Y-%m-%d %H:%M:%S", &timeinfo);
+	snprintf(micro, sizeof(micro), ".%06ld", usec);
+	return string(date_time) + micro + "+00:00";
+}
+
+/**
+ * Read a NodeId or ExpandedNodeId. Guid and opaque identifiers keep
+ * their type, so they match the NodeIds of the data types returned by
+ * the server in other responses.
+ */
+OpcUa::NodeId
+BinaryReader::readNodeId()
+{
+	uint8_t encoding = read<uint8_t>();
+	OpcUa::NodeId nodeId;
+	switch (encoding & 0x3f)
+	{
+		case 0:
+			nodeId = OpcUa::NodeId((uint32_t)read<uint8_t>(), 0);
+			break;
+		case 1:
+		{
+			uint8_t ns = read<uint8_t>();
+			nodeId = OpcUa::NodeId((uint32_t)read<uint16_t>(), ns);
+			break;
+		}
+		case 2:
+		{
+			uint16_t ns = read<uint16_t>();
+			nodeId = OpcUa::NodeId(read<uint32_t>(), ns);
+			break;
+		}
+		case 3:
+		{
+			uint16_t ns = read<uint16_t>();
+			nodeId = OpcUa::NodeId(readString(), ns);
+			break;
+		}
+		case 4:
+		{
+			uint16_t ns = read<uint16_t>();
+			OpcUa::Guid guid;
+			guid.Data1 = read<uint32_t>();
+			guid.Data2 = read<uint16_t>();
+			guid.Data3 = read<uint16_t>();
+			memcpy(guid.Data4, take(8), 8);
+			nodeId = OpcUa::GuidNodeId(guid, ns);
+			break;
+		}
+		case 5:
+		{
+			uint16_t ns = read<uint16_t>();
+			string bytes = readString();
+			nodeId = OpcUa::ByteStringNodeId(vector<uint8_t>(bytes.begin(), bytes.end()), ns);
+			break;
+		}
+		default:
+			throw runtime_error("Invalid NodeId encoding");
+	}
+	if (encoding & 0x80)
+	{
+		readString();		// Namespace URI of an ExpandedNodeId
+	}
+	if (encoding & 0x40)
+	{
+		read<uint32_t>();	// Server index of an ExpandedNodeId
+	}
+	return nodeId;
+}
+
+/**
+ * Read a LocalizedText, returning only the text
+ */
+string
+BinaryReader::readLocalizedText()
+{
+	uint8_t mask = read<uint8_t>();
+	if (mask & 0x01)
+	{
+		readString();		// Locale
+	}
+	return (mask & 0x02) ? readString() : "";
+}
+
+/**
+ * Return the built in type of a data type, including the standard
+ * data types that are encoded as a built in type.
+ *
+ * @param dataType	The NodeId of the data type
+ * @return		The built in type, NUL if not a built in type
+ */
+static OpcUa::VariantType builtinType(const OpcUa::NodeId& dataType)
+{
+	if (!dataType.IsInteger() || dataType.GetNamespaceIndex() != 0)
+	{
+		return OpcUa::VariantType::NUL;
+	}
+	uint32_t id = dataType.GetIntegerIdentifier();
+	if (id >= 1 && id <= 22)
+	{
+		// Built in types up to ExtensionObject, which is also the
+		// encoding of a field of the abstract Structure type
+		return static_cast<OpcUa::VariantType>(id);
+	}
+	switch (id)
+	{
+		case 290:	// Duration
+			return OpcUa::VariantType::DOUBLE;
+		case 294:	// UtcTime
+			return OpcUa::VariantType::DATE_TIME;
+		case 288:	// IntegerId
+		case 289:	// Counter
+		case 20998:	// VersionTime
+			return OpcUa::VariantType::UINT32;
+		case 291:	// NumericRange
+		case 295:	// LocaleId
+		case 12878:	// NormalizedString
+		case 12879:	// DecimalString
+		case 12880:	// DurationString
+		case 12881:	// TimeString
+		case 12882:	// DateString
+			return OpcUa::VariantType::STRING;
+		default:
+			return OpcUa::VariantType::NUL;
+	}
+}
+
+/**
+ * Return the encoded size of a built in type, 0 if the size varies
+ */
+static size_t fixedSize(OpcUa::VariantType type)
+{
+	switch (type)
+	{
+		case OpcUa::VariantType::BOOLEAN:
+		case OpcUa::VariantType::SBYTE:
+		case OpcUa::VariantType::BYTE:
+			return 1;
+		case OpcUa::VariantType::INT16:
+		case OpcUa::VariantType::UINT16:
+			return 2;
+		case OpcUa::VariantType::INT32:
+		case OpcUa::VariantType::UINT32:
+		case OpcUa::VariantType::FLOAT:
+		case OpcUa::VariantType::STATUS_CODE:
+			return 4;
+		case OpcUa::VariantType::INT64:
+		case OpcUa::VariantType::UINT64:
+		case OpcUa::VariantType::DOUBLE:
+		case OpcUa::VariantType::DATE_TIME:
+			return 8;
+		case OpcUa::VariantType::GUId:
+			return 16;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Load a value of a fixed size type from an encoded buffer
+ */
+template <typename T> static T load(const uint8_t *data)
+{
+	T value;
+	memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+/**
+ * Return the numeric value of a fixed size built in type
+ */
+static double numberAt(const uint8_t *data, OpcUa::VariantType type)
+{
+	switch (type)
+	{
+		case OpcUa::VariantType::BOOLEAN:
+		case OpcUa::VariantType::BYTE:
+			return *data;
+		case OpcUa::VariantType::SBYTE:
+			return (int8_t)*data;
+		case OpcUa::VariantType::INT16:
+			return load<int16_t>(data);
+		case OpcUa::VariantType::UINT16:
+			return load<uint16_t>(data);
+		case OpcUa::VariantType::INT32:
+			return load<int32_t>(data);
+		case OpcUa::VariantType::UINT32:
+		case OpcUa::VariantType::STATUS_CODE:
+			return load<uint32_t>(data);
+		case OpcUa::VariantType::INT64:
+			return load<int64_t>(data);
+		case OpcUa::VariantType::UINT64:
+			return load<uint64_t>(data);
+		case OpcUa::VariantType::FLOAT:
+			return load<float>(data);
+		case OpcUa::VariantType::DOUBLE:
+			return load<double>(data);
+		default:
+			throw runtime_error("Not a numeric type");
+	}
+}
+
+/**
+ * Return the value of a fixed size built in type
+ */
+static DatapointValue valueAt(const uint8_t *data, OpcUa::VariantType type)
+{
+	switch (type)
+	{
+		case OpcUa::VariantType::FLOAT:
+		case OpcUa::VariantType::DOUBLE:
+			return DatapointValue(numberAt(data, type));
+		case OpcUa::VariantType::INT64:
+			return DatapointValue((long)load<int64_t>(data));
+		case OpcUa::VariantType::UINT64:
+			return DatapointValue((long)load<uint64_t>(data));
+		case OpcUa::VariantType::DATE_TIME:
+			return DatapointValue(dateTimeString(load<int64_t>(data)));
+		case OpcUa::VariantType::GUId:
+			return DatapointValue(guidString(data));
+		default:
+			return DatapointValue((long)numberAt(data, type));
+	}
+}
+
+/**
+ * Read a value of a built in type
+ */
+static DatapointValue readBuiltin(BinaryReader& reader, OpcUa::VariantType type)
+{
+	size_t size = fixedSize(type);
+	if (size)
+	{
+		return valueAt(reader.take(size), type);
+	}
+	switch (type)
+	{
+		case OpcUa::VariantType::STRING:
+		case OpcUa::VariantType::XML_ELEMENT:
+			return DatapointValue(reader.readString());
+		case OpcUa::VariantType::BYTE_STRING:
+			return DatapointValue(hexString(reader.readString()));
+		case OpcUa::VariantType::NODE_Id:
+		case OpcUa::VariantType::EXPANDED_NODE_Id:
+			return DatapointValue(OpcUa::ToString(reader.readNodeId()));
+		case OpcUa::VariantType::QUALIFIED_NAME:
+		{
+			uint16_t ns = reader.read<uint16_t>();
+			return DatapointValue(to_string(ns) + ":" + reader.readString());
+		}
+		case OpcUa::VariantType::LOCALIZED_TEXT:
+			return DatapointValue(reader.readLocalizedText());
+		default:
+			throw runtime_error("Unsupported field type");
+	}
+}
+
+/**
+ * Free a vector of datapoints that has not been passed to a DatapointValue
+ */
+static void freeDatapoints(vector<Datapoint *> *points)
+{
+	for (auto point : *points)
+	{
+		delete point;
+	}
+	delete points;
+}
+
+/**
+ * Decode a structure whose fields all have a fixed size, using the
+ * offsets of the fields computed when the type was compiled. The
+ * caller has checked the buffer holds the whole structure.
+ *
+ * @param type	The structured type
+ * @param data	The encoded structure
+ * @return	The datapoints of the fields of the structure
+ */
+static vector<Datapoint *> *decodeFixed(const StructType& type, const uint8_t *data)
+{
+	vector<Datapoint *> *points = new vector<Datapoint *>;
+	points->reserve(type.fields.size());
+	for (auto& field : type.fields)
+	{
+		if (field.type)
+		{
+			vector<Datapoint *> *nested = decodeFixed(*field.type, data + field.offset);
+			DatapointValue value(nested, true);
+			points->push_back(new Datapoint(field.name, value));
+		}
+		else
+		{
+			DatapointValue value = valueAt(data + field.offset, field.builtin);
+			points->push_back(new Datapoint(field.name, value));
+		}
+	}
+	return points;
+}
+
+/**
+ * Clear the dictionary when a new session is created with the server
+ */
+void
+TypeDictionary::clear()
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_encodings.clear();
+	m_wanted.clear();
+	m_requested.clear();
+	m_encodingTypes.clear();
+	m_definitions.clear();
+	m_compiled.clear();
+}
+
+/**
+ * Decode a structured value into a dictionary of datapoints with one
+ * datapoint per field. If the encoding of the value has not been seen
+ * before it is noted, to be looked up, and the value is not decoded.
+ *
+ * @param object	The encoded structure
+ * @param value		Set to the decoded value
+ * @return		True if the value was decoded
+ */
+bool
+TypeDictionary::decode(const OpcUa::ExtensionObject& object, DatapointValue& value)
+{
+	if (static_cast<int>(object.Encoding) != BINARY_BODY)
+	{
+		return false;
+	}
+	return decodeBody(object.TypeId, object.Body.Data.data(), object.Body.Data.size(), value);
+}
+
+/**
+ * Decode the binary body of a structured value
+ *
+ * @param typeId	The NodeId of the encoding of the value
+ * @param data		The encoded value
+ * @param size		The size of the encoded value
+ * @param value		Set to the decoded value
+ * @return		True if the value was decoded
+ */
+bool
+TypeDictionary::decodeBody(const OpcUa::NodeId& typeId, const uint8_t *data, size_t size, DatapointValue& value)
+{
+	shared_ptr<const StructType> type;
+	{
+		lock_guard<mutex> guard(m_mutex);
+		auto it = m_encodings.find(typeId);
+		if (it == m_encodings.end())
+		{
+			if (m_requested.find(typeId) == m_requested.end())
+			{
+				m_wanted.insert(typeId);
+			}
+			return false;
+		}
+		type = it->second;
+	}
+	if (!type)
+	{
+		return false;
+	}
+
+	vector<Datapoint *> *points;
+	try {
+		if (type->fixedSize)
+		{
+			if (size < type->size)
+			{
+				return false;
+			}
+			points = decodeFixed(*type, data);
+		}
+		else
+		{
+			BinaryReader reader(data, size);
+			points = decodeStruct(*type, reader);
+		}
+	} catch (exception& e) {
+		return false;
+	}
+	value = DatapointValue(points, true);
+	return true;
+}
+
+/**
+ * Decode a structure field by field
+ *
+ * @param type		The structured type
+ * @param reader	The reader positioned at the structure
+ * @return		The datapoints of the fields of the structure
+ */
+vector<Datapoint *> *
+TypeDictionary::decodeStruct(const StructType& type, BinaryReader& reader)
+{
+	vector<Datapoint *> *points = new vector<Datapoint *>;
+	try {
+		if (type.structureType == UNION)
+		{
+			// Only the field selected by the switch field is encoded
+			uint32_t selected = reader.read<uint32_t>();
+			if (selected >= 1 && selected <= type.fields.size())
+			{
+				const StructField& field = type.fields[selected - 1];
+				DatapointValue value = decodeField(field, reader);
+				points->push_back(new Datapoint(field.name, value));
+			}
+			return points;
+		}
+
+		uint32_t mask = 0xffffffff;
+		if (type.structureType == STRUCTURE_WITH_OPTIONAL_FIELDS)
+		{
+			mask = reader.read<uint32_t>();
+		}
+		int optional = 0;
+		for (auto& field : type.fields)
+		{
+			if (field.optional && (mask & (1u << optional++)) == 0)
+			{
+				continue;
+			}
+			DatapointValue value = decodeField(field, reader);
+			points->push_back(new Datapoint(field.name, value));
+		}
+	} catch (...) {
+		freeDatapoints(points);
+		throw;
+	}
+	return points;
+}
+
+/**
+ * Decode a field of a structure. Arrays of numbers become arrays of
+ * floating point values, other arrays become lists of datapoints.
+ *
+ * @param field		The field
+ * @param reader	The reader positioned at the field
+ * @return		The value of the field
+ */
+DatapointValue
+TypeDictionary::decodeField(const StructField& field, BinaryReader& reader)
+{
+	if (!field.array)
+	{
+		return decodeValue(field, reader);
+	}
+	int32_t length = reader.read<int32_t>();
+	if (length < 0)
+	{
+		length = 0;
+	}
+	if ((size_t)length > reader.remaining())
+	{
+		throw runtime_error("Encoded array is truncated");
+	}
+	size_t size = fixedSize(field.builtin);
+	if (!field.type && size && field.builtin != OpcUa::VariantType::DATE_TIME
+			&& field.builtin != OpcUa::VariantType::GUId)
+	{
+		vector<double> values;
+		values.reserve(length);
+		const uint8_t *data = reader.take(size * length);
+		for (int32_t i = 0; i < length; i++)
+		{
+			values.push_back(numberAt(data + i * size, field.builtin));
+		}
+		return DatapointValue(values);
+	}
+	vector<Datapoint *> *list = new vector<Datapoint *>;
+	try {
+		for (int32_t i = 0; i < length; i++)
+		{
+			DatapointValue value = decodeValue(field, reader);
+			list->push_back(new Datapoint(to_string(i), value));
+		}
+	} catch (...) {
+		freeDatapoints(list);
+		throw;
+	}
+	return DatapointValue(list, false);
+}
+
+/**
+ * Decode a single value of a field
+ *
+ * @param field		The field
+ * @param reader	The reader positioned at the value
+ * @return		The value
+ */
+DatapointValue
+TypeDictionary::decodeValue(const StructField& field, BinaryReader& reader)
+{
+	if (field.type)
+	{
+		vector<Datapoint *> *nested = decodeStruct(*field.type, reader);
+		return DatapointValue(nested, true);
+	}
+	if (field.builtin == OpcUa::VariantType::EXTENSION_OBJECT)
+	{
+		// A field of an abstract type carries its own encoding
+		OpcUa::NodeId typeId = reader.readNodeId();
+		uint8_t encoding = reader.read<uint8_t>();
+		if (encoding != BINARY_BODY)
+		{
+			throw runtime_error("Unsupported structure encoding");
+		}
+		int32_t length = reader.read<int32_t>();
+		if (length < 0)
+		{
+			length = 0;
+		}
+		const uint8_t *data = reader.take(length);
+		DatapointValue value(0L);
+		if (!decodeBody(typeId, data, length, value))
+		{
+			throw runtime_error("Unknown structure type");
+		}
+		return value;
+	}
+	return readBuiltin(reader, field.builtin);
+}
+
+/**
+ * Return the encodings of the structured values that have been received
+ * but not yet looked up. The encodings are marked as being looked up.
+ */
+vector<OpcUa::NodeId>
+TypeDictionary::getWanted()
+{
+	lock_guard<mutex> guard(m_mutex);
+	vector<OpcUa::NodeId> wanted(m_wanted.begin(), m_wanted.end());
+	m_requested.insert(m_wanted.begin(), m_wanted.end());
+	m_wanted.clear();
+	return wanted;
+}
+
+/**
+ * Record the data type of an encoding
+ *
+ * @param encoding	The NodeId of the encoding
+ * @param dataType	The NodeId of the data type, null if not found
+ */
+void
+TypeDictionary::addEncoding(const OpcUa::NodeId& encoding, const OpcUa::NodeId& dataType)
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_encodingTypes[encoding] = dataType;
+}
+
+/**
+ * Return the data types, of the encodings being looked up or of the
+ * fields of their definitions, whose definitions have not been read
+ */
+vector<OpcUa::NodeId>
+TypeDictionary::getUndefined()
+{
+	lock_guard<mutex> guard(m_mutex);
+	set<OpcUa::NodeId> undefined;
+	for (auto& encoding : m_encodingTypes)
+	{
+		if (!encoding.second.IsNull() && m_definitions.find(encoding.second) == m_definitions.end())
+		{
+			undefined.insert(encoding.second);
+		}
+	}
+	for (auto& definition : m_definitions)
+	{
+		for (auto& field : definition.second.fields)
+		{
+			if (builtinType(field.dataType) == OpcUa::VariantType::NUL
+					&& m_definitions.find(field.dataType) == m_definitions.end())
+			{
+				undefined.insert(field.dataType);
+			}
+		}
+	}
+	return vector<OpcUa::NodeId>(undefined.begin(), undefined.end());
+}
+
+/**
+ * Add the definition of a data type, as read from its DataTypeDefinition
+ * attribute. Types whose definition cannot be read are recorded as
+ * unknown and values of those types are not decoded.
+ *
+ * @param dataType	The NodeId of the data type
+ * @param value		The value read from the DataTypeDefinition attribute
+ */
+void
+TypeDictionary::addDefinition(const OpcUa::NodeId& dataType, const OpcUa::DataValue& value)
+{
+	Definition definition;
+	try {
+		if (value.Status == OpcUa::StatusCode::Good && !value.Value.IsNul()
+				&& value.Value.Type() == OpcUa::VariantType::EXTENSION_OBJECT)
+		{
+			OpcUa::ExtensionObject object = static_cast<OpcUa::ExtensionObject>(value.Value);
+			if (object.TypeId == OpcUa::NodeId(ENUM_DEFINITION_ENCODING, 0))
+			{
+				definition.kind = Definition::Enumeration;
+			}
+			else if (object.TypeId == OpcUa::NodeId(STRUCTURE_DEFINITION_ENCODING, 0))
+			{
+				BinaryReader reader(object.Body.Data.data(), object.Body.Data.size());
+				reader.readNodeId();		// DefaultEncodingId
+				reader.readNodeId();		// BaseDataType
+				definition.structureType = reader.read<int32_t>();
+				int32_t n_fields = reader.read<int32_t>();
+				for (int32_t i = 0; i < n_fields; i++)
+				{
+					FieldDefinition field;
+					field.name = reader.readString();
+					reader.readLocalizedText();	// Description
+					field.dataType = reader.readNodeId();
+					field.valueRank = reader.read<int32_t>();
+					int32_t n_dimensions = reader.read<int32_t>();
+					for (int32_t j = 0; j < n_dimensions; j++)
+					{
+						reader.read<uint32_t>();
+					}
+					reader.read<uint32_t>();	// MaxStringLength
+					field.optional = reader.read<uint8_t>() != 0;
+					definition.fields.push_back(field);
+				}
+				definition.kind = Definition::Structure;
+			}
+		}
+	} catch (exception& e) {
+		Logger::getLogger()->warn("Unable to parse the definition of data type %s: %s",
+				OpcUa::ToString(dataType).c_str(), e.what());
+		definition = Definition();
+	}
+	lock_guard<mutex> guard(m_mutex);
+	m_definitions[dataType] = definition;
+}
+
+/**
+ * Compile the types of the encodings being looked up. Encodings whose
+ * type cannot be compiled are recorded so that they are not looked up
+ * again in this session.
+ *
+ * @return	The number of encodings that can now be decoded
+ */
+int
+TypeDictionary::compile()
+{
+	lock_guard<mutex> guard(m_mutex);
+	int compiled = 0;
+	for (auto& encoding : m_requested)
+	{
+		shared_ptr<const StructType> type;
+		auto it = m_encodingTypes.find(encoding);
+		if (it != m_encodingTypes.end() && !it->second.IsNull())
+		{
+			type = compileType(it->second, 0);
+		}
+		m_encodings[encoding] = type;
+		if (type)
+		{
+			compiled++;
+		}
+		else
+		{
+			Logger::getLogger()->warn("Structured values with encoding %s cannot be decoded "
+					"and will be reported as strings", OpcUa::ToString(encoding).c_str());
+		}
+	}
+	m_requested.clear();
+	m_encodingTypes.clear();
+	return compiled;
+}
+
+/**
+ * Return the encodings being looked up to the wanted list, after the
+ * look up has failed, so they are looked up again.
+ */
+void
+TypeDictionary::retry()
+{
+	lock_guard<mutex> guard(m_mutex);
+	m_wanted.insert(m_requested.begin(), m_requested.end());
+	m_requested.clear();
+	m_encodingTypes.clear();
+}
+
+/**
+ * Compile a structured type from its definition and those of its fields.
+ * The caller holds the dictionary lock.
+ *
+ * @param dataType	The NodeId of the data type
+ * @param depth		The nesting depth of the type
+ * @return		The compiled type, empty if the type cannot be decoded
+ */
+shared_ptr<const StructType>
+TypeDictionary::compileType(const OpcUa::NodeId& dataType, int depth)
+{
+	auto compiled = m_compiled.find(dataType);
+	if (compiled != m_compiled.end())
+	{
+		return compiled->second;
+	}
+	auto definition = m_definitions.find(dataType);
+	if (depth > MAX_TYPE_DEPTH || definition == m_definitions.end()
+			|| definition->second.kind != Definition::Structure
+			|| definition->second.structureType > UNION)
+	{
+		return shared_ptr<const StructType>();
+	}
+
+	shared_ptr<StructType> type = make_shared<StructType>();
+	type->structureType = definition->second.structureType;
+	bool fixed = type->structureType == STRUCTURE;
+	size_t offset = 0;
+	for (auto& fieldDefinition : definition->second.fields)
+	{
+		StructField field;
+		field.name = fieldDefinition.name;
+		field.optional = fieldDefinition.optional;
+		if (fieldDefinition.valueRank == 1)
+		{
+			field.array = true;
+		}
+		else if (fieldDefinition.valueRank != -1)
+		{
+			// Multi-dimensional fields are not supported
+			return shared_ptr<const StructType>();
+		}
+		field.builtin = builtinType(fieldDefinition.dataType);
+		if (field.builtin == OpcUa::VariantType::NUL)
+		{
+			auto fieldType = m_definitions.find(fieldDefinition.dataType);
+			if (fieldType != m_definitions.end() && fieldType->second.kind == Definition::Enumeration)
+			{
+				field.builtin = OpcUa::VariantType::INT32;
+			}
+			else
+			{
+				field.type = compileType(fieldDefinition.dataType, depth + 1);
+				if (!field.type)
+				{
+					return shared_ptr<const StructType>();
+				}
+			}
+		}
+		size_t size = field.type ? (field.type->fixedSize ? field.type->size : 0) : fixedSize(field.builtin);
+		if (field.array || size == 0)
+		{
+			fixed = false;
+		}
+		field.offset = offset;
+		offset += size;
+		type->fields.push_back(field);
+	}
+	type->fixedSize = fixed;
+	type->size = fixed ? offset : 0;
+	m_compiled[dataType] = type;
+	return type;
+}